@@ -0,0 +1,41 @@
+#include "AssetCache.hpp"
+
+#if defined (_WIN32)
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+namespace gps {
+
+    uint64_t AssetCache::Hash(const void* data, size_t bytes, uint64_t hash) {
+
+        const unsigned char* p = (const unsigned char*)data;
+        for (size_t i = 0; i < bytes; i++) {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    std::string AssetCache::FileName(const std::string& directory, const char* prefix, uint64_t hash) {
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s_%016llx.bin", prefix, (unsigned long long)hash);
+        return directory + "/" + name;
+    }
+
+    FILE* AssetCache::Create(const std::string& directory, const std::string& fileName) {
+
+#if defined (_WIN32)
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+        FILE* file = fopen(fileName.c_str(), "wb");
+        if (!file) {
+            fprintf(stderr, "WARNING: could not write %s\n", fileName.c_str());
+        }
+        return file;
+    }
+}
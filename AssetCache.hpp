@@ -0,0 +1,26 @@
+#ifndef AssetCache_hpp
+#define AssetCache_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace gps {
+
+    // Precomputed data kept between runs (lightmaps, light probes, the sky's lighting) - each file is named after
+    // a hash of everything it is computed from, so a change to any input simply makes a new one
+    class AssetCache {
+
+    public:
+        // FNV-1a, continued from hash
+        static uint64_t Hash(const void* data, size_t bytes, uint64_t hash = 14695981039346656037ULL);
+
+        // directory/prefix_<hash>.bin
+        static std::string FileName(const std::string& directory, const char* prefix, uint64_t hash);
+
+        // Creates the directory if needed and opens fileName for writing - NULL with a warning on failure
+        static FILE* Create(const std::string& directory, const std::string& fileName);
+    };
+}
+
+#endif /* AssetCache_hpp */
@@ -0,0 +1,287 @@
+#include "BakeScene.hpp"
+#include "AssetCache.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <map>
+
+namespace gps {
+
+    // basic.frag's ambientStrength - the sky's radiance, so a surface open to the whole sky keeps the ambient it had
+    static const float AMBIENT_STRENGTH = 0.2f;
+    // basic.frag's lamp attenuation
+    static const float ATTENUATION_LINEAR = 0.0045f;
+    static const float ATTENUATION_QUADRATIC = 0.0075f;
+    // ray origins are pushed off the surface they leave, in world units
+    static const float RAY_OFFSET = 0.01f;
+
+    BakeScene::Random::Random(uint32_t seed) {
+
+        state = seed * 747796405u + 2891336453u;
+        state ^= state >> 16;
+        state = state == 0 ? 1u : state;
+    }
+
+    float BakeScene::Random::Next() {
+
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    BakeScene::Filter::Filter(const BakeScene& scene, bool lampRays) : scene(scene), lampRays(lampRays) {}
+
+    bool BakeScene::Filter::Accept(int triangle, float u, float v) const {
+
+        const Triangle& hit = scene.triangles[triangle];
+        if (lampRays && hit.lampHousing) {
+            return false;
+        }
+        if (!hit.cutout) {
+            return true;
+        }
+        const unsigned char* texel = scene.FetchTexel(hit, u, v);
+        return texel[0] > 3 || texel[1] > 3 || texel[2] > 3;
+    }
+
+    BakeScene::BakeScene(const std::vector<Caster>& casters, glm::vec3 sunDirection, glm::vec3 sunColor, const std::vector<PointLight>& lamps) {
+
+        this->casters = casters;
+        this->sunDirection = glm::normalize(sunDirection);
+        this->sunColor = sunColor;
+        this->lamps = lamps;
+    }
+
+    BakeScene::~BakeScene() {
+
+        for (size_t i = 0; i < images.size(); i++) {
+            stbi_image_free(images[i].pixels);
+        }
+    }
+
+    // geometry, placement and texture names - the textures themselves are keyed by their path
+    static uint64_t HashModel(gps::Model3D& model, glm::mat4 modelMatrix, uint64_t hash) {
+
+        hash = AssetCache::Hash(&modelMatrix, sizeof(modelMatrix), hash);
+        std::vector<gps::Mesh>& meshes = model.GetMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            if (!meshes[i].vertices.empty()) {
+                hash = AssetCache::Hash(&meshes[i].vertices[0], meshes[i].vertices.size() * sizeof(gps::Vertex), hash);
+            }
+            if (!meshes[i].indices.empty()) {
+                hash = AssetCache::Hash(&meshes[i].indices[0], meshes[i].indices.size() * sizeof(GLuint), hash);
+            }
+            if (!meshes[i].lightmapCoords.empty()) {
+                hash = AssetCache::Hash(&meshes[i].lightmapCoords[0], meshes[i].lightmapCoords.size() * sizeof(glm::vec2), hash);
+            }
+            for (size_t t = 0; t < meshes[i].textures.size(); t++) {
+                hash = AssetCache::Hash(meshes[i].textures[t].path.c_str(), meshes[i].textures[t].path.size() + 1, hash);
+            }
+        }
+        return hash;
+    }
+
+    uint64_t BakeScene::getHash() {
+
+        uint32_t settings[1] = { (uint32_t)BOUNCES };
+        uint64_t hash = AssetCache::Hash(settings, sizeof(settings));
+        for (size_t i = 0; i < casters.size(); i++) {
+            hash = HashModel(*casters[i].model, casters[i].modelMatrix, hash);
+            hash = AssetCache::Hash(&casters[i].lampHousing, sizeof(bool), hash);
+        }
+        hash = AssetCache::Hash(&sunDirection, sizeof(sunDirection), hash);
+        hash = AssetCache::Hash(&sunColor, sizeof(sunColor), hash);
+        for (size_t i = 0; i < lamps.size(); i++) {
+            hash = AssetCache::Hash(&lamps[i].position, sizeof(lamps[i].position), hash);
+            hash = AssetCache::Hash(&lamps[i].range, sizeof(lamps[i].range), hash);
+            hash = AssetCache::Hash(&lamps[i].color, sizeof(lamps[i].color), hash);
+        }
+        return hash;
+    }
+
+    void BakeScene::Build() {
+
+        if (built) {
+            return;
+        }
+        built = true;
+
+        // every opaque or cutout triangle, with the diffuse texture it is shaded with
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        std::vector<glm::vec3> corners;
+        std::map<std::string, int> imageIds;
+        for (size_t m = 0; m < casters.size(); m++) {
+            std::vector<gps::Mesh>& meshes = casters[m].model->GetMeshes();
+            for (size_t i = 0; i < meshes.size(); i++) {
+                gps::Mesh& mesh = meshes[i];
+                int image = -1;
+                bool cutout = false;
+                for (size_t t = 0; t < mesh.textures.size(); t++) {
+                    if (mesh.textures[t].type != "diffuseTexture") {
+                        continue;
+                    }
+                    std::map<std::string, int>::iterator existing = imageIds.find(mesh.textures[t].path);
+                    if (existing == imageIds.end()) {
+                        Image loaded;
+                        int channels;
+                        loaded.pixels = stbi_load(mesh.textures[t].path.c_str(), &loaded.width, &loaded.height, &channels, 4);
+                        int id = loaded.pixels ? (int)images.size() : -1;
+                        if (loaded.pixels) {
+                            images.push_back(loaded);
+                        }
+                        existing = imageIds.insert(std::make_pair(mesh.textures[t].path, id)).first;
+                    }
+                    image = existing->second;
+                    cutout = mesh.textures[t].hasCutout;
+                }
+                // basic.frag discards everything of a mesh without a diffuse texture
+                if (image < 0) {
+                    continue;
+                }
+                for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+                    Triangle triangle;
+                    glm::vec3 p[3];
+                    for (int k = 0; k < 3; k++) {
+                        const gps::Vertex& vertex = mesh.vertices[mesh.indices[t + k]];
+                        p[k] = glm::vec3(casters[m].modelMatrix * glm::vec4(vertex.Position, 1.0f));
+                        triangle.texCoords[k] = vertex.TexCoords;
+                        corners.push_back(p[k]);
+                    }
+                    glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    triangle.normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+                    triangle.image = image;
+                    triangle.cutout = cutout;
+                    triangle.lampHousing = casters[m].lampHousing;
+                    triangles.push_back(triangle);
+                }
+            }
+        }
+        bvh.Build(corners);
+    }
+
+    // GL_REPEAT addressing, nearest texel - the rows were flipped on upload, so t = 0 is the file's last row
+    const unsigned char* BakeScene::FetchTexel(const Triangle& triangle, float u, float v) const {
+
+        const Image& image = images[triangle.image];
+        glm::vec2 texCoords = triangle.texCoords[0] * (1.0f - u - v) + triangle.texCoords[1] * u + triangle.texCoords[2] * v;
+        float s = texCoords.x - std::floor(texCoords.x);
+        float t = texCoords.y - std::floor(texCoords.y);
+        int x = std::min(image.width - 1, (int)(s * image.width));
+        int row = image.height - 1 - std::min(image.height - 1, (int)(t * image.height));
+        return image.pixels + ((size_t)row * image.width + x) * 4;
+    }
+
+    // basic.frag's computeAttenuation
+    static float Attenuation(float distance, float range) {
+
+        float attenuation = 1.0f / (1.0f + ATTENUATION_LINEAR * distance + ATTENUATION_QUADRATIC * distance * distance);
+        float ratio = distance / range;
+        float fade = std::min(std::max(1.0f - ratio * ratio * ratio * ratio, 0.0f), 1.0f);
+        return attenuation * fade * fade;
+    }
+
+    glm::vec3 BakeScene::SunDirect(glm::vec3 origin, glm::vec3 normal) const {
+
+        Filter filter(*this, false);
+        float cosine = glm::dot(normal, sunDirection);
+        if (cosine <= 0.0f || bvh.Occluded(origin, sunDirection, FLT_MAX, &filter)) {
+            return glm::vec3(0.0f);
+        }
+        return sunColor * cosine;
+    }
+
+    glm::vec3 BakeScene::LampFactor(glm::vec3 origin) const {
+
+        Filter filter(*this, true);
+        glm::vec3 factor(0.0f);
+        for (size_t i = 0; i < lamps.size(); i++) {
+            glm::vec3 toLamp = lamps[i].position - origin;
+            float distance = glm::length(toLamp);
+            if (distance >= lamps[i].range || distance <= 0.0f) {
+                continue;
+            }
+            if (!bvh.Occluded(origin, toLamp / distance, distance, &filter)) {
+                factor += Attenuation(distance, lamps[i].range) * lamps[i].color;
+            }
+        }
+        return factor * sunColor;
+    }
+
+    BakeScene::PathLight BakeScene::TracePath(glm::vec3 origin, glm::vec3 direction, Random& random, bool withLamps) const {
+
+        Filter filter(*this, false);
+        glm::vec3 ambient = getSkyLight();
+        PathLight light;
+        light.sky = glm::vec3(0.0f);
+        light.lamps = glm::vec3(0.0f);
+        light.backFace = false;
+
+        glm::vec3 throughput(1.0f);
+        for (int bounce = 0; bounce < BOUNCES; bounce++) {
+            Bvh::Hit hit;
+            if (!bvh.Intersect(origin, direction, FLT_MAX, hit, &filter)) {
+                light.sky += throughput * ambient;
+                break;
+            }
+            const Triangle& triangle = triangles[hit.triangle];
+            bool backFace = glm::dot(triangle.normal, direction) > 0.0f;
+            light.backFace = light.backFace || (bounce == 0 && backFace);
+            glm::vec3 normal = backFace ? -triangle.normal : triangle.normal;
+            const unsigned char* texel = FetchTexel(triangle, hit.u, hit.v);
+            throughput *= glm::vec3(srgbToLinear[texel[0]], srgbToLinear[texel[1]], srgbToLinear[texel[2]]);
+
+            origin = OffsetRay(origin + direction * hit.distance, normal);
+            glm::vec3 hitDirect = SunDirect(origin, normal);
+            light.sky += throughput * hitDirect;
+            if (withLamps && !lamps.empty()) {
+                light.lamps += throughput * LampFactor(origin) * (ambient + hitDirect);
+            }
+            direction = SampleCosine(normal, random);
+        }
+        return light;
+    }
+
+    glm::vec3 BakeScene::getSkyLight() const {
+
+        return AMBIENT_STRENGTH * sunColor;
+    }
+
+    void BakeScene::getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const {
+
+        bvh.getBounds(boundsMin, boundsMax);
+    }
+
+    int BakeScene::getTriangleCount() const {
+
+        return bvh.getTriangleCount();
+    }
+
+    int BakeScene::getNodeCount() const {
+
+        return bvh.getNodeCount();
+    }
+
+    const std::vector<PointLight>& BakeScene::getLamps() const {
+
+        return lamps;
+    }
+
+    glm::vec3 BakeScene::OffsetRay(glm::vec3 position, glm::vec3 normal) {
+
+        return position + normal * RAY_OFFSET;
+    }
+
+    glm::vec3 BakeScene::SampleCosine(glm::vec3 normal, Random& random) {
+
+        float angle = 6.2831853f * random.Next();
+        float radius2 = random.Next();
+        float radius = std::sqrt(radius2);
+        glm::vec3 tangent = glm::normalize(glm::cross(std::abs(normal.x) > 0.5f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), normal));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+        return glm::normalize(tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(std::max(0.0f, 1.0f - radius2)));
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef BakeScene_hpp
+#define BakeScene_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+#include "LightClusters.hpp"
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // The static scene as the CPU bakers see it (Lightmap, LightProbeGrid) - every textured triangle of the casters
+    // in a Bvh, their diffuse textures read back from the files, and the lights baked into it
+    // Build is only called when something has to be baked, so bakes found in the asset cache never pay for it
+    class BakeScene {
+
+    public:
+        // surfaces each path may bounce off
+        static const int BOUNCES = 2;
+
+        // A model that blocks and bounces light - lampHousing models are left out of the lamps' visibility rays,
+        // since they hold the lights themselves
+        struct Caster {
+
+            gps::Model3D* model;
+            glm::mat4 modelMatrix;
+            bool lampHousing;
+        };
+
+        // xorshift, seeded per texel or probe so a bake does not depend on the thread count
+        struct Random {
+
+            uint32_t state;
+
+            explicit Random(uint32_t seed);
+            float Next();
+        };
+
+        // Light carried back along a path, bounced off up to BOUNCES surfaces
+        struct PathLight {
+
+            // the sky where the path escapes, the sun at every surface it hits
+            glm::vec3 sky;
+            // the lamps at every surface it hits, as basic.frag applies them
+            glm::vec3 lamps;
+            // the first surface was hit from behind - the path started inside something
+            bool backFace;
+        };
+
+        // casters must still hold their CPU copies (KEEP_CPU_COPY)
+        // sunDirection - towards the sun, lamps - the lights baked in
+        BakeScene(const std::vector<Caster>& casters, glm::vec3 sunDirection, glm::vec3 sunColor, const std::vector<PointLight>& lamps);
+        ~BakeScene();
+
+        // Hash of the geometry, placement, texture names and lights - the start of every bake's cache key
+        uint64_t getHash();
+
+        // Builds the Bvh and reads the textures, once - the tracing below needs it, and is read-only afterwards
+        void Build();
+
+        // The sun's direct light at a point facing normal, N.L times visibility
+        glm::vec3 SunDirect(glm::vec3 origin, glm::vec3 normal) const;
+        // Sum of the lamps reaching a point, as basic.frag adds them before scaling the sun's light
+        glm::vec3 LampFactor(glm::vec3 origin) const;
+        // withLamps - also gathers the lamps at the surfaces hit
+        PathLight TracePath(glm::vec3 origin, glm::vec3 direction, Random& random, bool withLamps) const;
+
+        // basic.frag's ambient for a surface open to the whole sky
+        glm::vec3 getSkyLight() const;
+        // World space bounds of the triangles, after Build
+        void getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+        int getTriangleCount() const;
+        int getNodeCount() const;
+        const std::vector<PointLight>& getLamps() const;
+
+        // Ray origin pushed off the surface it leaves
+        static glm::vec3 OffsetRay(glm::vec3 position, glm::vec3 normal);
+        static glm::vec3 SampleCosine(glm::vec3 normal, Random& random);
+
+        // Runs work(i) for i in [0, count) on one thread per core, in batches of batchSize
+        template <typename Work>
+        static void ParallelFor(int count, int batchSize, Work work) {
+
+            int threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+            std::atomic<int> nextBatch(0);
+            auto worker = [&]() {
+                while (true) {
+                    int begin = nextBatch.fetch_add(batchSize);
+                    if (begin >= count) {
+                        break;
+                    }
+                    int end = std::min(begin + batchSize, count);
+                    for (int i = begin; i < end; i++) {
+                        work(i);
+                    }
+                }
+            };
+            std::vector<std::thread> threads;
+            for (int i = 1; i < threadCount; i++) {
+                threads.push_back(std::thread(worker));
+            }
+            worker();
+            for (size_t i = 0; i < threads.size(); i++) {
+                threads[i].join();
+            }
+        }
+
+    private:
+        // image data for the bounces - the loaded copies only live on the GPU
+        struct Image {
+
+            unsigned char* pixels;
+            int width;
+            int height;
+        };
+
+        struct Triangle {
+
+            // world space, front faces counter clock-wise
+            glm::vec3 normal;
+            glm::vec2 texCoords[3];
+            int image;
+            bool cutout;
+            bool lampHousing;
+        };
+
+        // cutout texels let the rays through as basic.frag discards them, lamp rays pass the lamp housings
+        class Filter : public BvhHitFilter {
+
+        public:
+            Filter(const BakeScene& scene, bool lampRays);
+            bool Accept(int triangle, float u, float v) const;
+
+        private:
+            const BakeScene& scene;
+            bool lampRays;
+        };
+
+        std::vector<Caster> casters;
+        glm::vec3 sunDirection;
+        glm::vec3 sunColor;
+        std::vector<PointLight> lamps;
+
+        bool built = false;
+        Bvh bvh;
+        std::vector<Triangle> triangles;
+        std::vector<Image> images;
+        float srgbToLinear[256];
+
+        const unsigned char* FetchTexel(const Triangle& triangle, float u, float v) const;
+    };
+}
+
+#endif /* BakeScene_hpp */
@@ -0,0 +1,231 @@
+#include "Benchmark.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        struct Summary {
+
+            double mean;
+            double p50;
+            double p90;
+            double p95;
+            double p99;
+            double max;
+        };
+
+        // nearest-rank percentiles over an unsorted copy of the values
+        Summary Summarize(std::vector<double> values) {
+
+            Summary summary = {};
+            if (values.empty())
+                return summary;
+
+            std::sort(values.begin(), values.end());
+            double sum = 0.0;
+            for (size_t i = 0; i < values.size(); i++)
+                sum += values[i];
+
+            summary.mean = sum / values.size();
+            summary.p50 = values[(values.size() - 1) * 50 / 100];
+            summary.p90 = values[(values.size() - 1) * 90 / 100];
+            summary.p95 = values[(values.size() - 1) * 95 / 100];
+            summary.p99 = values[(values.size() - 1) * 99 / 100];
+            summary.max = values.back();
+            return summary;
+        }
+
+        void WriteSummary(FILE* file, const char* name, Summary summary, bool last) {
+
+            fprintf(file, "  \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+                name, summary.mean, summary.p50, summary.p90, summary.p95, summary.p99, summary.max, last ? "" : ",");
+        }
+    }
+
+    void Benchmark::Init() {
+
+        glGenQueries(QUERY_FRAMES, timerQueries);
+#if defined (__APPLE__)
+        countFragments = false;
+#else
+        countFragments = GLEW_ARB_pipeline_statistics_query ? true : false;
+#endif
+        for (int i = 0; i < QUERY_FRAMES; i++)
+            queryFrame[i] = SIZE_MAX;
+        samples.clear();
+    }
+
+    void Benchmark::BeginFrame() {
+
+        // the slot about to be reused holds the result from QUERY_FRAMES frames ago
+        int slot = (int)(samples.size() % QUERY_FRAMES);
+        CollectGpuTime(slot);
+
+        frameStart = std::chrono::steady_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, timerQueries[slot]);
+        queryFrame[slot] = samples.size();
+        frameActive = true;
+        BeginFragmentQuery(false);
+    }
+
+    void Benchmark::EndFrame(float time, RenderStats& stats) {
+
+        EndFragmentQuery();
+        frameActive = false;
+        glEndQuery(GL_TIME_ELAPSED);
+
+        FrameSample sample;
+        sample.time = time;
+        sample.cpuMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+        sample.gpuMilliseconds = 0.0;
+        sample.drawCalls = stats.drawCalls;
+        sample.triangles = stats.trianglesSubmitted;
+        sample.fragments = 0;
+        sample.depthOnlyFragments = 0;
+        samples.push_back(sample);
+    }
+
+    void Benchmark::BeginDepthOnly() {
+
+        EndFragmentQuery();
+        BeginFragmentQuery(true);
+    }
+
+    void Benchmark::EndDepthOnly() {
+
+        EndFragmentQuery();
+        BeginFragmentQuery(false);
+    }
+
+    void Benchmark::BeginFragmentQuery(bool depthOnly) {
+
+        if (!countFragments || !frameActive)
+            return;
+
+        FragmentQuery fragmentQuery;
+        if (freeFragmentQueries.empty()) {
+            glGenQueries(1, &fragmentQuery.query);
+        }
+        else {
+            fragmentQuery.query = freeFragmentQueries.back();
+            freeFragmentQueries.pop_back();
+        }
+        fragmentQuery.depthOnly = depthOnly;
+
+#if !defined (__APPLE__)
+        glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, fragmentQuery.query);
+#endif
+        fragmentQueries[samples.size() % QUERY_FRAMES].push_back(fragmentQuery);
+    }
+
+    void Benchmark::EndFragmentQuery() {
+
+        if (!countFragments || !frameActive)
+            return;
+
+#if !defined (__APPLE__)
+        glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+#endif
+    }
+
+    void Benchmark::CollectGpuTime(int slot) {
+
+        if (queryFrame[slot] == SIZE_MAX)
+            return;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQueries[slot], GL_QUERY_RESULT, &elapsed);
+        samples[queryFrame[slot]].gpuMilliseconds = elapsed / 1000000.0;
+
+        for (size_t i = 0; i < fragmentQueries[slot].size(); i++) {
+
+            GLuint64 fragments = 0;
+            glGetQueryObjectui64v(fragmentQueries[slot][i].query, GL_QUERY_RESULT, &fragments);
+            if (fragmentQueries[slot][i].depthOnly)
+                samples[queryFrame[slot]].depthOnlyFragments += fragments;
+            else
+                samples[queryFrame[slot]].fragments += fragments;
+            freeFragmentQueries.push_back(fragmentQueries[slot][i].query);
+        }
+        fragmentQueries[slot].clear();
+        queryFrame[slot] = SIZE_MAX;
+    }
+
+    void Benchmark::Finish(std::string outputPrefix) {
+
+        for (int i = 0; i < QUERY_FRAMES; i++)
+            CollectGpuTime(i);
+        glDeleteQueries(QUERY_FRAMES, timerQueries);
+        if (!freeFragmentQueries.empty())
+            glDeleteQueries((GLsizei)freeFragmentQueries.size(), &freeFragmentQueries[0]);
+        freeFragmentQueries.clear();
+
+        WriteJSON(outputPrefix + ".json");
+        WriteCSV(outputPrefix + ".csv");
+    }
+
+    void Benchmark::WriteJSON(std::string fileName) {
+
+        std::vector<double> cpu, gpu, drawCalls, triangles, fragments, depthOnlyFragments;
+        for (size_t i = WARMUP_FRAMES; i < samples.size(); i++) {
+
+            cpu.push_back(samples[i].cpuMilliseconds);
+            gpu.push_back(samples[i].gpuMilliseconds);
+            drawCalls.push_back(samples[i].drawCalls);
+            triangles.push_back(samples[i].triangles);
+            fragments.push_back((double)samples[i].fragments);
+            depthOnlyFragments.push_back((double)samples[i].depthOnlyFragments);
+        }
+
+        FILE* file = fopen(fileName.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "ERROR: could not write %s\n", fileName.c_str());
+            return;
+        }
+
+        fprintf(file, "{\n");
+        fprintf(file, "  \"frames\": %zu,\n", cpu.size());
+        fprintf(file, "  \"warmup_frames\": %zu,\n", std::min(samples.size(), WARMUP_FRAMES));
+        WriteSummary(file, "cpu_ms", Summarize(cpu), false);
+        WriteSummary(file, "gpu_ms", Summarize(gpu), false);
+        WriteSummary(file, "draw_calls", Summarize(drawCalls), false);
+        WriteSummary(file, "triangles", Summarize(triangles), !countFragments);
+        if (countFragments) {
+            WriteSummary(file, "fragment_invocations", Summarize(fragments), false);
+            WriteSummary(file, "depth_only_fragment_invocations", Summarize(depthOnlyFragments), true);
+        }
+        fprintf(file, "}\n");
+        fclose(file);
+
+        Summary cpuSummary = Summarize(cpu);
+        Summary gpuSummary = Summarize(gpu);
+        printf("Benchmark: %zu frames, CPU %.2f ms mean / %.2f ms p95, GPU %.2f ms mean / %.2f ms p95 - written to %s\n",
+            cpu.size(), cpuSummary.mean, cpuSummary.p95, gpuSummary.mean, gpuSummary.p95, fileName.c_str());
+        if (countFragments) {
+            printf("Benchmark: %.0f shaded + %.0f depth-only fragment shader invocations per frame (mean)\n",
+                Summarize(fragments).mean, Summarize(depthOnlyFragments).mean);
+        }
+    }
+
+    void Benchmark::WriteCSV(std::string fileName) {
+
+        FILE* file = fopen(fileName.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "ERROR: could not write %s\n", fileName.c_str());
+            return;
+        }
+
+        fprintf(file, "frame,time_s,cpu_ms,gpu_ms,draw_calls,triangles,fragment_invocations,depth_only_fragment_invocations\n");
+        for (size_t i = 0; i < samples.size(); i++) {
+            fprintf(file, "%zu,%.4f,%.4f,%.4f,%u,%u,%llu,%llu\n", i, samples[i].time, samples[i].cpuMilliseconds,
+                samples[i].gpuMilliseconds, samples[i].drawCalls, samples[i].triangles,
+                (unsigned long long)samples[i].fragments, (unsigned long long)samples[i].depthOnlyFragments);
+        }
+        fclose(file);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef Benchmark_hpp
+#define Benchmark_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "RenderStats.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct FrameSample {
+
+        float time;
+        double cpuMilliseconds;
+        double gpuMilliseconds;
+        GLuint drawCalls;
+        GLuint triangles;
+        // fragment shader invocations of the shaded passes and of the depth-only passes,
+        // 0 without ARB_pipeline_statistics_query
+        GLuint64 fragments;
+        GLuint64 depthOnlyFragments;
+    };
+
+    // Records per-frame CPU/GPU time and submission counters, then writes a summary with percentiles
+    class Benchmark {
+
+    public:
+        void Init();
+
+        // Wrap everything that belongs to one frame, present included
+        void BeginFrame();
+        void EndFrame(float time, RenderStats& stats);
+
+        // Wrap depth-only passes - their fragments are counted apart, so the shaded count shows what they save
+        void BeginDepthOnly();
+        void EndDepthOnly();
+
+        // Waits for the outstanding GPU timings, then writes <prefix>.json (summary) and <prefix>.csv (every frame)
+        void Finish(std::string outputPrefix);
+
+    private:
+        // GPU timer results are read this many frames late so reading them never stalls the pipeline
+        static const int QUERY_FRAMES = 4;
+        // first frames are left out of the summary (shader warm-up, first texture uses)
+        static const size_t WARMUP_FRAMES = 10;
+
+        // one pipeline statistics query per stretch of the frame between depth-only begin/end
+        struct FragmentQuery {
+
+            GLuint query;
+            bool depthOnly;
+        };
+
+        GLuint timerQueries[QUERY_FRAMES];
+        size_t queryFrame[QUERY_FRAMES];
+        // fragment counting needs ARB_pipeline_statistics_query, the queries share the timers' ring
+        bool countFragments = false;
+        bool frameActive = false;
+        std::vector<FragmentQuery> fragmentQueries[QUERY_FRAMES];
+        std::vector<GLuint> freeFragmentQueries;
+        std::vector<FrameSample> samples;
+        std::chrono::steady_clock::time_point frameStart;
+
+        void CollectGpuTime(int slot);
+        void BeginFragmentQuery(bool depthOnly);
+        void EndFragmentQuery();
+        void WriteJSON(std::string fileName);
+        void WriteCSV(std::string fileName);
+    };
+}
+
+#endif /* Benchmark_hpp */
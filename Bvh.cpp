@@ -0,0 +1,283 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace gps {
+
+    // centroid bins tried along each axis when splitting a node
+    static const int SAH_BINS = 12;
+    // deeper than any tree the binned build produces over a few million triangles
+    static const int STACK_SIZE = 128;
+
+    struct BuildTask {
+
+        int node;
+        int begin;
+        int end;
+    };
+
+    static void Grow(glm::vec3& boundsMin, glm::vec3& boundsMax, glm::vec3 point) {
+
+        boundsMin = glm::min(boundsMin, point);
+        boundsMax = glm::max(boundsMax, point);
+    }
+
+    static float HalfArea(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+
+        glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    // distance to where the ray enters the box, FLT_MAX when it misses it before maxDistance
+    static float EnterBox(glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) {
+
+        glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+        glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return (enter <= exit) ? enter : FLT_MAX;
+    }
+
+    void Bvh::Build(const std::vector<glm::vec3>& corners) {
+
+        int triangleCount = (int)(corners.size() / 3);
+        nodes.clear();
+        triangles.clear();
+        if (triangleCount == 0) {
+            return;
+        }
+
+        std::vector<glm::vec3> triangleMin(triangleCount), triangleMax(triangleCount), centroids(triangleCount);
+        std::vector<int> order(triangleCount);
+        for (int i = 0; i < triangleCount; i++) {
+            triangleMin[i] = glm::min(glm::min(corners[i * 3], corners[i * 3 + 1]), corners[i * 3 + 2]);
+            triangleMax[i] = glm::max(glm::max(corners[i * 3], corners[i * 3 + 1]), corners[i * 3 + 2]);
+            centroids[i] = (triangleMin[i] + triangleMax[i]) * 0.5f;
+            order[i] = i;
+        }
+
+        nodes.reserve(triangleCount * 2 / MAX_LEAF_TRIANGLES + 1);
+        nodes.push_back(Node());
+        std::vector<BuildTask> tasks;
+        tasks.push_back({ 0, 0, triangleCount });
+
+        while (!tasks.empty()) {
+            BuildTask task = tasks.back();
+            tasks.pop_back();
+            int count = task.end - task.begin;
+
+            glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+            for (int i = task.begin; i < task.end; i++) {
+                Grow(boundsMin, boundsMax, triangleMin[order[i]]);
+                Grow(boundsMin, boundsMax, triangleMax[order[i]]);
+                Grow(centroidMin, centroidMax, centroids[order[i]]);
+            }
+            nodes[task.node].boundsMin = boundsMin;
+            nodes[task.node].boundsMax = boundsMax;
+            nodes[task.node].first = task.begin;
+            nodes[task.node].count = count;
+
+            // cheapest split over the bins of every axis, against keeping the triangles in one leaf
+            int bestAxis = -1, bestSplit = 0;
+            float bestCost = (float)count * HalfArea(boundsMin, boundsMax);
+            glm::vec3 centroidExtent = centroidMax - centroidMin;
+            for (int axis = 0; axis < 3 && count > MAX_LEAF_TRIANGLES; axis++) {
+                if (centroidExtent[axis] <= 0.0f) {
+                    continue;
+                }
+                int binCounts[SAH_BINS] = {};
+                glm::vec3 binMin[SAH_BINS], binMax[SAH_BINS];
+                std::fill(binMin, binMin + SAH_BINS, glm::vec3(FLT_MAX));
+                std::fill(binMax, binMax + SAH_BINS, glm::vec3(-FLT_MAX));
+                float binScale = SAH_BINS / centroidExtent[axis];
+                for (int i = task.begin; i < task.end; i++) {
+                    int bin = std::min(SAH_BINS - 1, (int)((centroids[order[i]][axis] - centroidMin[axis]) * binScale));
+                    binCounts[bin]++;
+                    Grow(binMin[bin], binMax[bin], triangleMin[order[i]]);
+                    Grow(binMin[bin], binMax[bin], triangleMax[order[i]]);
+                }
+
+                // areas of everything right of each split, then swept from the left
+                float rightCosts[SAH_BINS];
+                glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+                int sweepCount = 0;
+                for (int bin = SAH_BINS - 1; bin > 0; bin--) {
+                    Grow(sweepMin, sweepMax, binMin[bin]);
+                    Grow(sweepMin, sweepMax, binMax[bin]);
+                    sweepCount += binCounts[bin];
+                    rightCosts[bin] = sweepCount > 0 ? sweepCount * HalfArea(sweepMin, sweepMax) : 0.0f;
+                }
+                sweepMin = glm::vec3(FLT_MAX);
+                sweepMax = glm::vec3(-FLT_MAX);
+                sweepCount = 0;
+                for (int split = 1; split < SAH_BINS; split++) {
+                    Grow(sweepMin, sweepMax, binMin[split - 1]);
+                    Grow(sweepMin, sweepMax, binMax[split - 1]);
+                    sweepCount += binCounts[split - 1];
+                    if (sweepCount == 0 || sweepCount == count) {
+                        continue;
+                    }
+                    float cost = sweepCount * HalfArea(sweepMin, sweepMax) + rightCosts[split];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = split;
+                    }
+                }
+            }
+
+            if (bestAxis < 0) {
+                // a leaf - small enough, or no split pays off; only oversized leaves of coincident centroids stay large
+                if (count <= MAX_LEAF_TRIANGLES || centroidExtent == glm::vec3(0.0f)) {
+                    continue;
+                }
+                bestAxis = (centroidExtent.x >= centroidExtent.y && centroidExtent.x >= centroidExtent.z) ? 0 : (centroidExtent.y >= centroidExtent.z ? 1 : 2);
+                bestSplit = -1;
+            }
+
+            int middle;
+            if (bestSplit > 0) {
+                float binScale = SAH_BINS / centroidExtent[bestAxis];
+                middle = (int)(std::partition(order.begin() + task.begin, order.begin() + task.end, [&](int t) {
+                    return std::min(SAH_BINS - 1, (int)((centroids[t][bestAxis] - centroidMin[bestAxis]) * binScale)) < bestSplit;
+                }) - order.begin());
+            }
+            else {
+                middle = (task.begin + task.end) / 2;
+                std::nth_element(order.begin() + task.begin, order.begin() + middle, order.begin() + task.end, [&](int a, int b) {
+                    return centroids[a][bestAxis] < centroids[b][bestAxis];
+                });
+            }
+
+            int left = (int)nodes.size();
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            nodes[task.node].first = left;
+            nodes[task.node].count = 0;
+            tasks.push_back({ left, task.begin, middle });
+            tasks.push_back({ left + 1, middle, task.end });
+        }
+
+        triangles.resize(triangleCount);
+        for (int i = 0; i < triangleCount; i++) {
+            int t = order[i];
+            triangles[i].corner = corners[t * 3];
+            triangles[i].edge1 = corners[t * 3 + 1] - corners[t * 3];
+            triangles[i].edge2 = corners[t * 3 + 2] - corners[t * 3];
+            triangles[i].index = t;
+        }
+    }
+
+    bool Bvh::Intersect(glm::vec3 origin, glm::vec3 direction, float maxDistance, Hit& hit, const BvhHitFilter* filter) const {
+
+        return Trace(origin, direction, maxDistance, hit, filter, false);
+    }
+
+    bool Bvh::Occluded(glm::vec3 origin, glm::vec3 direction, float maxDistance, const BvhHitFilter* filter) const {
+
+        Hit hit;
+        return Trace(origin, direction, maxDistance, hit, filter, true);
+    }
+
+    bool Bvh::Trace(glm::vec3 origin, glm::vec3 direction, float maxDistance, Hit& hit, const BvhHitFilter* filter, bool anyHit) const {
+
+        if (nodes.empty()) {
+            return false;
+        }
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        bool found = false;
+        hit.distance = maxDistance;
+
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        int node = 0;
+        if (EnterBox(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverseDirection, maxDistance) == FLT_MAX) {
+            return false;
+        }
+
+        while (true) {
+            const Node& current = nodes[node];
+            if (current.count > 0) {
+                // Moller-Trumbore, both sides
+                for (int i = current.first; i < current.first + current.count; i++) {
+                    const Triangle& triangle = triangles[i];
+                    glm::vec3 p = glm::cross(direction, triangle.edge2);
+                    float determinant = glm::dot(triangle.edge1, p);
+                    if (std::abs(determinant) < 1e-12f) {
+                        continue;
+                    }
+                    float inverseDeterminant = 1.0f / determinant;
+                    glm::vec3 s = origin - triangle.corner;
+                    float u = glm::dot(s, p) * inverseDeterminant;
+                    if (u < 0.0f || u > 1.0f) {
+                        continue;
+                    }
+                    glm::vec3 q = glm::cross(s, triangle.edge1);
+                    float v = glm::dot(direction, q) * inverseDeterminant;
+                    if (v < 0.0f || u + v > 1.0f) {
+                        continue;
+                    }
+                    float distance = glm::dot(triangle.edge2, q) * inverseDeterminant;
+                    if (distance <= 0.0f || distance >= hit.distance) {
+                        continue;
+                    }
+                    if (filter != NULL && !filter->Accept(triangle.index, u, v)) {
+                        continue;
+                    }
+                    hit.distance = distance;
+                    hit.triangle = triangle.index;
+                    hit.u = u;
+                    hit.v = v;
+                    found = true;
+                    if (anyHit) {
+                        return true;
+                    }
+                }
+            }
+            else {
+                // nearer child first, the other one waits on the stack
+                int near = current.first, far = current.first + 1;
+                float nearDistance = EnterBox(nodes[near].boundsMin, nodes[near].boundsMax, origin, inverseDirection, hit.distance);
+                float farDistance = EnterBox(nodes[far].boundsMin, nodes[far].boundsMax, origin, inverseDirection, hit.distance);
+                if (farDistance < nearDistance) {
+                    std::swap(near, far);
+                    std::swap(nearDistance, farDistance);
+                }
+                if (nearDistance != FLT_MAX) {
+                    if (farDistance != FLT_MAX && stackSize < STACK_SIZE) {
+                        stack[stackSize++] = far;
+                    }
+                    node = near;
+                    continue;
+                }
+            }
+
+            if (stackSize == 0) {
+                break;
+            }
+            node = stack[--stackSize];
+        }
+        return found;
+    }
+
+    void Bvh::getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const {
+
+        boundsMin = nodes.empty() ? glm::vec3(FLT_MAX) : nodes[0].boundsMin;
+        boundsMax = nodes.empty() ? glm::vec3(-FLT_MAX) : nodes[0].boundsMax;
+    }
+
+    int Bvh::getTriangleCount() const {
+
+        return (int)triangles.size();
+    }
+
+    int Bvh::getNodeCount() const {
+
+        return (int)nodes.size();
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Decides whether a candidate hit stops the ray - lets cutout texels pass through
+    // u, v - barycentric coordinates of the hit on the triangle's second and third corner
+    class BvhHitFilter {
+
+    public:
+        virtual bool Accept(int triangle, float u, float v) const = 0;
+    };
+
+    // Bounding volume hierarchy over world space triangles, for ray casting on the CPU (lightmap and probe baking)
+    //   built top-down with a binned surface area heuristic, leaves hold at most MAX_LEAF_TRIANGLES
+    //   triangles are stored in leaf order next to the nodes, hits report the caller's triangle index
+    //   read-only once built, so any number of threads can trace through it
+    class Bvh {
+
+    public:
+        static const int MAX_LEAF_TRIANGLES = 4;
+
+        struct Hit {
+
+            float distance;
+            // index of the triangle in the corners handed to Build
+            int triangle;
+            float u;
+            float v;
+        };
+
+        // corners - three per triangle
+        void Build(const std::vector<glm::vec3>& corners);
+
+        // Closest accepted hit closer than maxDistance - false on a miss
+        bool Intersect(glm::vec3 origin, glm::vec3 direction, float maxDistance, Hit& hit, const BvhHitFilter* filter = NULL) const;
+
+        // Any accepted hit closer than maxDistance, for shadow rays
+        bool Occluded(glm::vec3 origin, glm::vec3 direction, float maxDistance, const BvhHitFilter* filter = NULL) const;
+
+        // Bounds of every triangle - empty (min above max) before Build
+        void getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+        int getTriangleCount() const;
+        int getNodeCount() const;
+
+    private:
+        // an inner node has count 0 and its children at first and first + 1, a leaf its triangles from first on
+        struct Node {
+
+            glm::vec3 boundsMin;
+            int first;
+            glm::vec3 boundsMax;
+            int count;
+        };
+
+        // first corner and the two edges from it, in leaf order
+        struct Triangle {
+
+            glm::vec3 corner;
+            glm::vec3 edge1;
+            glm::vec3 edge2;
+            int index;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<Triangle> triangles;
+
+        // traversal shared by Intersect and Occluded - anyHit stops at the first accepted hit
+        bool Trace(glm::vec3 origin, glm::vec3 direction, float maxDistance, Hit& hit, const BvhHitFilter* filter, bool anyHit) const;
+    };
+}
+
+#endif /* Bvh_hpp */
@@ -0,0 +1,97 @@
+#include "CameraPath.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+    // One keyframe per line: time px py pz tx ty tz hold|linear - '#' starts a comment
+    bool CameraPath::Load(std::string fileName) {
+
+        std::ifstream pathFile(fileName);
+        if (!pathFile.is_open()) {
+            std::cerr << "ERROR: could not open camera path " << fileName << std::endl;
+            return false;
+        }
+
+        keyframes.clear();
+        std::string line;
+        int lineNumber = 0;
+
+        while (std::getline(pathFile, line)) {
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream lineStream(line);
+            CameraKeyframe keyframe;
+            std::string interpolation;
+
+            if (!(lineStream >> keyframe.time))
+                continue;
+
+            if (!(lineStream >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+                >> keyframe.target.x >> keyframe.target.y >> keyframe.target.z >> interpolation)) {
+                std::cerr << "ERROR: " << fileName << " (" << lineNumber << "): malformed keyframe" << std::endl;
+                return false;
+            }
+
+            if (!keyframes.empty() && keyframe.time < keyframes.back().time) {
+                std::cerr << "ERROR: " << fileName << " (" << lineNumber << "): keyframes must be sorted by time" << std::endl;
+                return false;
+            }
+
+            keyframe.linear = (interpolation == "linear");
+            keyframes.push_back(keyframe);
+        }
+
+        return !keyframes.empty();
+    }
+
+    bool CameraPath::Sample(float time, glm::vec3& position, glm::vec3& target, float previousTime, bool* cut) {
+
+        if (keyframes.empty())
+            return false;
+
+        // a linear segment ends where the next keyframe starts, a hold jumps to it unless they are the same shot
+        if (cut) {
+            *cut = false;
+            for (size_t i = 1; i < keyframes.size(); i++) {
+                const CameraKeyframe& held = keyframes[i - 1];
+                const CameraKeyframe& next = keyframes[i];
+                if (next.time > previousTime && next.time <= time && !held.linear &&
+                    (held.position != next.position || held.target != next.target))
+                    *cut = true;
+            }
+        }
+
+        if (time >= keyframes.back().time) {
+            position = keyframes.back().position;
+            target = keyframes.back().target;
+            return false;
+        }
+
+        // last keyframe at or before the requested time
+        size_t current = 0;
+        while (current + 1 < keyframes.size() && keyframes[current + 1].time <= time)
+            current++;
+
+        CameraKeyframe& from = keyframes[current];
+        position = from.position;
+        target = from.target;
+
+        if (from.linear && current + 1 < keyframes.size()) {
+            CameraKeyframe& to = keyframes[current + 1];
+            float t = (time - from.time) / (to.time - from.time);
+            position = glm::mix(from.position, to.position, t);
+            target = glm::mix(from.target, to.target, t);
+        }
+
+        return true;
+    }
+
+    float CameraPath::getDuration() {
+
+        return keyframes.empty() ? 0.0f : keyframes.back().time;
+    }
+}
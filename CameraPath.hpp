@@ -0,0 +1,39 @@
+#ifndef CameraPath_hpp
+#define CameraPath_hpp
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct CameraKeyframe {
+
+        float time;
+        glm::vec3 position;
+        glm::vec3 target;
+        // move linearly towards the next keyframe, otherwise hold until it is reached
+        bool linear;
+    };
+
+    // Camera tour read from a text file, sampled by time instead of by frame count
+    class CameraPath {
+
+    public:
+        bool Load(std::string fileName);
+
+        // Camera position and target at the given time (seconds from the start)
+        // Returns false once the path is over, leaving the last keyframe in position/target
+        // cut - set when a hold ended in a jump to another shot after previousTime, so nothing may be blended across it
+        bool Sample(float time, glm::vec3& position, glm::vec3& target, float previousTime = 0.0f, bool* cut = NULL);
+
+        float getDuration();
+
+    private:
+        std::vector<CameraKeyframe> keyframes;
+    };
+}
+
+#endif /* CameraPath_hpp */
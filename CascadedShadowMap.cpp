@@ -0,0 +1,246 @@
+#include "CascadedShadowMap.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace gps {
+
+    // blend between logarithmic (1) and uniform (0) split distances
+    static const float SPLIT_LAMBDA = 0.8f;
+    // grid the cascades move on, as a fraction of their radius - the cascades are enlarged to cover the offset
+    static const float MAX_DRIFT = 0.1f;
+
+    GLuint CascadedShadowMap::CreateDepthArray() {
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        // hardware 2x2 comparison filtering
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        // outside the map counts as lit
+        GLfloat border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        renderStats.textureBytes += (size_t)size * size * 4 * CASCADES;
+        return texture;
+    }
+
+    void CascadedShadowMap::Init(int size) {
+
+        this->size = size;
+        depthTexture = CreateDepthArray();
+        staticTexture = CreateDepthArray();
+
+        GLuint framebuffers[] = { 0, 0 };
+        GLuint textures[] = { depthTexture, staticTexture };
+        // bound again at the end - headless runs draw into an offscreen framebuffer, not 0
+        GLint previousFramebuffer;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffers(2, framebuffers);
+        for (int i = 0; i < 2; i++) {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[i], 0, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                throw std::runtime_error("Could not create the shadow map framebuffer!");
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        framebuffer = framebuffers[0];
+        staticFramebuffer = framebuffers[1];
+
+        for (int i = 0; i < CASCADES; i++) {
+            cascades[i].lightView = glm::mat4(1.0f);
+            cascades[i].lightProjection = glm::mat4(1.0f);
+            cascades[i].valid = false;
+            cascades[i].dynamicRect = glm::ivec4(0);
+        }
+    }
+
+    void CascadedShadowMap::Delete() {
+
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &staticTexture);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteFramebuffers(1, &staticFramebuffer);
+    }
+
+    void CascadedShadowMap::Update(glm::mat4 view, float fovy, float aspect, float near, float shadowDistance,
+        glm::vec3 lightDir, BoundingSphere sceneBounds) {
+
+        lightDir = glm::normalize(lightDir);
+        bool lightMoved = lightDir != this->lightDir;
+        this->lightDir = lightDir;
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanY = std::tan(fovy * 0.5f);
+        float tanX = tanY * aspect;
+        float k2 = tanX * tanX + tanY * tanY;
+
+        float splitNear = near;
+        for (int i = 0; i < CASCADES; i++) {
+
+            Cascade& cascade = cascades[i];
+
+            // practical split scheme - logarithmic close to the camera, closer to uniform further out
+            float t = (float)(i + 1) / CASCADES;
+            float logSplit = near * std::pow(shadowDistance / near, t);
+            float uniformSplit = near + (shadowDistance - near) * t;
+            float splitFar = SPLIT_LAMBDA * logSplit + (1.0f - SPLIT_LAMBDA) * uniformSplit;
+            cascade.split = splitFar;
+
+            // bounding sphere of the slice - on the view axis, as far from the near corners as from the far ones
+            float centerDistance = std::min(splitFar, (splitFar + splitNear) * (1.0f + k2) * 0.5f);
+            float radius = std::sqrt((splitFar - centerDistance) * (splitFar - centerDistance) + splitFar * splitFar * k2);
+            glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDistance, 1.0f));
+            splitNear = splitFar;
+
+            // enlarged to still hold the slice from anywhere in its grid cell, in whole units so the texel size stays put
+            radius = std::ceil(radius * (1.0f + MAX_DRIFT));
+            float cell = radius * MAX_DRIFT;
+            center = glm::round(center / cell) * cell;
+
+            // the cached static casters stay valid while the cascade stays in its cell
+            cascade.staticRedraw = !cascade.valid || lightMoved || radius != cascade.radius || center != cascade.center;
+            if (cascade.staticRedraw) {
+                Fit(cascade, center, radius, sceneBounds);
+            }
+        }
+    }
+
+    void CascadedShadowMap::Fit(Cascade& cascade, glm::vec3 center, float radius, BoundingSphere sceneBounds) {
+
+        cascade.center = center;
+        cascade.radius = radius;
+        cascade.valid = true;
+
+        glm::vec3 up = (std::fabs(lightDir.y) > 0.99f) ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        cascade.lightView = glm::lookAt(center + lightDir, center, up);
+
+        // the near plane is pulled back to the scene bounds, so casters between the slice and the light still cast
+        float sceneNear = 1.0f + glm::dot(center - sceneBounds.center, lightDir) - sceneBounds.radius;
+        float zNear = std::min(1.0f - radius, sceneNear);
+        float zFar = 1.0f + radius;
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, zNear, zFar);
+
+        // move the projection so the world origin lands on a texel corner - the texel grid then stays fixed in the world
+        glm::vec4 origin = projection * cascade.lightView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        glm::vec2 texel = glm::vec2(origin.x, origin.y) * (size * 0.5f);
+        glm::vec2 offset = (glm::round(texel) - texel) / (size * 0.5f);
+        projection[3][0] += offset.x;
+        projection[3][1] += offset.y;
+        cascade.lightProjection = projection;
+    }
+
+    bool CascadedShadowMap::needsStaticRedraw(int cascade) {
+
+        return cascades[cascade].staticRedraw;
+    }
+
+    void CascadedShadowMap::BeginStatic(int cascade) {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, cascade);
+        glViewport(0, 0, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    bool CascadedShadowMap::BeginDynamic(int cascade, BoundingSphere dynamicBounds) {
+
+        Cascade& current = cascades[cascade];
+        glm::ivec4 rect = TexelRect(current, dynamicBounds);
+
+        // the cached depth goes back under last frame's dynamic casters and the area they cover now,
+        // or everywhere once the cache was redrawn
+        glm::ivec4 restore = rect;
+        if (current.staticRedraw) {
+            restore = glm::ivec4(0, 0, size, size);
+        }
+        else if (rect.x >= rect.z) {
+            restore = current.dynamicRect;
+        }
+        else if (current.dynamicRect.x < current.dynamicRect.z) {
+            glm::ivec4 last = current.dynamicRect;
+            restore = glm::ivec4(std::min(rect.x, last.x), std::min(rect.y, last.y), std::max(rect.z, last.z), std::max(rect.w, last.w));
+        }
+        current.dynamicRect = rect;
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, cascade);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, cascade);
+        if (restore.x < restore.z) {
+            glBlitFramebuffer(restore.x, restore.y, restore.z, restore.w, restore.x, restore.y, restore.z, restore.w,
+                GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+        if (rect.x >= rect.z) {
+            return false;
+        }
+        glViewport(0, 0, size, size);
+        return true;
+    }
+
+    // Texels of the cascade a sphere can cover, with one more around it for the filtering - empty outside the map
+    glm::ivec4 CascadedShadowMap::TexelRect(Cascade& cascade, BoundingSphere bounds) {
+
+        glm::vec4 center = cascade.lightProjection * cascade.lightView * glm::vec4(bounds.center, 1.0f);
+        float x = (center.x * 0.5f + 0.5f) * size;
+        float y = (center.y * 0.5f + 0.5f) * size;
+        float radius = bounds.radius * size / (2.0f * cascade.radius) + 1.0f;
+
+        glm::ivec4 rect((int)std::max(0.0f, std::floor(x - radius)), (int)std::max(0.0f, std::floor(y - radius)),
+            (int)std::min((float)size, std::ceil(x + radius)), (int)std::min((float)size, std::ceil(y + radius)));
+        if (rect.x >= rect.z || rect.y >= rect.w) {
+            return glm::ivec4(0);
+        }
+        return rect;
+    }
+
+    glm::mat4 CascadedShadowMap::getLightView(int cascade) {
+
+        return cascades[cascade].lightView;
+    }
+
+    glm::mat4 CascadedShadowMap::getLightProjection(int cascade) {
+
+        return cascades[cascade].lightProjection;
+    }
+
+    glm::mat4 CascadedShadowMap::getShadowMatrix(int cascade, glm::mat4 view) {
+
+        // clip space [-1, 1] to texture coordinates and depth [0, 1]
+        glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+        return bias * cascades[cascade].lightProjection * cascades[cascade].lightView * glm::inverse(view);
+    }
+
+    float CascadedShadowMap::getSplit(int cascade) {
+
+        return cascades[cascade].split;
+    }
+
+    float CascadedShadowMap::getTexelSize(int cascade) {
+
+        return 2.0f * cascades[cascade].radius / size;
+    }
+
+    void CascadedShadowMap::Bind(GLuint unit) {
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+        renderStats.textureBinds++;
+    }
+}
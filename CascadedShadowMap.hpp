@@ -0,0 +1,91 @@
+#ifndef CascadedShadowMap_hpp
+#define CascadedShadowMap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Culling.hpp"
+
+namespace gps {
+
+    // Sun shadows - the view frustum is cut along its depth into cascades, each covered by an orthographic
+    // shadow map in one layer of a depth texture array
+    //   each cascade is fitted with the bounding sphere of its slice, so its size does not change as the camera turns,
+    //   and moved in whole texels, so the shadow edges do not shimmer as the camera moves
+    //   the static casters are cached in a second array and only redrawn when their cascade steps to the next cell
+    //   of a grid (a tenth of its radius, so the far cascades move and redraw less often) or the sun moves;
+    //   each frame the cache is copied under the dynamic casters and they alone are drawn again
+    class CascadedShadowMap {
+
+    public:
+        static const int CASCADES = 4;
+
+        void Init(int size);
+        void Delete();
+
+        // Fits the cascades to the camera and picks the ones whose static casters are redrawn this frame
+        // lightDir points towards the light, sceneBounds holds every shadow caster (in world space)
+        void Update(glm::mat4 view, float fovy, float aspect, float near, float shadowDistance,
+            glm::vec3 lightDir, BoundingSphere sceneBounds);
+
+        bool needsStaticRedraw(int cascade);
+
+        // Binds the cascade's static cache layer as the depth target, sets the viewport and clears it
+        void BeginStatic(int cascade);
+
+        // Restores the static depth where the dynamic casters were and are now, then binds the cascade's layer
+        // for drawing them - false when they are outside the cascade and there is nothing to draw
+        bool BeginDynamic(int cascade, BoundingSphere dynamicBounds);
+
+        // Light matrices the cascade is drawn with - the light projection holds all the casters in front of the slice
+        glm::mat4 getLightView(int cascade);
+        glm::mat4 getLightProjection(int cascade);
+
+        // Eye space -> shadow map coordinates, from the matrices the cascade was last drawn with
+        glm::mat4 getShadowMatrix(int cascade, glm::mat4 view);
+        // Eye distance where the cascade ends
+        float getSplit(int cascade);
+        // World size of one shadow map texel
+        float getTexelSize(int cascade);
+
+        void Bind(GLuint unit);
+
+    private:
+        struct Cascade {
+
+            glm::mat4 lightView;
+            glm::mat4 lightProjection;
+            // grid cell the static casters were drawn for
+            glm::vec3 center;
+            float radius;
+            float split;
+            bool staticRedraw;
+            bool valid;
+            // texels the dynamic casters covered last frame - x0, y0, x1, y1, empty when x0 >= x1
+            glm::ivec4 dynamicRect;
+        };
+
+        int size = 0;
+        // sampled by the shaders - the static cache with the dynamic casters on top
+        GLuint depthTexture = 0;
+        GLuint staticTexture = 0;
+        GLuint framebuffer = 0;
+        GLuint staticFramebuffer = 0;
+        Cascade cascades[CASCADES] = {};
+        glm::vec3 lightDir = glm::vec3(0.0f);
+
+        GLuint CreateDepthArray();
+        glm::ivec4 TexelRect(Cascade& cascade, BoundingSphere bounds);
+
+        void Fit(Cascade& cascade, glm::vec3 center, float radius, BoundingSphere sceneBounds);
+    };
+}
+
+#endif /* CascadedShadowMap_hpp */
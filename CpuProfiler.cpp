@@ -0,0 +1,162 @@
+#include "CpuProfiler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace gps {
+
+    // events kept per thread, about 24 MB at most
+    static const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+    struct CpuEvent {
+
+        const char* name;
+        int64_t begin;
+        int64_t end;
+    };
+
+    struct ThreadBuffer {
+
+        std::string name;
+        std::vector<CpuEvent> events;
+    };
+
+    static std::atomic<bool> profilerEnabled(false);
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    // owns every buffer so the events outlive the threads that wrote them
+    static std::mutex registryMutex;
+    static std::vector<std::unique_ptr<ThreadBuffer>> registry;
+    static thread_local ThreadBuffer* threadBuffer = nullptr;
+
+    static ThreadBuffer* GetThreadBuffer() {
+
+        if (threadBuffer == nullptr) {
+
+            std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+            buffer->events.reserve(4096);
+
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffer->name = registry.empty() ? "Main" : "Thread " + std::to_string(registry.size());
+            threadBuffer = buffer.get();
+            registry.push_back(std::move(buffer));
+        }
+        return threadBuffer;
+    }
+
+    void CpuProfiler::setEnabled(bool enabled) {
+
+        profilerEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool CpuProfiler::isEnabled() {
+
+        return profilerEnabled.load(std::memory_order_relaxed);
+    }
+
+    void CpuProfiler::SetThreadName(const char* name) {
+
+        GetThreadBuffer()->name = name;
+    }
+
+    int64_t CpuProfiler::Now() {
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void CpuProfiler::Record(const char* name, int64_t begin, int64_t end) {
+
+        ThreadBuffer* buffer = GetThreadBuffer();
+        if (buffer->events.size() < MAX_EVENTS_PER_THREAD) {
+            buffer->events.push_back({ name, begin, end });
+        }
+    }
+
+    void CpuProfiler::PrintSummary() {
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+
+        std::vector<const char*> names;
+        std::vector<double> totals;
+        std::vector<long> counts;
+        long frames = 0;
+
+        for (size_t b = 0; b < registry.size(); b++) {
+            for (size_t i = 0; i < registry[b]->events.size(); i++) {
+
+                const CpuEvent& event = registry[b]->events[i];
+                size_t n = 0;
+                while (n < names.size() && names[n] != event.name)
+                    n++;
+                if (n == names.size()) {
+
+                    names.push_back(event.name);
+                    totals.push_back(0.0);
+                    counts.push_back(0);
+                }
+                totals[n] += (event.end - event.begin) / 1000000.0;
+                counts[n]++;
+
+                if (std::string(event.name) == "Frame")
+                    frames++;
+            }
+        }
+
+        if (frames == 0)
+            frames = 1;
+
+        printf("CPU profile over %ld frames (average per frame):\n", frames);
+        for (size_t n = 0; n < names.size(); n++) {
+            printf("  %-24s %8.3f ms %8.1f calls\n", names[n], totals[n] / frames, (double)counts[n] / frames);
+        }
+    }
+
+    void CpuProfiler::WriteChromeTrace(std::string fileName) {
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+
+        FILE* file = fopen(fileName.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "ERROR: could not write %s\n", fileName.c_str());
+            return;
+        }
+
+        size_t written = 0;
+        fprintf(file, "{\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}}");
+        for (size_t b = 0; b < registry.size(); b++) {
+
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                b + 1, registry[b]->name.c_str());
+
+            // complete events - microseconds, nested by time containment
+            for (size_t i = 0; i < registry[b]->events.size(); i++) {
+
+                const CpuEvent& event = registry[b]->events[i];
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, b + 1, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+                written++;
+            }
+        }
+        fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(file);
+
+        printf("CPU trace with %zu events written to %s\n", written, fileName.c_str());
+    }
+
+    CpuZone::CpuZone(const char* name) : name(name), begin(0), active(CpuProfiler::isEnabled()) {
+
+        if (active)
+            begin = CpuProfiler::Now();
+    }
+
+    CpuZone::~CpuZone() {
+
+        if (active)
+            CpuProfiler::Record(name, begin, CpuProfiler::Now());
+    }
+}
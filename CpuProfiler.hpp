@@ -0,0 +1,57 @@
+#ifndef CpuProfiler_hpp
+#define CpuProfiler_hpp
+
+#include <cstdint>
+#include <string>
+
+// GPS_ENABLE_PROFILING compiles the zones in; without it GPS_PROFILE_ZONE expands to nothing
+#ifdef GPS_ENABLE_PROFILING
+    #define GPS_PROFILE_CONCAT_(a, b) a##b
+    #define GPS_PROFILE_CONCAT(a, b) GPS_PROFILE_CONCAT_(a, b)
+    #define GPS_PROFILE_ZONE(name) gps::CpuZone GPS_PROFILE_CONCAT(cpuZone, __LINE__)(name)
+#else
+    #define GPS_PROFILE_ZONE(name)
+#endif
+
+namespace gps {
+
+    // Scoped CPU timing written to per-thread buffers
+    // Recording takes no locks - a thread only touches its own buffer, registered once on its first zone
+    // The trace is written after recording stopped, once worker threads have finished
+    class CpuProfiler {
+
+    public:
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        // Label for the calling thread in the trace
+        static void SetThreadName(const char* name);
+
+        // Nanoseconds since the profiler was first used
+        static int64_t Now();
+
+        // Zone names must outlive the profiler (string literals)
+        static void Record(const char* name, int64_t begin, int64_t end);
+
+        // Average milliseconds per frame for every zone, a frame being one "Frame" zone
+        static void PrintSummary();
+
+        // Chrome trace-event format - open with chrome://tracing or ui.perfetto.dev
+        static void WriteChromeTrace(std::string fileName);
+    };
+
+    // Times the enclosing block when the profiler is enabled
+    class CpuZone {
+
+    public:
+        CpuZone(const char* name);
+        ~CpuZone();
+
+    private:
+        const char* name;
+        int64_t begin;
+        bool active;
+    };
+}
+
+#endif /* CpuProfiler_hpp */
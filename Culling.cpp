@@ -0,0 +1,73 @@
+#include "Culling.hpp"
+
+namespace gps {
+
+    // Gribb-Hartmann plane extraction from the rows of the clip matrix
+    void Frustum::Extract(glm::mat4 clipMatrix) {
+
+        glm::vec4 rowX(clipMatrix[0][0], clipMatrix[1][0], clipMatrix[2][0], clipMatrix[3][0]);
+        glm::vec4 rowY(clipMatrix[0][1], clipMatrix[1][1], clipMatrix[2][1], clipMatrix[3][1]);
+        glm::vec4 rowZ(clipMatrix[0][2], clipMatrix[1][2], clipMatrix[2][2], clipMatrix[3][2]);
+        glm::vec4 rowW(clipMatrix[0][3], clipMatrix[1][3], clipMatrix[2][3], clipMatrix[3][3]);
+
+        planes[0] = rowW + rowX; // left
+        planes[1] = rowW - rowX; // right
+        planes[2] = rowW + rowY; // bottom
+        planes[3] = rowW - rowY; // top
+        planes[4] = rowW + rowZ; // near
+        planes[5] = rowW - rowZ; // far
+
+        // normalize so the plane equation gives real distances for the sphere test
+        for (int i = 0; i < 6; i++) {
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+    }
+
+    bool Frustum::Intersects(glm::vec3 center, float radius) {
+
+        for (int i = 0; i < 6; i++) {
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    CullingInfo MakeCullingInfo(glm::mat4 projection, glm::mat4 modelView) {
+
+        CullingInfo info;
+        info.frustum.Extract(projection * modelView);
+        // the eye sits at the view space origin - bring it back into object space
+        info.cameraPosition = glm::vec3(glm::inverse(modelView) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        info.backfaceCulling = true;
+        info.occlusionCulling = false;
+        return info;
+    }
+
+    CullingInfo MakeShadowCullingInfo(glm::mat4 projection, glm::mat4 modelView) {
+
+        CullingInfo info = MakeCullingInfo(projection, modelView);
+        info.backfaceCulling = false;
+        return info;
+    }
+
+    BoundingSphere Merge(BoundingSphere a, BoundingSphere b) {
+
+        float distance = glm::length(b.center - a.center);
+        if (distance + b.radius <= a.radius)
+            return a;
+        if (distance + a.radius <= b.radius)
+            return b;
+
+        BoundingSphere merged;
+        merged.radius = (distance + a.radius + b.radius) * 0.5f;
+        merged.center = a.center + (b.center - a.center) * ((merged.radius - a.radius) / distance);
+        return merged;
+    }
+
+    // coneCutoff is the sine of the cone half angle (>= 1 disables the test)
+    bool IsBackfacing(glm::vec3 center, float radius, glm::vec3 coneAxis, float coneCutoff, glm::vec3 cameraPosition) {
+
+        glm::vec3 toCenter = center - cameraPosition;
+        return glm::dot(toCenter, coneAxis) >= coneCutoff * glm::length(toCenter) + radius;
+    }
+}
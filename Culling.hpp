@@ -0,0 +1,51 @@
+#ifndef Culling_hpp
+#define Culling_hpp
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    struct BoundingSphere {
+
+        glm::vec3 center;
+        float radius;
+    };
+
+    class Frustum {
+
+    public:
+        // Extracts the six clip planes from a projection * view * model matrix
+        // The planes end up in the object space of whatever the model matrix transforms
+        void Extract(glm::mat4 clipMatrix);
+
+        // True if the sphere is at least partially inside all six planes
+        bool Intersects(glm::vec3 center, float radius);
+
+    private:
+        glm::vec4 planes[6];
+    };
+
+    // Everything needed to cull the parts of one model, in that model's object space
+    struct CullingInfo {
+
+        Frustum frustum;
+        glm::vec3 cameraPosition;
+        // normal cone test - off for shadow casters, whose back faces still block the light
+        bool backfaceCulling;
+        // draw the meshlet groups behind occlusion queries issued this frame, see Mesh::QueryOcclusion
+        bool occlusionCulling;
+    };
+
+    CullingInfo MakeCullingInfo(glm::mat4 projection, glm::mat4 modelView);
+
+    // Caster culling for a light's projection - frustum only
+    CullingInfo MakeShadowCullingInfo(glm::mat4 projection, glm::mat4 modelView);
+
+    // Smallest sphere holding both spheres
+    BoundingSphere Merge(BoundingSphere a, BoundingSphere b);
+
+    // Normal cone test - true if every triangle inside the bounds faces away from the camera
+    bool IsBackfacing(glm::vec3 center, float radius, glm::vec3 coneAxis, float coneCutoff, glm::vec3 cameraPosition);
+}
+
+#endif /* Culling_hpp */
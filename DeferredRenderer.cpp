@@ -0,0 +1,254 @@
+#include "DeferredRenderer.hpp"
+#include "RenderStats.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace gps {
+
+    // lighting shader variants
+    static const unsigned DEFERRED_SUN = 1u;
+    static const unsigned DEFERRED_POINT_LIGHT = 2u;
+    static const unsigned DEFERRED_SHADOWS = 4u;
+
+    // G-buffer texture units during the lighting passes
+    static const GLint ALBEDO_UNIT = 0;
+    static const GLint SPECULAR_UNIT = 1;
+    static const GLint NORMAL_UNIT = 2;
+    static const GLint DEPTH_UNIT = 3;
+
+    void DeferredRenderer::Init(int width, int height, GLuint frameUniformsBinding, GLint shadowMapUnit, GLint pointShadowMapUnit) {
+
+        this->width = width;
+        this->height = height;
+        this->shadowMapUnit = shadowMapUnit;
+        this->pointShadowMapUnit = pointShadowMapUnit;
+
+        lightingShaders.Load("shaders/deferred.vert", "shaders/deferred.frag", { "SUN_ON", "POINT_LIGHT", "SHADOWS" });
+        lightingShaders.BindUniformBlock("FrameUniforms", frameUniformsBinding);
+        InitSamplers();
+
+        CreateTargets();
+        CreateSphere();
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    void DeferredRenderer::Delete() {
+
+        lightingShaders.Delete();
+        GLuint textures[] = { albedoTexture, specularTexture, normalTexture, depthTexture };
+        glDeleteTextures(4, textures);
+        glDeleteFramebuffers(1, &gBuffer);
+        GLuint buffers[] = { sphereVBO, sphereEBO, instanceVBO };
+        glDeleteBuffers(3, buffers);
+        glDeleteVertexArrays(1, &sphereVAO);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    static GLuint CreateTarget(GLenum internalFormat, GLenum format, GLenum type, int width, int height) {
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        // read back with texelFetch, one texel per pixel
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void DeferredRenderer::CreateTargets() {
+
+        albedoTexture = CreateTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        specularTexture = CreateTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        normalTexture = CreateTarget(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, width, height);
+        depthTexture = CreateTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        renderStats.textureBytes += (size_t)width * height * (4 + 4 + 8 + 4);
+
+        // the window's framebuffer is not 0 in headless mode - whatever was bound is bound again afterwards
+        GLint previousFramebuffer;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffers(1, &gBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, specularTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, drawBuffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Could not create the G-buffer!");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    }
+
+    // UV sphere slightly larger than the unit sphere, so its flat faces still enclose the light's range
+    void DeferredRenderer::CreateSphere() {
+
+        const float PI = 3.14159265f;
+        float scale = 1.0f / (std::cos(PI / SPHERE_SEGMENTS) * std::cos(PI / (2 * SPHERE_RINGS)));
+
+        std::vector<glm::vec3> vertices;
+        for (int ring = 0; ring <= SPHERE_RINGS; ring++) {
+            float theta = PI * ring / SPHERE_RINGS;
+            for (int segment = 0; segment <= SPHERE_SEGMENTS; segment++) {
+                float phi = 2.0f * PI * segment / SPHERE_SEGMENTS;
+                vertices.push_back(scale * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+            }
+        }
+
+        std::vector<GLuint> indices;
+        for (int ring = 0; ring < SPHERE_RINGS; ring++) {
+            for (int segment = 0; segment < SPHERE_SEGMENTS; segment++) {
+                GLuint a = ring * (SPHERE_SEGMENTS + 1) + segment;
+                GLuint b = a + SPHERE_SEGMENTS + 1;
+                // counter-clockwise seen from outside
+                indices.insert(indices.end(), { a, a + 1, b, b, a + 1, b + 1 });
+            }
+        }
+        sphereIndexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &sphereVAO);
+        glBindVertexArray(sphereVAO);
+
+        glGenBuffers(1, &sphereVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+
+        glGenBuffers(1, &sphereEBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+        // per light - world position + range, color + shadow slot
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (GLvoid*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (GLvoid*)sizeof(glm::vec4));
+        glVertexAttribDivisor(2, 1);
+
+        glBindVertexArray(0);
+        renderStats.bufferBytes += vertices.size() * sizeof(glm::vec3) + indices.size() * sizeof(GLuint);
+    }
+
+    void DeferredRenderer::InitSamplers() {
+
+        // every variant is built here, up front
+        unsigned keys[] = { 0, DEFERRED_SUN, DEFERRED_SUN | DEFERRED_POINT_LIGHT,
+            DEFERRED_SUN | DEFERRED_SHADOWS, DEFERRED_SUN | DEFERRED_POINT_LIGHT | DEFERRED_SHADOWS };
+        for (unsigned key : keys) {
+            Shader& shader = lightingShaders.Get(key);
+            shader.useShaderProgram();
+            glUniform1i(shader.getUniformLocation("albedoBuffer"), ALBEDO_UNIT);
+            glUniform1i(shader.getUniformLocation("specularBuffer"), SPECULAR_UNIT);
+            glUniform1i(shader.getUniformLocation("normalBuffer"), NORMAL_UNIT);
+            glUniform1i(shader.getUniformLocation("depthBuffer"), DEPTH_UNIT);
+            if (key & DEFERRED_SHADOWS)
+                glUniform1i(shader.getUniformLocation("shadowMap"), shadowMapUnit);
+            if ((key & DEFERRED_SHADOWS) && (key & DEFERRED_POINT_LIGHT))
+                glUniform1i(shader.getUniformLocation("pointShadowMap"), pointShadowMapUnit);
+        }
+    }
+
+    void DeferredRenderer::SetLights(const std::vector<PointLight>& lights) {
+
+        std::vector<glm::vec4> instances;
+        for (size_t i = 0; i < lights.size(); i++) {
+            instances.push_back(glm::vec4(lights[i].position, lights[i].range));
+            instances.push_back(glm::vec4(lights[i].color, (float)lights[i].shadowSlot));
+        }
+        lightCount = (GLsizei)lights.size();
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::vec4), instances.empty() ? NULL : &instances[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void DeferredRenderer::BeginGeometry() {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
+    }
+
+    void DeferredRenderer::BindTargets() {
+
+        GLuint textures[] = { albedoTexture, specularTexture, normalTexture, depthTexture };
+        GLint units[] = { ALBEDO_UNIT, SPECULAR_UNIT, NORMAL_UNIT, DEPTH_UNIT };
+        for (int i = 0; i < 4; i++) {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        renderStats.textureBinds += 4;
+    }
+
+    void DeferredRenderer::Light(bool sun, bool pointLights, bool shadows) {
+
+        // screen space passes - the rendering mode only applies to the meshes
+        GLint polygonMode[2], depthFunc;
+        glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+        glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+        BindTargets();
+
+        // sun, or the unlit albedo - also copies the G-buffer depth into the bound framebuffer
+        glDepthFunc(GL_ALWAYS);
+        unsigned shadowKey = (sun && shadows) ? DEFERRED_SHADOWS : 0u;
+        lightingShaders.Get(sun ? (DEFERRED_SUN | shadowKey) : 0).useShaderProgram();
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        renderStats.drawCalls++;
+        renderStats.trianglesSubmitted++;
+
+        // point light volumes, added on top - back faces, so they still cover the pixels with the camera inside,
+        // depth tested so the pixels whose surface lies behind the whole volume (the distant terrain) are never shaded
+        if (sun && pointLights && lightCount > 0) {
+            lightingShaders.Get(DEFERRED_SUN | DEFERRED_POINT_LIGHT | shadowKey).useShaderProgram();
+            glDepthFunc(GL_GEQUAL);
+            glDepthMask(GL_FALSE);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glCullFace(GL_FRONT);
+
+            glBindVertexArray(sphereVAO);
+            glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, 0, lightCount);
+            renderStats.drawCalls++;
+            renderStats.trianglesSubmitted += sphereIndexCount / 3 * lightCount;
+
+            glCullFace(GL_BACK);
+            glDisable(GL_BLEND);
+            glDepthMask(GL_TRUE);
+        }
+
+        glBindVertexArray(0);
+        for (int unit = DEPTH_UNIT; unit >= ALBEDO_UNIT; unit--) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        glDepthFunc(depthFunc);
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+    }
+
+    bool DeferredRenderer::usesFile(const std::string& fileName) {
+
+        return lightingShaders.usesFile(fileName);
+    }
+
+    bool DeferredRenderer::ReloadShaders() {
+
+        if (!lightingShaders.Reload())
+            return false;
+        InitSamplers();
+        return true;
+    }
+}
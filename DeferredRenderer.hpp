@@ -0,0 +1,77 @@
+#ifndef DeferredRenderer_hpp
+#define DeferredRenderer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Shader.hpp"
+#include "LightClusters.hpp"
+
+namespace gps {
+
+    // Deferred shading - the meshes are drawn once into a G-buffer (basic.frag with GBUFFER),
+    // then lit in screen space: a full screen pass for the sun and one sphere per point light,
+    // so every light only shades the pixels it covers and overdraw no longer multiplies the lighting
+    //   albedo   (SRGB8_ALPHA8) - diffuse texture
+    //   specular (SRGB8_ALPHA8) - specular texture, or white for the shiny meshes
+    //   normal   (RGBA16F)      - eye space normal
+    //   depth    (DEPTH24)      - eye space position is rebuilt from it
+    class DeferredRenderer {
+
+    public:
+        // The sun's shadow cascades are read from shadowMapUnit and the point light cubes from pointShadowMapUnit,
+        // both bound by the caller
+        void Init(int width, int height, GLuint frameUniformsBinding, GLint shadowMapUnit, GLint pointShadowMapUnit);
+        void Delete();
+
+        // Point lights drawn as light volumes - call again when they change
+        void SetLights(const std::vector<PointLight>& lights);
+
+        // Binds and clears the G-buffer, the meshes are drawn next
+        void BeginGeometry();
+
+        // Lights the G-buffer into the bound framebuffer, leaving the pixels no mesh covered untouched
+        // Without the sun the albedo is shown unlit, the point lights only add to the sun (as in basic.frag)
+        // With shadows the point lights with a shadowSlot are shadowed too
+        void Light(bool sun, bool pointLights, bool shadows);
+
+        bool usesFile(const std::string& fileName);
+        bool ReloadShaders();
+
+    private:
+        static const int SPHERE_SEGMENTS = 12;
+        static const int SPHERE_RINGS = 8;
+
+        int width = 0, height = 0;
+        GLint shadowMapUnit = 0, pointShadowMapUnit = 0;
+        GLuint gBuffer = 0;
+        GLuint albedoTexture = 0, specularTexture = 0, normalTexture = 0, depthTexture = 0;
+
+        ShaderPermutations lightingShaders;
+
+        // full screen triangle, made up from gl_VertexID
+        GLuint emptyVAO = 0;
+
+        // unit sphere, instanced once per light
+        GLuint sphereVAO = 0, sphereVBO = 0, sphereEBO = 0, instanceVBO = 0;
+        GLsizei sphereIndexCount = 0;
+        GLsizei lightCount = 0;
+
+        void CreateTargets();
+        void CreateSphere();
+        void InitSamplers();
+        void BindTargets();
+    };
+}
+
+#endif /* DeferredRenderer_hpp */
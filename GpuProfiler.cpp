@@ -0,0 +1,209 @@
+#include "GpuProfiler.hpp"
+
+#include <cstdio>
+
+namespace gps {
+
+    // Upper bound on stored events so a long session cannot grow without limit
+    static const size_t MAX_EVENTS = 1000000;
+
+    void GpuProfiler::Init() {
+
+        for (int i = 0; i < FRAMES; i++) {
+
+            frames[i].queriesUsed = 0;
+            frames[i].frame = 0;
+            frames[i].pending = false;
+        }
+        initialized = true;
+    }
+
+    void GpuProfiler::Delete() {
+
+        for (int i = 0; i < FRAMES; i++) {
+
+            if (!frames[i].queryPool.empty())
+                glDeleteQueries((GLsizei)frames[i].queryPool.size(), &frames[i].queryPool[0]);
+            frames[i].queryPool.clear();
+        }
+        initialized = false;
+    }
+
+    void GpuProfiler::setEnabled(bool enabled) {
+
+        this->enabled = enabled;
+    }
+
+    bool GpuProfiler::isEnabled() {
+
+        return this->enabled;
+    }
+
+    void GpuProfiler::BeginFrame() {
+
+        if (!enabled || !initialized)
+            return;
+
+        FrameQueries& frame = frames[frameCounter % FRAMES];
+        Resolve(frame);
+
+        frame.scopes.clear();
+        frame.queriesUsed = 0;
+        frame.frame = frameCounter;
+        frame.pending = true;
+        scopeStack.clear();
+        inFrame = true;
+
+        BeginScope("Frame");
+    }
+
+    void GpuProfiler::EndFrame() {
+
+        if (!inFrame)
+            return;
+
+        // close anything left open, the frame scope included
+        while (!scopeStack.empty())
+            EndScope();
+
+        inFrame = false;
+        frameCounter++;
+    }
+
+    void GpuProfiler::BeginScope(const char* name) {
+
+        if (!inFrame)
+            return;
+
+        FrameQueries& frame = frames[frameCounter % FRAMES];
+
+        ScopeRecord scope;
+        scope.name = name;
+        scope.depth = (int)scopeStack.size();
+        scope.beginQuery = NextQuery(frame);
+        scope.endQuery = NextQuery(frame);
+        glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+
+        scopeStack.push_back(frame.scopes.size());
+        frame.scopes.push_back(scope);
+    }
+
+    void GpuProfiler::EndScope() {
+
+        if (!inFrame || scopeStack.empty())
+            return;
+
+        FrameQueries& frame = frames[frameCounter % FRAMES];
+        glQueryCounter(frame.scopes[scopeStack.back()].endQuery, GL_TIMESTAMP);
+        scopeStack.pop_back();
+    }
+
+    GLuint GpuProfiler::NextQuery(FrameQueries& frame) {
+
+        if (frame.queriesUsed == frame.queryPool.size()) {
+
+            GLuint query;
+            glGenQueries(1, &query);
+            frame.queryPool.push_back(query);
+        }
+        return frame.queryPool[frame.queriesUsed++];
+    }
+
+    void GpuProfiler::Resolve(FrameQueries& frame) {
+
+        if (!frame.pending)
+            return;
+
+        for (size_t i = 0; i < frame.scopes.size(); i++) {
+
+            GpuEvent event;
+            event.name = frame.scopes[i].name;
+            event.depth = frame.scopes[i].depth;
+            event.frame = frame.frame;
+            glGetQueryObjectui64v(frame.scopes[i].beginQuery, GL_QUERY_RESULT, &event.begin);
+            glGetQueryObjectui64v(frame.scopes[i].endQuery, GL_QUERY_RESULT, &event.end);
+
+            if (events.size() < MAX_EVENTS)
+                events.push_back(event);
+        }
+        frame.pending = false;
+    }
+
+    void GpuProfiler::ResolveAll() {
+
+        if (!initialized || inFrame)
+            return;
+
+        // oldest first, so the events stay in frame order
+        for (int i = 0; i < FRAMES; i++)
+            Resolve(frames[(frameCounter + i) % FRAMES]);
+    }
+
+    void GpuProfiler::PrintSummary() {
+
+        ResolveAll();
+
+        // accumulate per scope name, in the order the scopes first appeared
+        std::vector<const char*> names;
+        std::vector<int> depths;
+        std::vector<double> totals;
+        std::vector<long> counts;
+
+        for (size_t i = 0; i < events.size(); i++) {
+
+            size_t n = 0;
+            while (n < names.size() && !(names[n] == events[i].name && depths[n] == events[i].depth))
+                n++;
+            if (n == names.size()) {
+
+                names.push_back(events[i].name);
+                depths.push_back(events[i].depth);
+                totals.push_back(0.0);
+                counts.push_back(0);
+            }
+            totals[n] += (events[i].end - events[i].begin) / 1000000.0;
+            counts[n]++;
+        }
+
+        printf("GPU profile (average ms per frame):\n");
+        for (size_t n = 0; n < names.size(); n++) {
+            printf("%*s%-*s %8.3f\n", depths[n] * 2, "", 24 - depths[n] * 2, names[n], totals[n] / counts[n]);
+        }
+    }
+
+    void GpuProfiler::WriteChromeTrace(std::string fileName) {
+
+        ResolveAll();
+
+        FILE* file = fopen(fileName.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "ERROR: could not write %s\n", fileName.c_str());
+            return;
+        }
+
+        GLuint64 origin = events.empty() ? 0 : events[0].begin;
+
+        fprintf(file, "{\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GPU\"}}");
+        for (size_t i = 0; i < events.size(); i++) {
+
+            // complete events - microseconds, nested by time containment
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%ld}}",
+                events[i].name, (events[i].begin - origin) / 1000.0, (events[i].end - events[i].begin) / 1000.0, events[i].frame);
+        }
+        fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(file);
+
+        printf("GPU trace with %zu events written to %s\n", events.size(), fileName.c_str());
+    }
+
+    GpuScope::GpuScope(GpuProfiler& profiler, const char* name) : profiler(profiler) {
+
+        profiler.BeginScope(name);
+    }
+
+    GpuScope::~GpuScope() {
+
+        profiler.EndScope();
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef GpuProfiler_hpp
+#define GpuProfiler_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // One finished GPU scope, timestamps in nanoseconds
+    struct GpuEvent {
+
+        const char* name;
+        int depth;
+        long frame;
+        GLuint64 begin;
+        GLuint64 end;
+    };
+
+    // Hierarchical GPU timing with GL_TIMESTAMP queries
+    // Queries of a frame are read back FRAMES frames later, when they have long completed, so nothing stalls
+    class GpuProfiler {
+
+    public:
+        void Init();
+        void Delete();
+
+        void setEnabled(bool enabled);
+        bool isEnabled();
+
+        void BeginFrame();
+        void EndFrame();
+
+        // Scope names must outlive the profiler (string literals)
+        void BeginScope(const char* name);
+        void EndScope();
+
+        // Average milliseconds per scope over the recorded frames, indented by depth
+        void PrintSummary();
+
+        // Chrome trace-event format - open with chrome://tracing or ui.perfetto.dev
+        void WriteChromeTrace(std::string fileName);
+
+    private:
+        static const int FRAMES = 4;
+
+        struct ScopeRecord {
+
+            const char* name;
+            int depth;
+            GLuint beginQuery;
+            GLuint endQuery;
+        };
+
+        struct FrameQueries {
+
+            std::vector<ScopeRecord> scopes;
+            std::vector<GLuint> queryPool;
+            size_t queriesUsed;
+            long frame;
+            bool pending;
+        };
+
+        bool enabled = false;
+        bool initialized = false;
+        bool inFrame = false;
+        long frameCounter = 0;
+        FrameQueries frames[FRAMES];
+        std::vector<size_t> scopeStack;
+        std::vector<GpuEvent> events;
+
+        GLuint NextQuery(FrameQueries& frame);
+        void Resolve(FrameQueries& frame);
+        void ResolveAll();
+    };
+
+    // Times everything issued until the end of the enclosing block
+    class GpuScope {
+
+    public:
+        GpuScope(GpuProfiler& profiler, const char* name);
+        ~GpuScope();
+
+    private:
+        GpuProfiler& profiler;
+    };
+}
+
+#endif /* GpuProfiler_hpp */
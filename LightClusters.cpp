@@ -0,0 +1,186 @@
+#include "LightClusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    void LightClusters::Init() {
+
+        for (int i = 0; i < BUFFER_SETS; i++) {
+            createBufferTexture(lightBuffers[i], lightTextures[i], GL_RGBA32F);
+            createBufferTexture(clusterBuffers[i], clusterTextures[i], GL_RG32UI);
+            createBufferTexture(indexBuffers[i], indexTextures[i], GL_R32UI);
+        }
+        clusterLights.resize(TILES_X * TILES_Y * SLICES);
+    }
+
+    void LightClusters::Delete() {
+
+        glDeleteBuffers(BUFFER_SETS, lightBuffers);
+        glDeleteBuffers(BUFFER_SETS, clusterBuffers);
+        glDeleteBuffers(BUFFER_SETS, indexBuffers);
+        glDeleteTextures(BUFFER_SETS, lightTextures);
+        glDeleteTextures(BUFFER_SETS, clusterTextures);
+        glDeleteTextures(BUFFER_SETS, indexTextures);
+    }
+
+    void LightClusters::createBufferTexture(GLuint& buffer, GLuint& texture, GLenum format) {
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        // a buffer texture needs storage before it can be attached
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::SetProjection(glm::mat4 projection, float nearPlane, float farPlane, int viewportWidth, int viewportHeight) {
+
+        this->projection = projection;
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+
+        float logRatio = std::log(farPlane / nearPlane);
+        clusterScale = glm::vec4((float)TILES_X / viewportWidth, (float)TILES_Y / viewportHeight,
+            SLICES / logRatio, SLICES * std::log(nearPlane) / logRatio);
+
+        clusterMin.resize(TILES_X * TILES_Y * SLICES);
+        clusterMax.resize(TILES_X * TILES_Y * SLICES);
+
+        // a point at depth d seen through normalized device coordinates (x, y) is d * (x / P00, y / P11, -1)
+        float scaleX = 1.0f / projection[0][0];
+        float scaleY = 1.0f / projection[1][1];
+
+        for (int z = 0; z < SLICES; z++) {
+            float depths[2] = {
+                nearPlane * std::pow(farPlane / nearPlane, (float)z / SLICES),
+                nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / SLICES)
+            };
+            for (int y = 0; y < TILES_Y; y++) {
+                for (int x = 0; x < TILES_X; x++) {
+                    float ndcX[2] = { 2.0f * x / TILES_X - 1.0f, 2.0f * (x + 1) / TILES_X - 1.0f };
+                    float ndcY[2] = { 2.0f * y / TILES_Y - 1.0f, 2.0f * (y + 1) / TILES_Y - 1.0f };
+
+                    glm::vec3 minimum(1e30f), maximum(-1e30f);
+                    for (int corner = 0; corner < 8; corner++) {
+                        float depth = depths[corner & 1];
+                        glm::vec3 point(depth * ndcX[(corner >> 1) & 1] * scaleX, depth * ndcY[corner >> 2] * scaleY, -depth);
+                        minimum = glm::min(minimum, point);
+                        maximum = glm::max(maximum, point);
+                    }
+
+                    int cluster = (z * TILES_Y + y) * TILES_X + x;
+                    clusterMin[cluster] = minimum;
+                    clusterMax[cluster] = maximum;
+                }
+            }
+        }
+    }
+
+    int LightClusters::slice(float depth) {
+
+        int z = (int)std::floor(std::log(depth) * clusterScale.z - clusterScale.w);
+        return std::max(0, std::min(SLICES - 1, z));
+    }
+
+    void LightClusters::Update(const std::vector<PointLight>& lights, glm::mat4 view) {
+
+        for (size_t i = 0; i < clusterLights.size(); i++)
+            clusterLights[i].clear();
+
+        lightData.resize(lights.size() * 2);
+        for (size_t i = 0; i < lights.size(); i++) {
+            glm::vec3 center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            float radius = lights[i].range;
+            lightData[2 * i] = glm::vec4(center, radius);
+            lightData[2 * i + 1] = glm::vec4(lights[i].color, (float)lights[i].shadowSlot);
+
+            // depth range of the light, skipped when it is entirely in front of or behind the frustum
+            float nearDepth = -center.z - radius;
+            float farDepth = -center.z + radius;
+            if (farDepth < nearPlane || nearDepth > farPlane)
+                continue;
+
+            int z0 = slice(std::max(nearDepth, nearPlane));
+            int z1 = slice(std::min(farDepth, farPlane));
+
+            // screen rectangle from the corners of the light's bounding box
+            // (a box reaching past the near plane projects across the whole screen)
+            int x0 = 0, x1 = TILES_X - 1, y0 = 0, y1 = TILES_Y - 1;
+            if (nearDepth > nearPlane) {
+                glm::vec2 minimum(1e30f), maximum(-1e30f);
+                for (int corner = 0; corner < 8; corner++) {
+                    glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius);
+                    glm::vec4 clip = projection * glm::vec4(center + offset, 1.0f);
+                    glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+                    minimum = glm::min(minimum, ndc);
+                    maximum = glm::max(maximum, ndc);
+                }
+                if (maximum.x < -1.0f || minimum.x > 1.0f || maximum.y < -1.0f || minimum.y > 1.0f)
+                    continue;
+
+                x0 = std::max(0, (int)std::floor((minimum.x * 0.5f + 0.5f) * TILES_X));
+                x1 = std::min(TILES_X - 1, (int)std::floor((maximum.x * 0.5f + 0.5f) * TILES_X));
+                y0 = std::max(0, (int)std::floor((minimum.y * 0.5f + 0.5f) * TILES_Y));
+                y1 = std::min(TILES_Y - 1, (int)std::floor((maximum.y * 0.5f + 0.5f) * TILES_Y));
+            }
+
+            // exact sphere / box test for the clusters inside the rectangle
+            for (int z = z0; z <= z1; z++) {
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x++) {
+                        int cluster = (z * TILES_Y + y) * TILES_X + x;
+                        glm::vec3 closest = glm::clamp(center, clusterMin[cluster], clusterMax[cluster]);
+                        glm::vec3 delta = closest - center;
+                        if (glm::dot(delta, delta) <= radius * radius)
+                            clusterLights[cluster].push_back((GLuint)i);
+                    }
+                }
+            }
+        }
+
+        // flatten the per-cluster lists
+        clusterData.resize(clusterLights.size() * 2);
+        indexData.clear();
+        for (size_t i = 0; i < clusterLights.size(); i++) {
+            clusterData[2 * i] = (GLuint)indexData.size();
+            clusterData[2 * i + 1] = (GLuint)clusterLights[i].size();
+            indexData.insert(indexData.end(), clusterLights[i].begin(), clusterLights[i].end());
+        }
+
+        currentSet = (currentSet + 1) % BUFFER_SETS;
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffers[currentSet]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(lightData.size(), 1) * sizeof(glm::vec4), lightData.empty() ? NULL : lightData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffers[currentSet]);
+        glBufferData(GL_TEXTURE_BUFFER, clusterData.size() * sizeof(GLuint), clusterData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffers[currentSet]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(indexData.size(), 1) * sizeof(GLuint), indexData.empty() ? NULL : indexData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::Bind(GLuint firstUnit) {
+
+        GLuint textures[] = { lightTextures[currentSet], clusterTextures[currentSet], indexTextures[currentSet] };
+        for (GLuint i = 0; i < 3; i++) {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    glm::vec4 LightClusters::getClusterScale() {
+
+        return clusterScale;
+    }
+
+    int LightClusters::getAssignedCount() {
+
+        return (int)indexData.size();
+    }
+}
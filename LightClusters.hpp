@@ -0,0 +1,87 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    struct PointLight {
+
+        glm::vec3 position;
+        // distance at which the light has faded out completely
+        float range;
+        glm::vec3 color;
+        // cube of the light in PointShadowAtlas, -1 when it casts no shadow
+        int shadowSlot;
+    };
+
+    // Clustered forward lighting - the view frustum is split into TILES_X * TILES_Y screen tiles
+    // and SLICES exponential depth slices, and every frame each light is assigned to the clusters it reaches
+    // GL 4.1 has neither SSBOs nor compute shaders, so the assignment runs on the CPU
+    // and the results go to the fragment shader as buffer textures:
+    //   pointLights   (RGBA32F) - two texels per light: eye space position + range, color + shadow slot
+    //   lightClusters (RG32UI)  - per cluster the offset and count of its lights in lightIndices
+    //   lightIndices  (R32UI)   - light indices, grouped by cluster
+    class LightClusters {
+
+    public:
+        static const int TILES_X = 16;
+        static const int TILES_Y = 9;
+        static const int SLICES = 24;
+
+        void Init();
+        void Delete();
+
+        // Cluster bounds follow the projection - call again when it or the viewport changes
+        void SetProjection(glm::mat4 projection, float nearPlane, float farPlane, int viewportWidth, int viewportHeight);
+
+        // Assigns the lights to the clusters seen through the view matrix and uploads the buffers
+        void Update(const std::vector<PointLight>& lights, glm::mat4 view);
+
+        // Binds the three buffer textures to firstUnit, firstUnit + 1 and firstUnit + 2
+        void Bind(GLuint firstUnit);
+
+        // x, y - tiles per pixel, z, w - scale and bias turning log(depth) into a slice
+        glm::vec4 getClusterScale();
+
+        // Light/cluster pairs written by the last Update
+        int getAssignedCount();
+
+    private:
+        // one set of buffers per frame the GPU may still be reading, written round robin
+        // so an update never waits for the frame that reads the previous one
+        static const int BUFFER_SETS = 3;
+        GLuint lightBuffers[BUFFER_SETS] = {}, lightTextures[BUFFER_SETS] = {};
+        GLuint clusterBuffers[BUFFER_SETS] = {}, clusterTextures[BUFFER_SETS] = {};
+        GLuint indexBuffers[BUFFER_SETS] = {}, indexTextures[BUFFER_SETS] = {};
+        int currentSet = 0;
+
+        glm::mat4 projection;
+        float nearPlane = 0.1f, farPlane = 1000.0f;
+        glm::vec4 clusterScale;
+
+        // eye space bounding boxes, one per cluster
+        std::vector<glm::vec3> clusterMin, clusterMax;
+
+        // rebuilt every frame, kept to reuse their memory
+        std::vector<std::vector<GLuint>> clusterLights;
+        std::vector<glm::vec4> lightData;
+        std::vector<GLuint> clusterData;
+        std::vector<GLuint> indexData;
+
+        int slice(float depth);
+        void createBufferTexture(GLuint& buffer, GLuint& texture, GLenum format);
+    };
+}
+
+#endif /* LightClusters_hpp */
@@ -0,0 +1,259 @@
+#include "LightProbeGrid.hpp"
+#include "AssetCache.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+namespace gps {
+
+    // directions sampled around each probe - a Fibonacci sphere, so every probe sees the same even spread
+    static const int SAMPLES = 256;
+    // a probe is buried when more of its paths start on a back face
+    static const float BACK_FACE_LIMIT = 0.25f;
+    // bounds of the grid - its texel count, and a depth of COEFFICIENTS slabs that still fits GL_MAX_3D_TEXTURE_SIZE
+    static const int MAX_PROBES = 1 << 18;
+    static const int MAX_DEPTH = 2048;
+    // probes are handed to the worker threads in batches
+    static const int BATCH_SIZE = 16;
+    // identifies the cache files - "GPLP", the version changes with the baking
+    static const uint32_t CACHE_MAGIC = 0x504c5047;
+    static const uint32_t CACHE_VERSION = 1;
+
+    // real L2 spherical harmonics, in the order basic.vert evaluates them
+    static void EvaluateBasis(glm::vec3 n, float basis[LightProbeGrid::COEFFICIENTS]) {
+
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * n.y;
+        basis[2] = 0.488603f * n.z;
+        basis[3] = 0.488603f * n.x;
+        basis[4] = 1.092548f * n.x * n.y;
+        basis[5] = 1.092548f * n.y * n.z;
+        basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+        basis[7] = 1.092548f * n.x * n.z;
+        basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+    }
+
+    static glm::vec3 FibonacciDirection(int i) {
+
+        float z = 1.0f - (2.0f * i + 1.0f) / SAMPLES;
+        float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        float angle = 2.3999632f * i;
+        return glm::vec3(radius * std::cos(angle), radius * std::sin(angle), z);
+    }
+
+    void LightProbeGrid::Bake(gps::BakeScene& scene, float spacing) {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        scene.Build();
+
+        // half a spacing around the geometry, so the outer probes are not on its surfaces
+        glm::vec3 boundsMin, boundsMax;
+        scene.getBounds(boundsMin, boundsMax);
+        glm::vec3 size = glm::max(boundsMax - boundsMin, glm::vec3(0.0f)) + spacing;
+        while (true) {
+            resolution = glm::max(glm::ivec3(glm::ceil(size / spacing)) + 1, glm::ivec3(2));
+            if (resolution.x * resolution.y * resolution.z <= MAX_PROBES && resolution.z * COEFFICIENTS <= MAX_DEPTH) {
+                break;
+            }
+            spacing *= 1.25f;
+        }
+        extent = glm::vec3(resolution - 1) * spacing;
+        origin = (boundsMin + boundsMax) * 0.5f - extent * 0.5f;
+        int probeCount = resolution.x * resolution.y * resolution.z;
+
+        printf("Light probes : baking %dx%dx%d probes, %.1f apart, against %d triangles on %d threads\n", resolution.x, resolution.y, resolution.z,
+            spacing, scene.getTriangleCount(), std::max(1, (int)std::thread::hardware_concurrency()));
+
+        // the cosine lobe's convolution per band, over pi like the lightmap's cosine weighted average
+        const float BAND_SCALES[COEFFICIENTS] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        std::vector<glm::vec3> probes((size_t)probeCount * COEFFICIENTS, glm::vec3(0.0f));
+        std::vector<char> valid(probeCount);
+        BakeScene::ParallelFor(probeCount, BATCH_SIZE, [&](int probe) {
+            glm::ivec3 cell(probe % resolution.x, (probe / resolution.x) % resolution.y, probe / (resolution.x * resolution.y));
+            glm::vec3 position = origin + glm::vec3(cell) * spacing;
+            BakeScene::Random random((uint32_t)probe);
+            glm::vec3* sums = &probes[(size_t)probe * COEFFICIENTS];
+            int backFaces = 0;
+            for (int s = 0; s < SAMPLES; s++) {
+                glm::vec3 direction = FibonacciDirection(s);
+                BakeScene::PathLight light = scene.TracePath(position, direction, random, false);
+                backFaces += light.backFace ? 1 : 0;
+                float basis[COEFFICIENTS];
+                EvaluateBasis(direction, basis);
+                for (int c = 0; c < COEFFICIENTS; c++) {
+                    sums[c] += light.sky * basis[c];
+                }
+            }
+            for (int c = 0; c < COEFFICIENTS; c++) {
+                sums[c] *= 4.0f * 3.14159265f / SAMPLES * BAND_SCALES[c];
+            }
+            valid[probe] = backFaces < SAMPLES * BACK_FACE_LIMIT;
+        });
+
+        // buried probes grow in from their valid neighbours, and take the open sky when there are none
+        int buried = 0;
+        for (int probe = 0; probe < probeCount; probe++) {
+            buried += valid[probe] ? 0 : 1;
+        }
+        const glm::ivec3 NEIGHBOURS[6] = { glm::ivec3(-1, 0, 0), glm::ivec3(1, 0, 0), glm::ivec3(0, -1, 0), glm::ivec3(0, 1, 0), glm::ivec3(0, 0, -1), glm::ivec3(0, 0, 1) };
+        bool grown = true;
+        while (grown) {
+            grown = false;
+            std::vector<char> wasValid = valid;
+            for (int probe = 0; probe < probeCount; probe++) {
+                if (wasValid[probe]) {
+                    continue;
+                }
+                glm::ivec3 cell(probe % resolution.x, (probe / resolution.x) % resolution.y, probe / (resolution.x * resolution.y));
+                glm::vec3 sums[COEFFICIENTS] = {};
+                int count = 0;
+                for (int n = 0; n < 6; n++) {
+                    glm::ivec3 neighbour = cell + NEIGHBOURS[n];
+                    if (neighbour.x < 0 || neighbour.y < 0 || neighbour.z < 0 ||
+                        neighbour.x >= resolution.x || neighbour.y >= resolution.y || neighbour.z >= resolution.z) {
+                        continue;
+                    }
+                    int other = (neighbour.z * resolution.y + neighbour.y) * resolution.x + neighbour.x;
+                    if (!wasValid[other]) {
+                        continue;
+                    }
+                    for (int c = 0; c < COEFFICIENTS; c++) {
+                        sums[c] += probes[(size_t)other * COEFFICIENTS + c];
+                    }
+                    count++;
+                }
+                if (count > 0) {
+                    for (int c = 0; c < COEFFICIENTS; c++) {
+                        probes[(size_t)probe * COEFFICIENTS + c] = sums[c] / (float)count;
+                    }
+                    valid[probe] = true;
+                    grown = true;
+                }
+            }
+        }
+        for (int probe = 0; probe < probeCount; probe++) {
+            if (!valid[probe]) {
+                std::fill(probes.begin() + (size_t)probe * COEFFICIENTS, probes.begin() + (size_t)(probe + 1) * COEFFICIENTS, glm::vec3(0.0f));
+                probes[(size_t)probe * COEFFICIENTS] = scene.getSkyLight() / 0.282095f;
+            }
+        }
+
+        coefficients.resize(probes.size());
+        for (int probe = 0; probe < probeCount; probe++) {
+            for (int c = 0; c < COEFFICIENTS; c++) {
+                coefficients[(size_t)c * probeCount + probe] = probes[(size_t)probe * COEFFICIENTS + c];
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Light probes : baked in %.1f s, %d buried\n", seconds, buried);
+    }
+
+    bool LightProbeGrid::LoadOrBake(const std::string& cacheDirectory, bool rebake, gps::BakeScene& scene, float spacing) {
+
+        Delete();
+
+        uint32_t settings[3] = { CACHE_VERSION, (uint32_t)SAMPLES, (uint32_t)MAX_PROBES };
+        uint64_t hash = AssetCache::Hash(settings, sizeof(settings), scene.getHash());
+        hash = AssetCache::Hash(&spacing, sizeof(spacing), hash);
+        std::string fileName = AssetCache::FileName(cacheDirectory, "probes", hash);
+
+        if (!rebake && !cacheDirectory.empty() && ReadCache(fileName)) {
+            printf("Light probes : loaded %s\n", fileName.c_str());
+        }
+        else {
+            Bake(scene, spacing);
+            if (!cacheDirectory.empty()) {
+                WriteCache(cacheDirectory, fileName);
+            }
+        }
+
+        Upload();
+        std::vector<glm::vec3>().swap(coefficients);
+        return true;
+    }
+
+    bool LightProbeGrid::ReadCache(const std::string& fileName) {
+
+        FILE* file = fopen(fileName.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        uint32_t header[2];
+        bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == CACHE_MAGIC && header[1] == CACHE_VERSION &&
+            fread(&resolution, sizeof(resolution), 1, file) == 1 && fread(&origin, sizeof(origin), 1, file) == 1 &&
+            fread(&extent, sizeof(extent), 1, file) == 1;
+        valid = valid && resolution.x >= 2 && resolution.y >= 2 && resolution.z >= 2 &&
+            resolution.x * resolution.y * resolution.z <= MAX_PROBES && resolution.z * COEFFICIENTS <= MAX_DEPTH;
+        if (valid) {
+            coefficients.resize((size_t)resolution.x * resolution.y * resolution.z * COEFFICIENTS);
+            valid = fread(&coefficients[0], sizeof(glm::vec3), coefficients.size(), file) == coefficients.size();
+        }
+        fclose(file);
+        return valid;
+    }
+
+    void LightProbeGrid::WriteCache(const std::string& cacheDirectory, const std::string& fileName) {
+
+        FILE* file = AssetCache::Create(cacheDirectory, fileName);
+        if (!file) {
+            return;
+        }
+        uint32_t header[2] = { CACHE_MAGIC, CACHE_VERSION };
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(&resolution, sizeof(resolution), 1, file);
+        fwrite(&origin, sizeof(origin), 1, file);
+        fwrite(&extent, sizeof(extent), 1, file);
+        fwrite(&coefficients[0], sizeof(glm::vec3), coefficients.size(), file);
+        fclose(file);
+    }
+
+    void LightProbeGrid::Upload() {
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, resolution.x, resolution.y, resolution.z * COEFFICIENTS, 0, GL_RGB, GL_FLOAT, &coefficients[0]);
+        // basic.vert keeps its lookups inside each slab, so the slabs do not bleed into each other
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        renderStats.textureBytes += coefficients.size() * 6;
+    }
+
+    void LightProbeGrid::Delete() {
+
+        if (texture != 0) {
+            glDeleteTextures(1, &texture);
+            texture = 0;
+        }
+    }
+
+    void LightProbeGrid::Bind(GLuint unit) {
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        renderStats.textureBinds++;
+    }
+
+    bool LightProbeGrid::isLoaded() {
+
+        return texture != 0;
+    }
+
+    glm::vec3 LightProbeGrid::getOrigin() {
+
+        return origin;
+    }
+
+    glm::vec3 LightProbeGrid::getExtent() {
+
+        return extent;
+    }
+}
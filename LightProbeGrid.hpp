@@ -0,0 +1,64 @@
+#ifndef LightProbeGrid_hpp
+#define LightProbeGrid_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "BakeScene.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Baked sky and bounce light for moving models - a regular grid of probes over the scene's bounds, each the light
+    // arriving from every direction as L2 spherical harmonics, path traced through the same BakeScene as the Lightmap
+    //   the coefficients are convolved with the cosine lobe and scaled like the lightmap's layer 1, so evaluated at a
+    //   normal they give the ambient basic.frag uses - what the lightmapped ground around the model gets
+    //   stored as one RGB16F 3D texture, the COEFFICIENTS slabs stacked along z, sampled per vertex by basic.vert's PROBES variant
+    //   probes buried in geometry (most paths start on a back face) take the average of their valid neighbours
+    // Bakes are stored in the asset cache, named after a hash of every input, and reloaded on later runs
+    class LightProbeGrid {
+
+    public:
+        static const int COEFFICIENTS = 9;
+
+        // Loads the grid from the cache directory, baking and storing it first when it is missing or rebake is set
+        // spacing - world distance between neighbouring probes, widened when the grid would get too large
+        bool LoadOrBake(const std::string& cacheDirectory, bool rebake, gps::BakeScene& scene, float spacing);
+
+        void Delete();
+
+        void Bind(GLuint unit);
+
+        bool isLoaded();
+
+        // world position of the first probe, and the distance from it to the last one
+        glm::vec3 getOrigin();
+        glm::vec3 getExtent();
+
+    private:
+        glm::ivec3 resolution;
+        glm::vec3 origin;
+        glm::vec3 extent;
+        GLuint texture = 0;
+        // texture order - coefficient, then z, y, x
+        std::vector<glm::vec3> coefficients;
+
+        void Bake(gps::BakeScene& scene, float spacing);
+
+        bool ReadCache(const std::string& fileName);
+        void WriteCache(const std::string& cacheDirectory, const std::string& fileName);
+
+        void Upload();
+    };
+}
+
+#endif /* LightProbeGrid_hpp */
@@ -0,0 +1,537 @@
+#include "Lightmap.hpp"
+#include "AssetCache.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+namespace gps {
+
+    // hemisphere paths traced per texel
+    static const int SAMPLES = 64;
+    // texels around each chart - keeps bilinear filtering from reaching into the neighbouring charts
+    static const int CHART_PADDING = 1;
+    // texels whose centre is this close to a triangle, in texels, are baked from it even when outside
+    static const float EDGE_REACH = 0.75f;
+    // texels are handed to the worker threads in batches
+    static const int BATCH_SIZE = 256;
+    // identifies the cache files - "GPLM", the version changes with the baking
+    static const uint32_t CACHE_MAGIC = 0x4d4c5047;
+    static const uint32_t CACHE_VERSION = 1;
+
+    struct Chart {
+
+        // dominant axis of the triangles' normals, the chart is projected along it
+        int axis;
+        glm::vec2 min;
+        glm::vec2 max;
+        // first texel of the chart's cell
+        int x;
+        int y;
+    };
+
+    static glm::vec2 Project(glm::vec3 position, int axis) {
+
+        return glm::vec2(position[(axis + 1) % 3], position[(axis + 2) % 3]);
+    }
+
+    static float Cross(glm::vec2 a, glm::vec2 b) {
+
+        return a.x * b.y - a.y * b.x;
+    }
+
+    // cell of a chart at the texel density, padding included
+    static glm::ivec2 CellSize(const Chart& chart, float density) {
+
+        glm::vec2 extent = (chart.max - chart.min) * density;
+        return glm::ivec2(std::max(1, (int)std::ceil(extent.x)) + 2 * CHART_PADDING, std::max(1, (int)std::ceil(extent.y)) + 2 * CHART_PADDING);
+    }
+
+    // rows of charts, tallest first - false when they overflow the atlas
+    static bool ShelfPack(std::vector<Chart>& charts, const std::vector<int>& order, float density, int size) {
+
+        int x = 0, y = 0, shelfHeight = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            Chart& chart = charts[order[i]];
+            glm::ivec2 cell = CellSize(chart, density);
+            if (cell.x > size) {
+                return false;
+            }
+            if (x + cell.x > size) {
+                y += shelfHeight;
+                x = 0;
+                shelfHeight = 0;
+            }
+            if (y + cell.y > size) {
+                return false;
+            }
+            chart.x = x;
+            chart.y = y;
+            x += cell.x;
+            shelfHeight = std::max(shelfHeight, cell.y);
+        }
+        return true;
+    }
+
+    void Lightmap::GenerateCoords(std::vector<std::vector<gps::Vertex> >& vertices, std::vector<std::vector<GLuint> >& indices,
+        std::vector<std::vector<glm::vec2> >& coords, int size) {
+
+        std::vector<Chart> charts;
+        std::vector<std::vector<int> > triangleCharts(vertices.size());
+
+        for (size_t s = 0; s < vertices.size(); s++) {
+            const std::vector<gps::Vertex>& shapeVertices = vertices[s];
+            const std::vector<GLuint>& shapeIndices = indices[s];
+            int triangleCount = (int)(shapeIndices.size() / 3);
+
+            // corners at the same position are welded, so charts grow across normal and texture seams
+            std::map<std::tuple<float, float, float>, int> positionIds;
+            std::vector<int> welded(shapeVertices.size());
+            for (size_t v = 0; v < shapeVertices.size(); v++) {
+                glm::vec3 p = shapeVertices[v].Position;
+                welded[v] = positionIds.insert(std::make_pair(std::make_tuple(p.x, p.y, p.z), (int)positionIds.size())).first->second;
+            }
+
+            // direction each triangle faces, one of +-X, +-Y, +-Z, and its edges sorted so neighbours line up
+            std::vector<int> directions(triangleCount);
+            std::vector<std::pair<uint64_t, int> > edges;
+            edges.reserve(triangleCount * 3);
+            for (int t = 0; t < triangleCount; t++) {
+                glm::vec3 p[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = shapeVertices[shapeIndices[t * 3 + k]].Position;
+                    uint64_t a = (uint64_t)welded[shapeIndices[t * 3 + k]];
+                    uint64_t b = (uint64_t)welded[shapeIndices[t * 3 + (k + 1) % 3]];
+                    edges.push_back(std::make_pair(std::min(a, b) << 32 | std::max(a, b), t));
+                }
+                glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 magnitude = glm::abs(normal);
+                int axis = (magnitude.x >= magnitude.y && magnitude.x >= magnitude.z) ? 0 : (magnitude.y >= magnitude.z ? 1 : 2);
+                directions[t] = axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+            }
+            std::sort(edges.begin(), edges.end());
+            std::vector<std::vector<int> > neighbours(triangleCount);
+            for (size_t first = 0, last = 0; first < edges.size(); first = last) {
+                while (last < edges.size() && edges[last].first == edges[first].first) {
+                    last++;
+                }
+                for (size_t i = first; i < last; i++) {
+                    for (size_t j = first; j < last; j++) {
+                        if (i != j) {
+                            neighbours[edges[i].second].push_back(edges[j].second);
+                        }
+                    }
+                }
+            }
+
+            // charts flood through neighbours facing the same direction
+            std::vector<int>& chartOf = triangleCharts[s];
+            chartOf.assign(triangleCount, -1);
+            std::vector<int> stack;
+            for (int t = 0; t < triangleCount; t++) {
+                if (chartOf[t] >= 0) {
+                    continue;
+                }
+                Chart chart;
+                chart.axis = directions[t] / 2;
+                chart.min = glm::vec2(FLT_MAX);
+                chart.max = glm::vec2(-FLT_MAX);
+                int id = (int)charts.size();
+                chartOf[t] = id;
+                stack.push_back(t);
+                while (!stack.empty()) {
+                    int current = stack.back();
+                    stack.pop_back();
+                    for (int k = 0; k < 3; k++) {
+                        glm::vec2 projected = Project(shapeVertices[shapeIndices[current * 3 + k]].Position, chart.axis);
+                        chart.min = glm::min(chart.min, projected);
+                        chart.max = glm::max(chart.max, projected);
+                    }
+                    for (size_t n = 0; n < neighbours[current].size(); n++) {
+                        int neighbour = neighbours[current][n];
+                        if (chartOf[neighbour] < 0 && directions[neighbour] == directions[t]) {
+                            chartOf[neighbour] = id;
+                            stack.push_back(neighbour);
+                        }
+                    }
+                }
+                charts.push_back(chart);
+            }
+        }
+
+        // the densest packing that fits - the density cannot exceed the one filling the atlas with no padding
+        float totalArea = 0.0f;
+        std::vector<int> order(charts.size());
+        for (size_t i = 0; i < charts.size(); i++) {
+            glm::vec2 extent = charts[i].max - charts[i].min;
+            totalArea += extent.x * extent.y;
+            order[i] = (int)i;
+        }
+        std::sort(order.begin(), order.end(), [&charts](int a, int b) {
+            return charts[a].max.y - charts[a].min.y > charts[b].max.y - charts[b].min.y;
+        });
+        float low = 0.0f;
+        float high = (float)size / std::sqrt(std::max(totalArea, 1e-6f));
+        for (int i = 0; i < 32; i++) {
+            float middle = (low + high) * 0.5f;
+            if (ShelfPack(charts, order, middle, size)) {
+                low = middle;
+            }
+            else {
+                high = middle;
+            }
+        }
+        float density = low;
+        if (!ShelfPack(charts, order, density, size)) {
+            fprintf(stderr, "WARNING: %d lightmap charts do not fit a %dx%d lightmap\n", (int)charts.size(), size, size);
+        }
+        printf("Lightmap : %d charts, %.2f texels per unit\n", (int)charts.size(), density);
+
+        // a vertex is split once per chart it is in
+        coords.assign(vertices.size(), std::vector<glm::vec2>());
+        for (size_t s = 0; s < vertices.size(); s++) {
+            std::vector<gps::Vertex> splitVertices;
+            std::vector<glm::vec2>& splitCoords = coords[s];
+            std::unordered_map<uint64_t, GLuint> splitIds;
+            for (size_t i = 0; i < indices[s].size(); i++) {
+                GLuint vertex = indices[s][i];
+                int chartId = triangleCharts[s][i / 3];
+                uint64_t key = (uint64_t)chartId << 32 | vertex;
+                std::unordered_map<uint64_t, GLuint>::iterator existing = splitIds.find(key);
+                if (existing != splitIds.end()) {
+                    indices[s][i] = existing->second;
+                    continue;
+                }
+                const Chart& chart = charts[chartId];
+                glm::vec2 texel = glm::vec2((float)chart.x, (float)chart.y) + (float)CHART_PADDING +
+                    (Project(vertices[s][vertex].Position, chart.axis) - chart.min) * density;
+                splitIds[key] = (GLuint)splitVertices.size();
+                indices[s][i] = (GLuint)splitVertices.size();
+                splitVertices.push_back(vertices[s][vertex]);
+                splitCoords.push_back(texel / (float)size);
+            }
+            vertices[s].swap(splitVertices);
+        }
+    }
+
+    // a receiver texel - where on the surface it is baked
+    struct BakeSample {
+
+        int texel;
+        glm::vec3 position;
+        glm::vec3 normal;
+        // faces the same side as the normal, the rays leave along it
+        glm::vec3 geometricNormal;
+    };
+
+    static void BakeTexel(const BakeScene& scene, const BakeSample& sample, glm::vec3* layers[Lightmap::LAYERS]) {
+
+        BakeScene::Random random((uint32_t)sample.texel);
+        bool withLamps = !scene.getLamps().empty();
+        glm::vec3 ambient = scene.getSkyLight();
+
+        glm::vec3 origin = BakeScene::OffsetRay(sample.position, sample.geometricNormal);
+        glm::vec3 direct = scene.SunDirect(origin, sample.normal);
+        glm::vec3 lamps = withLamps ? scene.LampFactor(origin) * (ambient + direct) : glm::vec3(0.0f);
+
+        // paths over the cosine weighted hemisphere, lit at every surface they hit
+        glm::vec3 indirect(0.0f);
+        glm::vec3 lampsIndirect(0.0f);
+        for (int s = 0; s < SAMPLES; s++) {
+            glm::vec3 direction = BakeScene::SampleCosine(sample.normal, random);
+            if (glm::dot(direction, sample.geometricNormal) <= 0.0f) {
+                direction = glm::reflect(direction, sample.geometricNormal);
+            }
+            BakeScene::PathLight light = scene.TracePath(origin, direction, random, withLamps);
+            indirect += light.sky;
+            lampsIndirect += light.lamps;
+        }
+
+        layers[0][sample.texel] = direct;
+        layers[1][sample.texel] = indirect / (float)SAMPLES;
+        layers[2][sample.texel] = lamps + lampsIndirect / (float)SAMPLES;
+    }
+
+    // shared exponent packing for GL_RGB9_E5 - 9 bit mantissas, 5 bit exponent with a bias of 15
+    static GLuint PackRGB9E5(glm::vec3 color) {
+
+        const float MAX_VALUE = 65408.0f;
+        color = glm::clamp(color, glm::vec3(0.0f), glm::vec3(MAX_VALUE));
+        float maxComponent = std::max(color.x, std::max(color.y, color.z));
+        if (maxComponent < 1e-9f) {
+            return 0;
+        }
+        int exponent = std::max(-16, (int)std::floor(std::log2(maxComponent))) + 16;
+        float scale = std::pow(2.0f, (float)(exponent - 15 - 9));
+        if ((int)std::floor(maxComponent / scale + 0.5f) == 512) {
+            exponent++;
+            scale *= 2.0f;
+        }
+        GLuint r = (GLuint)std::floor(color.x / scale + 0.5f);
+        GLuint g = (GLuint)std::floor(color.y / scale + 0.5f);
+        GLuint b = (GLuint)std::floor(color.z / scale + 0.5f);
+        return r | (g << 9) | (b << 18) | ((GLuint)exponent << 27);
+    }
+
+    // corners of a receiver triangle in texels, with their world positions and normals
+    static void RasterizeTriangle(const glm::vec2 texels[3], const glm::vec3 positions[3], const glm::vec3 normals[3], int size, bool edges,
+        std::vector<int>& texelSamples, std::vector<BakeSample>& samples) {
+
+        glm::vec3 geometricNormal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+        float area = Cross(texels[1] - texels[0], texels[2] - texels[0]);
+        if (glm::length(geometricNormal) <= 0.0f || std::abs(area) < 1e-8f) {
+            return;
+        }
+        geometricNormal = glm::normalize(geometricNormal);
+        float edgeLengths[3];
+        for (int k = 0; k < 3; k++) {
+            edgeLengths[k] = glm::length(texels[(k + 2) % 3] - texels[(k + 1) % 3]);
+        }
+
+        glm::vec2 low = glm::min(glm::min(texels[0], texels[1]), texels[2]);
+        glm::vec2 high = glm::max(glm::max(texels[0], texels[1]), texels[2]);
+        int x0 = std::max(0, (int)std::floor(low.x - 1.0f)), x1 = std::min(size - 1, (int)std::ceil(high.x));
+        int y0 = std::max(0, (int)std::floor(low.y - 1.0f)), y1 = std::min(size - 1, (int)std::ceil(high.y));
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                int texel = y * size + x;
+                if (texelSamples[texel] >= 0) {
+                    continue;
+                }
+                glm::vec2 centre((float)x + 0.5f, (float)y + 0.5f);
+                float weights[3];
+                bool inside = true;
+                for (int k = 0; k < 3; k++) {
+                    float edge = Cross(texels[(k + 2) % 3] - texels[(k + 1) % 3], centre - texels[(k + 1) % 3]) / area;
+                    weights[k] = edge;
+                    // outside the triangle - the centre's distance to the edge in texels decides on the second pass
+                    if (edge < 0.0f && (!edges || edge * std::abs(area) / edgeLengths[k] < -EDGE_REACH)) {
+                        inside = false;
+                    }
+                }
+                if (!inside) {
+                    continue;
+                }
+                // nearest point of the triangle for the texels it only touches
+                float total = 0.0f;
+                for (int k = 0; k < 3; k++) {
+                    weights[k] = std::max(weights[k], 0.0f);
+                    total += weights[k];
+                }
+                BakeSample sample;
+                sample.texel = texel;
+                sample.position = glm::vec3(0.0f);
+                sample.normal = glm::vec3(0.0f);
+                for (int k = 0; k < 3; k++) {
+                    sample.position += positions[k] * (weights[k] / total);
+                    sample.normal += normals[k] * (weights[k] / total);
+                }
+                sample.normal = glm::length(sample.normal) > 0.0f ? glm::normalize(sample.normal) : geometricNormal;
+                sample.geometricNormal = glm::dot(sample.normal, geometricNormal) < 0.0f ? -geometricNormal : geometricNormal;
+                texelSamples[texel] = (int)samples.size();
+                samples.push_back(sample);
+            }
+        }
+    }
+
+    void Lightmap::Bake(gps::BakeScene& scene, gps::Model3D& receiver, glm::mat4 receiverModel) {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        scene.Build();
+
+        // the receiver's texels - centres inside a triangle first, then the texels its edges only cross
+        std::vector<int> texelSamples((size_t)size * size, -1);
+        std::vector<BakeSample> samples;
+        glm::mat3 normalMatrix = glm::mat3(glm::inverseTranspose(receiverModel));
+        std::vector<gps::Mesh>& meshes = receiver.GetMeshes();
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t i = 0; i < meshes.size(); i++) {
+                gps::Mesh& mesh = meshes[i];
+                if (mesh.lightmapCoords.empty()) {
+                    continue;
+                }
+                for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+                    glm::vec2 texels[3];
+                    glm::vec3 positions[3];
+                    glm::vec3 normals[3];
+                    for (int k = 0; k < 3; k++) {
+                        GLuint index = mesh.indices[t + k];
+                        texels[k] = mesh.lightmapCoords[index] * (float)size;
+                        positions[k] = glm::vec3(receiverModel * glm::vec4(mesh.vertices[index].Position, 1.0f));
+                        normals[k] = normalMatrix * mesh.vertices[index].Normal;
+                    }
+                    RasterizeTriangle(texels, positions, normals, size, pass == 1, texelSamples, samples);
+                }
+            }
+        }
+
+        std::vector<glm::vec3> layerTexels[LAYERS];
+        glm::vec3* layers[LAYERS];
+        for (int layer = 0; layer < LAYERS; layer++) {
+            layerTexels[layer].assign((size_t)size * size, glm::vec3(0.0f));
+            layers[layer] = &layerTexels[layer][0];
+        }
+
+        printf("Lightmap : baking %d texels against %d triangles (%d BVH nodes) on %d threads\n", (int)samples.size(),
+            scene.getTriangleCount(), scene.getNodeCount(), std::max(1, (int)std::thread::hardware_concurrency()));
+        BakeScene::ParallelFor((int)samples.size(), BATCH_SIZE, [&](int i) {
+            BakeTexel(scene, samples[i], layers);
+        });
+
+        // the padding takes the average of its baked neighbours, so filtering at chart borders stays within the chart
+        std::vector<bool> covered(texelSamples.size());
+        for (size_t i = 0; i < texelSamples.size(); i++) {
+            covered[i] = texelSamples[i] >= 0;
+        }
+        for (int pass = 0; pass <= CHART_PADDING; pass++) {
+            std::vector<bool> grown = covered;
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    int texel = y * size + x;
+                    if (covered[texel]) {
+                        continue;
+                    }
+                    glm::vec3 sums[LAYERS] = {};
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int nx = x + dx, ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= size || ny >= size || !covered[ny * size + nx]) {
+                                continue;
+                            }
+                            for (int layer = 0; layer < LAYERS; layer++) {
+                                sums[layer] += layers[layer][ny * size + nx];
+                            }
+                            count++;
+                        }
+                    }
+                    if (count > 0) {
+                        for (int layer = 0; layer < LAYERS; layer++) {
+                            layers[layer][texel] = sums[layer] / (float)count;
+                        }
+                        grown[texel] = true;
+                    }
+                }
+            }
+            covered.swap(grown);
+        }
+
+        texels.resize((size_t)size * size * LAYERS);
+        for (int layer = 0; layer < LAYERS; layer++) {
+            for (size_t i = 0; i < (size_t)size * size; i++) {
+                texels[layer * (size_t)size * size + i] = PackRGB9E5(layers[layer][i]);
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Lightmap : baked in %.1f s\n", seconds);
+    }
+
+    bool Lightmap::LoadOrBake(const std::string& cacheDirectory, bool rebake, gps::BakeScene& scene, gps::Model3D& receiver,
+        glm::mat4 receiverModel, int size) {
+
+        std::vector<gps::Mesh>& meshes = receiver.GetMeshes();
+        bool hasCoords = false;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            hasCoords = hasCoords || (!meshes[i].lightmapCoords.empty() && !meshes[i].vertices.empty());
+        }
+        if (!hasCoords) {
+            fprintf(stderr, "ERROR: the lightmapped model has no lightmap coords or CPU copy\n");
+            return false;
+        }
+
+        Delete();
+        this->size = size;
+
+        uint32_t settings[3] = { CACHE_VERSION, (uint32_t)SAMPLES, (uint32_t)size };
+        uint64_t hash = AssetCache::Hash(settings, sizeof(settings), scene.getHash());
+        std::string fileName = AssetCache::FileName(cacheDirectory, "lightmap", hash);
+
+        if (!rebake && !cacheDirectory.empty() && ReadCache(fileName)) {
+            printf("Lightmap : loaded %s\n", fileName.c_str());
+        }
+        else {
+            Bake(scene, receiver, receiverModel);
+            if (!cacheDirectory.empty()) {
+                WriteCache(cacheDirectory, fileName);
+            }
+        }
+
+        Upload();
+        std::vector<GLuint>().swap(texels);
+        return true;
+    }
+
+    bool Lightmap::ReadCache(const std::string& fileName) {
+
+        FILE* file = fopen(fileName.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        uint32_t header[4];
+        bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == CACHE_MAGIC && header[1] == CACHE_VERSION &&
+            header[2] == (uint32_t)size && header[3] == (uint32_t)LAYERS;
+        if (valid) {
+            texels.resize((size_t)size * size * LAYERS);
+            valid = fread(&texels[0], sizeof(GLuint), texels.size(), file) == texels.size();
+        }
+        fclose(file);
+        return valid;
+    }
+
+    void Lightmap::WriteCache(const std::string& cacheDirectory, const std::string& fileName) {
+
+        FILE* file = AssetCache::Create(cacheDirectory, fileName);
+        if (!file) {
+            return;
+        }
+        uint32_t header[4] = { CACHE_MAGIC, CACHE_VERSION, (uint32_t)size, (uint32_t)LAYERS };
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(&texels[0], sizeof(GLuint), texels.size(), file);
+        fclose(file);
+    }
+
+    void Lightmap::Upload() {
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB9_E5, size, size, LAYERS, 0, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, &texels[0]);
+        // no mip chain - the charts are only padded by a texel
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        renderStats.textureBytes += (size_t)size * size * 4 * LAYERS;
+    }
+
+    void Lightmap::Delete() {
+
+        if (texture != 0) {
+            glDeleteTextures(1, &texture);
+            texture = 0;
+        }
+    }
+
+    void Lightmap::Bind(GLuint unit) {
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        renderStats.textureBinds++;
+    }
+
+    bool Lightmap::isLoaded() {
+
+        return texture != 0;
+    }
+}
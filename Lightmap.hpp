@@ -0,0 +1,65 @@
+#ifndef Lightmap_hpp
+#define Lightmap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+#include "BakeScene.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Baked lighting of a static model - path traced on the CPU through a BakeScene holding the model and its casters,
+    // stored as an RGB9_E5 texture array sampled by basic.frag's LIGHTMAP variant through a second UV set
+    //   layer 0 - the sun's direct light (N.L times visibility), so the shader can still darken it with the shadow map
+    //   layer 1 - sky and bounced sun light, what replaces the constant ambient
+    //   layer 2 - the baked lamps, direct and bounced, as basic.frag applies a lamp (scaling the sun's ambient and diffuse)
+    // Bakes are stored in the asset cache, named after a hash of every input, and reloaded on later runs
+    class Lightmap {
+
+    public:
+        static const int LAYERS = 3;
+
+        // Second UV set - planar charts of connected triangles facing the same axis, shelf packed into a size x size
+        // atlas with a texel of padding around each; vertices on chart borders are split, coords are in [0, 1]
+        static void GenerateCoords(std::vector<std::vector<gps::Vertex> >& vertices, std::vector<std::vector<GLuint> >& indices,
+            std::vector<std::vector<glm::vec2> >& coords, int size);
+
+        // Loads the receiver's lightmap from the cache directory, baking and storing it first when it is missing or rebake is set
+        // receiver must be one of the scene's casters, holding its lightmap coords for size; the scene's lamps are baked in,
+        // so the shader must skip them
+        bool LoadOrBake(const std::string& cacheDirectory, bool rebake, gps::BakeScene& scene, gps::Model3D& receiver,
+            glm::mat4 receiverModel, int size);
+
+        void Delete();
+
+        void Bind(GLuint unit);
+
+        bool isLoaded();
+
+    private:
+        int size = 0;
+        GLuint texture = 0;
+        // RGB9_E5 texels, layer after layer
+        std::vector<GLuint> texels;
+
+        void Bake(gps::BakeScene& scene, gps::Model3D& receiver, glm::mat4 receiverModel);
+
+        bool ReadCache(const std::string& fileName);
+        void WriteCache(const std::string& cacheDirectory, const std::string& fileName);
+
+        void Upload();
+    };
+}
+
+#endif /* Lightmap_hpp */
@@ -1,44 +1,520 @@
 #include "Mesh.hpp"
+#include "RenderStats.hpp"
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
 namespace gps {
 
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures) {
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, MESH_RESIDENCY residency,
+		std::vector<glm::vec2> lightmapCoords) {
 
-		this->vertices = vertices;
-		this->indices = indices;
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
 		this->textures = textures;
+		this->lightmapCoords = std::move(lightmapCoords);
 
+		this->buildMeshlets();
 		this->setupMesh();
+
+		// The GPU owns the geometry now - drop the CPU copy unless someone still needs to read it
+		if (residency == RELEASE_AFTER_UPLOAD)
+			ReleaseCpuCopy();
+	}
+
+	void Mesh::ReleaseCpuCopy() {
+
+		std::vector<Vertex>().swap(this->vertices);
+		std::vector<GLuint>().swap(this->indices);
+		std::vector<glm::vec2>().swap(this->lightmapCoords);
 	}
 
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
+	GLenum Mesh::getIndexType() {
+		return this->indexType;
+	}
+
+	size_t Mesh::getHostBytes() {
+		return this->vertices.capacity() * sizeof(Vertex) + this->indices.capacity() * sizeof(GLuint) + this->lightmapCoords.capacity() * sizeof(glm::vec2);
+	}
+
+	size_t Mesh::getUploadedBytes() {
+		return this->uploadedBytes;
+	}
+
+	size_t Mesh::getMeshletCount() {
+		return this->meshlets.size();
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)	{
+	void Mesh::Draw(gps::Shader& shader)	{
+
+		GPS_PROFILE_ZONE("Mesh::Draw");
 
 		shader.useShaderProgram();
 
+		bindTextures(shader);
+
+		glBindVertexArray(this->buffers.VAO);
+		glDrawElements(GL_TRIANGLES, this->indexCount, this->indexType, 0);
+		glBindVertexArray(0);
+
+		unbindTextures();
+
+		renderStats.drawCalls++;
+		renderStats.trianglesSubmitted += this->indexCount / 3;
+		renderStats.meshletsTotal += (GLuint)this->meshlets.size();
+    }
+
+	/* Culled drawing function - submits the visible meshlets with a single multi-draw */
+	void Mesh::Draw(gps::Shader& shader, gps::CullingInfo& culling) {
+
+		GPS_PROFILE_ZONE("Mesh::Draw");
+
+		std::vector<GLsizei> counts;
+		std::vector<const GLvoid*> offsets;
+		std::vector<size_t> groupEnds;
+		bool occlusion = culling.occlusionCulling && !this->occlusionGroups.empty();
+		if (!visibleRanges(culling, counts, offsets, true, occlusion ? &groupEnds : NULL)) {
+
+			for (size_t i = 0; i < this->occlusionGroups.size(); i++)
+				this->occlusionGroups[i].queried = false;
+			return;
+		}
+
+		shader.useShaderProgram();
+
+		bindTextures(shader);
+
+		glBindVertexArray(this->buffers.VAO);
+		if (!occlusion) {
+
+			glMultiDrawElements(GL_TRIANGLES, &counts[0], this->indexType, &offsets[0], (GLsizei)counts.size());
+			renderStats.drawCalls++;
+		}
+		else {
+
+			// the groups tested this frame are drawn on their own, under their query - the GPU drops those whose
+			// box did not pass without waiting on the CPU; the ranges in between still go in one draw
+			size_t first = 0;
+			size_t end = 0;
+			for (size_t i = 0; i < this->occlusionGroups.size(); i++) {
+
+				OcclusionGroup& group = this->occlusionGroups[i];
+				if (group.queried && groupEnds[i] > end) {
+
+					if (end > first) {
+						glMultiDrawElements(GL_TRIANGLES, &counts[first], this->indexType, &offsets[first], (GLsizei)(end - first));
+						renderStats.drawCalls++;
+					}
+					glBeginConditionalRender(group.query, GL_QUERY_WAIT);
+					glMultiDrawElements(GL_TRIANGLES, &counts[end], this->indexType, &offsets[end], (GLsizei)(groupEnds[i] - end));
+					glEndConditionalRender();
+					renderStats.drawCalls++;
+					first = groupEnds[i];
+				}
+				end = groupEnds[i];
+				// a result is only used by the frame that issued it
+				group.queried = false;
+			}
+			if (end > first) {
+				glMultiDrawElements(GL_TRIANGLES, &counts[first], this->indexType, &offsets[first], (GLsizei)(end - first));
+				renderStats.drawCalls++;
+			}
+		}
+		glBindVertexArray(0);
+
+		unbindTextures();
+	}
+
+	void Mesh::QueryOcclusion(gps::OcclusionBoxes& boxes, glm::mat4 modelMatrix, gps::CullingInfo& culling) {
+
+		if (!culling.frustum.Intersects(this->bounds.center, this->bounds.radius))
+			return;
+
+		for (size_t i = 0; i < this->occlusionGroups.size(); i++) {
+
+			OcclusionGroup& group = this->occlusionGroups[i];
+			group.queried = false;
+
+			if (!culling.frustum.Intersects(group.center, glm::length(group.halfExtent)))
+				continue;
+
+			// with the camera in or right next to the box, the near plane can clip away the faces that would pass
+			glm::vec3 distance = glm::abs(culling.cameraPosition - group.center) - group.halfExtent;
+			if (glm::max(distance.x, glm::max(distance.y, distance.z)) < 1.0f)
+				continue;
+
+			if (group.query == 0)
+				glGenQueries(1, &group.query);
+			boxes.Query(group.query, modelMatrix, group.center, group.halfExtent);
+			group.queried = true;
+		}
+	}
+
+	void Mesh::DeleteQueries() {
+
+		for (size_t i = 0; i < this->occlusionGroups.size(); i++) {
+
+			if (this->occlusionGroups[i].query != 0)
+				glDeleteQueries(1, &this->occlusionGroups[i].query);
+			this->occlusionGroups[i].query = 0;
+			this->occlusionGroups[i].queried = false;
+		}
+	}
+
+	/* Depth-only drawing function */
+	void Mesh::DrawDepth() {
+
+		glBindVertexArray(this->buffers.positionVAO);
+		glDrawElements(GL_TRIANGLES, this->indexCount, this->indexType, 0);
+		glBindVertexArray(0);
+
+		renderStats.drawCalls++;
+		renderStats.trianglesSubmitted += this->indexCount / 3;
+	}
+
+	/* Culled depth-only drawing function - the meshlet counters are left to the shaded pass */
+	void Mesh::DrawDepth(gps::CullingInfo& culling) {
+
+		std::vector<GLsizei> counts;
+		std::vector<const GLvoid*> offsets;
+		if (!visibleRanges(culling, counts, offsets, false))
+			return;
+
+		glBindVertexArray(this->buffers.positionVAO);
+		glMultiDrawElements(GL_TRIANGLES, &counts[0], this->indexType, &offsets[0], (GLsizei)counts.size());
+		glBindVertexArray(0);
+
+		renderStats.drawCalls++;
+	}
+
+	bool Mesh::visibleRanges(gps::CullingInfo& culling, std::vector<GLsizei>& counts, std::vector<const GLvoid*>& offsets, bool countStats,
+		std::vector<size_t>* groupEnds) {
+
+		if (countStats)
+			renderStats.meshletsTotal += (GLuint)this->meshlets.size();
+
+		if (!culling.frustum.Intersects(this->bounds.center, this->bounds.radius)) {
+
+			if (countStats)
+				renderStats.meshletsCulled += (GLuint)this->meshlets.size();
+			return false;
+		}
+
+		size_t indexSize = (this->indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+		GLuint runEnd = UINT_MAX;
+		size_t group = 0;
+
+		for (size_t i = 0; i < this->meshlets.size(); i++) {
+
+			if (groupEnds && i == this->occlusionGroups[group].firstMeshlet + this->occlusionGroups[group].meshletCount) {
+
+				groupEnds->push_back(counts.size());
+				group++;
+				runEnd = UINT_MAX;
+			}
+
+			Meshlet& meshlet = this->meshlets[i];
+
+			if (!culling.frustum.Intersects(meshlet.center, meshlet.radius) ||
+				(culling.backfaceCulling && IsBackfacing(meshlet.center, meshlet.radius, meshlet.coneAxis, meshlet.coneCutoff, culling.cameraPosition))) {
+
+				if (countStats)
+					renderStats.meshletsCulled++;
+				continue;
+			}
+
+			// neighbouring visible meshlets are merged into one range
+			if (meshlet.indexOffset == runEnd) {
+				counts.back() += (GLsizei)(meshlet.triangleCount * 3);
+			}
+			else {
+				counts.push_back((GLsizei)(meshlet.triangleCount * 3));
+				offsets.push_back((const GLvoid*)(meshlet.indexOffset * indexSize));
+			}
+			runEnd = meshlet.indexOffset + meshlet.triangleCount * 3;
+			renderStats.trianglesSubmitted += meshlet.triangleCount;
+		}
+
+		if (groupEnds)
+			groupEnds->resize(this->occlusionGroups.size(), counts.size());
+
+		return !counts.empty();
+	}
+
+	gps::BoundingSphere Mesh::getBounds() {
+
+		return this->bounds;
+	}
+
+	bool Mesh::hasCutout() {
+
+		bool hasDiffuse = false;
+		for (size_t i = 0; i < this->textures.size(); i++) {
+
+			if (this->textures[i].type == "diffuseTexture") {
+				hasDiffuse = true;
+				if (this->textures[i].hasCutout)
+					return true;
+			}
+		}
+		// without a diffuse texture the shader samples black and discards everything
+		return !hasDiffuse;
+	}
+
+	void Mesh::bindTextures(gps::Shader& shader) {
+
 		//set textures
 		for (GLuint i = 0; i < textures.size(); i++) {
 
 			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
+			glUniform1i(shader.getUniformLocation(this->textures[i].type), i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			renderStats.textureBinds++;
 		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	void Mesh::unbindTextures() {
 
         for(GLuint i = 0; i < this->textures.size(); i++) {
 
             glActiveTexture(GL_TEXTURE0 + i);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
+	}
 
-    }
+	// Greedy meshlet builder - each meshlet grows through the triangles sharing its vertices,
+	// preferring those that add the fewest new vertices and then those closest to its centre
+	void Mesh::buildMeshlets() {
+
+		size_t triangleCount = this->indices.size() / 3;
+		size_t vertexCount = this->vertices.size();
+
+		this->meshlets.clear();
+		this->bounds.center = glm::vec3(0.0f);
+		this->bounds.radius = 0.0f;
+
+		if (triangleCount == 0)
+			return;
+
+		// bounding sphere of the whole mesh
+		glm::vec3 minPosition(FLT_MAX);
+		glm::vec3 maxPosition(-FLT_MAX);
+		for (size_t i = 0; i < vertexCount; i++) {
+
+			minPosition = glm::min(minPosition, this->vertices[i].Position);
+			maxPosition = glm::max(maxPosition, this->vertices[i].Position);
+		}
+		this->bounds.center = (minPosition + maxPosition) * 0.5f;
+		for (size_t i = 0; i < vertexCount; i++) {
+			this->bounds.radius = std::max(this->bounds.radius, glm::length(this->vertices[i].Position - this->bounds.center));
+		}
+
+		// vertex -> triangle adjacency
+		std::vector<GLuint> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++) {
+			adjacencyOffsets[this->indices[i] + 1]++;
+		}
+		for (size_t i = 0; i < vertexCount; i++) {
+			adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+		}
+		std::vector<GLuint> adjacency(triangleCount * 3);
+		std::vector<GLuint> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (size_t k = 0; k < 3; k++) {
+				adjacency[adjacencyFill[this->indices[t * 3 + k]]++] = (GLuint)t;
+			}
+		}
+
+		std::vector<bool> emitted(triangleCount, false);
+		// id of the last meshlet each vertex was added to
+		std::vector<GLuint> vertexMeshlet(vertexCount, UINT_MAX);
+		std::vector<GLuint> meshletVertices;
+		std::vector<GLuint> meshletTriangles;
+		std::vector<GLuint> reordered;
+		reordered.reserve(this->indices.size());
+
+		glm::vec3 positionSum(0.0f);
+		size_t emittedCount = 0;
+		size_t cursor = 0;
+
+		while (emittedCount < triangleCount) {
+
+			GLuint meshletId = (GLuint)this->meshlets.size();
+			GLint best = -1;
+			size_t bestNewVertices = 4;
+			float bestDistance = FLT_MAX;
+
+			if (!meshletVertices.empty()) {
+
+				glm::vec3 centroid = positionSum / (float)meshletVertices.size();
+
+				for (size_t i = 0; i < meshletVertices.size(); i++) {
+
+					GLuint v = meshletVertices[i];
+					for (GLuint a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++) {
+
+						GLuint t = adjacency[a];
+						if (emitted[t])
+							continue;
+
+						size_t newVertices = 0;
+						glm::vec3 triangleCenter(0.0f);
+						for (size_t k = 0; k < 3; k++) {
+
+							GLuint index = this->indices[t * 3 + k];
+							if (vertexMeshlet[index] != meshletId)
+								newVertices++;
+							triangleCenter += this->vertices[index].Position;
+						}
+
+						float distance = glm::length(triangleCenter / 3.0f - centroid);
+						if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance)) {
+
+							best = (GLint)t;
+							bestNewVertices = newVertices;
+							bestDistance = distance;
+						}
+					}
+				}
+			}
+
+			// nothing connected left - restart from the first triangle not emitted yet
+			if (best == -1) {
+
+				while (emitted[cursor])
+					cursor++;
+				best = (GLint)cursor;
+				bestNewVertices = 3;
+			}
+
+			if (meshletVertices.size() + bestNewVertices > MESHLET_MAX_VERTICES || meshletTriangles.size() + 1 > MESHLET_MAX_TRIANGLES) {
+
+				finishMeshlet(meshletTriangles, reordered);
+				meshletVertices.clear();
+				meshletTriangles.clear();
+				positionSum = glm::vec3(0.0f);
+				meshletId++;
+			}
+
+			for (size_t k = 0; k < 3; k++) {
+
+				GLuint index = this->indices[best * 3 + k];
+				if (vertexMeshlet[index] != meshletId) {
+
+					vertexMeshlet[index] = meshletId;
+					meshletVertices.push_back(index);
+					positionSum += this->vertices[index].Position;
+				}
+			}
+			meshletTriangles.push_back((GLuint)best);
+			emitted[best] = true;
+			emittedCount++;
+		}
+
+		finishMeshlet(meshletTriangles, reordered);
+
+		this->indices.swap(reordered);
+
+		buildOcclusionGroups();
+	}
+
+	// Runs of OCCLUSION_GROUP_MESHLETS meshlets, boxed around their bounding spheres
+	void Mesh::buildOcclusionGroups() {
+
+		this->occlusionGroups.clear();
+
+		for (size_t first = 0; first < this->meshlets.size(); first += OCCLUSION_GROUP_MESHLETS) {
+
+			size_t end = std::min(first + OCCLUSION_GROUP_MESHLETS, this->meshlets.size());
+			glm::vec3 minPosition(FLT_MAX);
+			glm::vec3 maxPosition(-FLT_MAX);
+			for (size_t i = first; i < end; i++) {
+
+				minPosition = glm::min(minPosition, this->meshlets[i].center - glm::vec3(this->meshlets[i].radius));
+				maxPosition = glm::max(maxPosition, this->meshlets[i].center + glm::vec3(this->meshlets[i].radius));
+			}
+
+			OcclusionGroup group;
+			group.firstMeshlet = (GLuint)first;
+			group.meshletCount = (GLuint)(end - first);
+			group.center = (minPosition + maxPosition) * 0.5f;
+			// a little larger, so a face of the box never lands on the depth of the geometry it holds
+			group.halfExtent = (maxPosition - minPosition) * 0.5f + glm::vec3(0.01f);
+			group.query = 0;
+			group.queried = false;
+			this->occlusionGroups.push_back(group);
+		}
+	}
+
+	// Appends the triangles of a finished meshlet to the reordered index list and computes its culling data
+	void Mesh::finishMeshlet(std::vector<GLuint>& triangles, std::vector<GLuint>& reordered) {
+
+		if (triangles.empty())
+			return;
+
+		Meshlet meshlet;
+		meshlet.indexOffset = (GLuint)reordered.size();
+		meshlet.triangleCount = (GLuint)triangles.size();
+
+		glm::vec3 minPosition(FLT_MAX);
+		glm::vec3 maxPosition(-FLT_MAX);
+		glm::vec3 normalSum(0.0f);
+		std::vector<glm::vec3> normals;
+
+		for (size_t t = 0; t < triangles.size(); t++) {
+
+			glm::vec3 p[3];
+			for (size_t k = 0; k < 3; k++) {
+
+				GLuint index = this->indices[triangles[t] * 3 + k];
+				reordered.push_back(index);
+				p[k] = this->vertices[index].Position;
+				minPosition = glm::min(minPosition, p[k]);
+				maxPosition = glm::max(maxPosition, p[k]);
+			}
+
+			// geometric normal - front faces are counter clock-wise
+			glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+			float area = glm::length(normal);
+			if (area > 0.0f) {
+
+				normals.push_back(normal / area);
+				normalSum += normal / area;
+			}
+		}
+
+		meshlet.center = (minPosition + maxPosition) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (size_t i = meshlet.indexOffset; i < reordered.size(); i++) {
+			meshlet.radius = std::max(meshlet.radius, glm::length(this->vertices[reordered[i]].Position - meshlet.center));
+		}
+
+		// the cone must hold every triangle normal, otherwise it cannot be used for culling
+		meshlet.coneAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+		meshlet.coneCutoff = 1.0f;
+		float axisLength = glm::length(normalSum);
+		if (axisLength > 0.0f) {
+
+			meshlet.coneAxis = normalSum / axisLength;
+			float minDot = 1.0f;
+			for (size_t i = 0; i < normals.size(); i++) {
+				minDot = std::min(minDot, glm::dot(normals[i], meshlet.coneAxis));
+			}
+			if (minDot > 0.0f)
+				meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+
+		this->meshlets.push_back(meshlet);
+	}
 
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh() {
@@ -53,8 +529,24 @@ namespace gps {
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
 		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
 
+		// Use 16-bit indices whenever every vertex fits, halving the index buffer
+		this->indexCount = (GLsizei)this->indices.size();
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		if (this->vertices.size() <= MAX_SHORT_INDEXED_VERTICES) {
+
+			std::vector<GLushort> shortIndices(this->indices.begin(), this->indices.end());
+			this->indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(GLushort), &shortIndices[0], GL_STATIC_DRAW);
+		}
+		else {
+
+			this->indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		}
+
+		this->uploadedBytes = this->vertices.size() * sizeof(Vertex) + this->indices.size() * sizeof(GLuint);
+		renderStats.bufferBytes += this->vertices.size() * sizeof(Vertex) +
+			this->indices.size() * (this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
 
 		// Set the vertex attribute pointers
 		// Vertex Positions
@@ -67,6 +559,35 @@ namespace gps {
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
 
+		// Lightmap coords in a stream of their own, so meshes without them pay nothing
+		this->buffers.lightmapVBO = 0;
+		if (!this->lightmapCoords.empty()) {
+
+			glGenBuffers(1, &this->buffers.lightmapVBO);
+			glBindBuffer(GL_ARRAY_BUFFER, this->buffers.lightmapVBO);
+			glBufferData(GL_ARRAY_BUFFER, this->lightmapCoords.size() * sizeof(glm::vec2), &this->lightmapCoords[0], GL_STATIC_DRAW);
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (GLvoid*)0);
+			this->uploadedBytes += this->lightmapCoords.size() * sizeof(glm::vec2);
+			renderStats.bufferBytes += this->lightmapCoords.size() * sizeof(glm::vec2);
+		}
+
+		// Tightly packed positions for depth-only passes - a third of the vertex fetch bandwidth
+		std::vector<glm::vec3> positions(this->vertices.size());
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			positions[i] = this->vertices[i].Position;
+		}
+		glGenVertexArrays(1, &this->buffers.positionVAO);
+		glGenBuffers(1, &this->buffers.positionVBO);
+
+		glBindVertexArray(this->buffers.positionVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+		renderStats.bufferBytes += positions.size() * sizeof(glm::vec3);
+
 		glBindVertexArray(0);
 	}
 }
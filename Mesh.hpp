@@ -12,6 +12,8 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "Culling.hpp"
+#include "OcclusionBoxes.hpp"
 
 #include <string>
 #include <vector>
@@ -32,6 +34,8 @@ namespace gps {
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
+        // has texels dark enough for basic.frag to discard
+        bool hasCutout;
     };
 
     struct Material {
@@ -45,6 +49,51 @@ namespace gps {
         GLuint VAO;
         GLuint VBO;
         GLuint EBO;
+        // positions only, for depth-only passes - shares the EBO
+        GLuint positionVAO;
+        GLuint positionVBO;
+        // second UV set at location 3, 0 when the mesh has none
+        GLuint lightmapVBO;
+    };
+
+    // What happens to the CPU-side vertices/indices once they are uploaded to the GPU
+    // KEEP_CPU_COPY is only needed by meshes that are read back on the CPU (collision, BVH build, picking)
+    enum MESH_RESIDENCY { RELEASE_AFTER_UPLOAD, KEEP_CPU_COPY };
+
+    // Largest vertex count that can still be addressed with GL_UNSIGNED_SHORT indices
+    const size_t MAX_SHORT_INDEXED_VERTICES = 65536;
+
+    // Meshlet size limits
+    const size_t MESHLET_MAX_VERTICES = 64;
+    const size_t MESHLET_MAX_TRIANGLES = 124;
+
+    // Small cluster of triangles stored contiguously in the mesh index buffer
+    struct Meshlet {
+
+        GLuint indexOffset;
+        GLuint triangleCount;
+        // bounding sphere
+        glm::vec3 center;
+        float radius;
+        // normal cone - coneCutoff is the sine of the half angle, 1 when the cone is too wide to cull
+        glm::vec3 coneAxis;
+        float coneCutoff;
+    };
+
+    // Consecutive meshlets sharing one occlusion query - the builder grows meshlets through neighbouring
+    // triangles, so a run of them stays close together
+    const size_t OCCLUSION_GROUP_MESHLETS = 16;
+
+    struct OcclusionGroup {
+
+        GLuint firstMeshlet;
+        GLuint meshletCount;
+        // box around the meshlet spheres
+        glm::vec3 center;
+        glm::vec3 halfExtent;
+        // created on first use, issued this frame when queried is set
+        GLuint query;
+        bool queried;
     };
 
     class Mesh {
@@ -53,20 +102,77 @@ namespace gps {
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        // lightmap coordinates, one per vertex - empty unless the model generated them, see Lightmap
+        std::vector<glm::vec2> lightmapCoords;
+
+	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, MESH_RESIDENCY residency = RELEASE_AFTER_UPLOAD,
+	        std::vector<glm::vec2> lightmapCoords = std::vector<glm::vec2>());
 
-	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	    // Drops a CPU copy kept with KEEP_CPU_COPY once nothing reads it anymore
+	    void ReleaseCpuCopy();
 
 	    Buffers getBuffers();
 
-	    void Draw(gps::Shader shader);
+	    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, picked from the vertex count at upload
+	    GLenum getIndexType();
+
+	    // Bytes of geometry held in host memory now / handed to the GPU at upload
+	    size_t getHostBytes();
+	    size_t getUploadedBytes();
+
+	    size_t getMeshletCount();
+
+	    // Object space bounding sphere of the whole mesh
+	    gps::BoundingSphere getBounds();
+
+	    void Draw(gps::Shader& shader);
+
+	    // Draws only the meshlets that survive frustum and normal cone culling
+	    // With culling.occlusionCulling the groups queried this frame are drawn only if their box passed
+	    void Draw(gps::Shader& shader, gps::CullingInfo& culling);
+
+	    // Tests the box of every group in the frustum against the depth in the framebuffer - between
+	    // boxes.Begin and boxes.End, after the depth pre-pass. Groups around the camera are not tested
+	    void QueryOcclusion(gps::OcclusionBoxes& boxes, glm::mat4 modelMatrix, gps::CullingInfo& culling);
+	    void DeleteQueries();
+
+	    // Depth-only drawing from the position stream - the caller binds the program, no textures are bound
+	    void DrawDepth();
+	    void DrawDepth(gps::CullingInfo& culling);
+
+	    // True when fragments can be discarded (cutout texels or no diffuse texture at all),
+	    // so a depth-only pass would write depth the shaded pass does not
+	    bool hasCutout();
 
     private:
         /*  Render data  */
         Buffers buffers;
+        GLsizei indexCount;
+        GLenum indexType;
+        size_t uploadedBytes;
+
+        /*  Culling data  */
+        std::vector<Meshlet> meshlets;
+        std::vector<OcclusionGroup> occlusionGroups;
+        BoundingSphere bounds;
 
 	    // Initializes all the buffer objects/arrays
 	    void setupMesh();
 
+	    // Reorders the indices into meshlets and computes their bounds and normal cones
+	    void buildMeshlets();
+	    void finishMeshlet(std::vector<GLuint>& triangles, std::vector<GLuint>& reordered);
+	    void buildOcclusionGroups();
+
+	    // Index ranges of the meshlets that survive culling, neighbours merged - false when nothing is visible
+	    // groupEnds, when given, gets the number of ranges up to the end of each occlusion group; ranges are then
+	    // not merged across groups
+	    bool visibleRanges(gps::CullingInfo& culling, std::vector<GLsizei>& counts, std::vector<const GLvoid*>& offsets, bool countStats,
+	        std::vector<size_t>* groupEnds = NULL);
+
+	    void bindTextures(gps::Shader& shader);
+	    void unbindTextures();
+
     };
 
 }
@@ -1,4 +1,6 @@
 #include "Model3D.hpp"
+#include "Lightmap.hpp"
+#include "RenderStats.hpp"
 
 namespace gps {
 
@@ -13,17 +15,120 @@ namespace gps {
 		ReadOBJ(fileName, basePath);
 	}
 
+	void Model3D::SetSplitLargeMeshes(bool split) {
+
+		this->splitLargeMeshes = split;
+	}
+
+	void Model3D::SetResidency(gps::MESH_RESIDENCY residency) {
+
+		this->residency = residency;
+	}
+
+	void Model3D::SetLightmapSize(int size) {
+
+		this->lightmapSize = size;
+	}
+
+	void Model3D::ReleaseCpuCopies() {
+
+		for (size_t i = 0; i < meshes.size(); i++)
+			meshes[i].ReleaseCpuCopy();
+	}
+
+	std::vector<gps::Mesh>& Model3D::GetMeshes() {
+
+		return meshes;
+	}
+
+	// Object space bounding sphere of all the meshes
+	gps::BoundingSphere Model3D::GetBounds() {
+
+		gps::BoundingSphere bounds = { glm::vec3(0.0f), 0.0f };
+		for (size_t i = 0; i < meshes.size(); i++)
+			bounds = (i == 0) ? meshes[i].getBounds() : gps::Merge(bounds, meshes[i].getBounds());
+		return bounds;
+	}
+
+	// Prints the host memory taken by the geometry at upload time and what is still retained
+	void Model3D::PrintMemoryReport() {
+
+		size_t uploadedBytes = 0;
+		size_t hostBytes = 0;
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			uploadedBytes += meshes[i].getUploadedBytes();
+			hostBytes += meshes[i].getHostBytes();
+		}
+
+		size_t meshletCount = 0;
+		for (size_t i = 0; i < meshes.size(); i++)
+			meshletCount += meshes[i].getMeshletCount();
+
+		std::cout << "Memory : " << modelName << " - " << meshes.size() << " meshes, " << meshletCount << " meshlets, host geometry "
+			<< uploadedBytes / 1024 << " KB at upload, " << hostBytes / 1024 << " KB retained" << std::endl;
+	}
+
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram) {
+	void Model3D::Draw(gps::Shader& shaderProgram, gps::MESH_SELECTION selection) {
+
+		for (int i = 0; i < meshes.size(); i++) {
+
+			if (IsSelected(meshes[i], selection))
+				meshes[i].Draw(shaderProgram);
+		}
+	}
+
+	// Draw only the visible meshlets of each mesh
+	void Model3D::Draw(gps::Shader& shaderProgram, gps::CullingInfo culling, gps::MESH_SELECTION selection) {
+
+		for (int i = 0; i < meshes.size(); i++) {
+
+			if (IsSelected(meshes[i], selection))
+				meshes[i].Draw(shaderProgram, culling);
+		}
+	}
+
+	// Depth only - the cutout meshes are left to the shaded pass
+	void Model3D::DrawDepth() {
 
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+		for (int i = 0; i < meshes.size(); i++) {
+
+			if (!meshes[i].hasCutout())
+				meshes[i].DrawDepth();
+		}
+	}
+
+	void Model3D::DrawDepth(gps::CullingInfo culling) {
+
+		for (int i = 0; i < meshes.size(); i++) {
+
+			if (!meshes[i].hasCutout())
+				meshes[i].DrawDepth(culling);
+		}
+	}
+
+	void Model3D::QueryOcclusion(gps::OcclusionBoxes& boxes, glm::mat4 modelMatrix, gps::CullingInfo culling) {
+
+		for (int i = 0; i < meshes.size(); i++) {
+
+			meshes[i].QueryOcclusion(boxes, modelMatrix, culling);
+		}
+	}
+
+	bool Model3D::IsSelected(gps::Mesh& mesh, gps::MESH_SELECTION selection) {
+
+		if (selection == gps::ALL_MESHES)
+			return true;
+		return mesh.hasCutout() == (selection == gps::CUTOUT_MESHES);
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
 	void Model3D::ReadOBJ(std::string fileName, std::string basePath) {
 
         std::cout << "Loading : " << fileName << std::endl;
+		modelName = fileName;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
@@ -46,6 +151,11 @@ namespace gps {
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		// With a lightmap the charts of every shape share one atlas, so the meshes wait until all are read
+		std::vector<std::vector<gps::Vertex> > shapeVertices;
+		std::vector<std::vector<GLuint> > shapeIndices;
+		std::vector<std::vector<gps::Texture> > shapeTextures;
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 
@@ -53,6 +163,9 @@ namespace gps {
 			std::vector<GLuint> indices;
 			std::vector<gps::Texture> textures;
 
+			// Face corners referencing the same position/normal/texcoord share one vertex
+			std::map<std::tuple<int, int, int>, GLuint> uniqueVertices;
+
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
@@ -68,6 +181,15 @@ namespace gps {
 					// access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
+					std::tuple<int, int, int> key(idx.vertex_index, idx.normal_index, idx.texcoord_index);
+					std::map<std::tuple<int, int, int>, GLuint>::iterator existing = uniqueVertices.find(key);
+
+					if (existing != uniqueVertices.end()) {
+
+						indices.push_back(existing->second);
+						continue;
+					}
+
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
@@ -92,9 +214,10 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
-					vertices.push_back(currentVertex);
+					uniqueVertices[key] = (GLuint)vertices.size();
+					indices.push_back((GLuint)vertices.size());
 
-					indices.push_back((GLuint)(index_offset + v));
+					vertices.push_back(currentVertex);
 				}
 
 				index_offset += fv;
@@ -146,10 +269,77 @@ namespace gps {
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			if (lightmapSize > 0) {
+
+				shapeVertices.push_back(vertices);
+				shapeIndices.push_back(indices);
+				shapeTextures.push_back(textures);
+			}
+			else
+				AddMesh(vertices, indices, textures, std::vector<glm::vec2>());
+		}
+
+		if (lightmapSize > 0) {
+
+			std::vector<std::vector<glm::vec2> > shapeLightmapCoords;
+			gps::Lightmap::GenerateCoords(shapeVertices, shapeIndices, shapeLightmapCoords, lightmapSize);
+			for (size_t s = 0; s < shapeVertices.size(); s++)
+				AddMesh(shapeVertices[s], shapeIndices[s], shapeTextures[s], shapeLightmapCoords[s]);
 		}
 	}
 
+	// Adds a shape as one or more meshes, splitting it when it exceeds the 16-bit index range
+	void Model3D::AddMesh(const std::vector<gps::Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<gps::Texture>& textures,
+		const std::vector<glm::vec2>& lightmapCoords) {
+
+		if (!splitLargeMeshes || vertices.size() <= gps::MAX_SHORT_INDEXED_VERTICES) {
+
+			meshes.push_back(gps::Mesh(vertices, indices, textures, residency, lightmapCoords));
+			return;
+		}
+
+		// Greedily gather whole triangles into chunks of at most MAX_SHORT_INDEXED_VERTICES vertices
+		std::vector<GLint> remap(vertices.size(), -1);
+		std::vector<gps::Vertex> chunkVertices;
+		std::vector<GLuint> chunkIndices;
+		std::vector<glm::vec2> chunkLightmapCoords;
+
+		for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+
+			size_t newVertices = 0;
+			for (size_t k = 0; k < 3; k++) {
+
+				if (remap[indices[t + k]] == -1)
+					newVertices++;
+			}
+
+			if (chunkVertices.size() + newVertices > gps::MAX_SHORT_INDEXED_VERTICES) {
+
+				meshes.push_back(gps::Mesh(chunkVertices, chunkIndices, textures, residency, chunkLightmapCoords));
+				std::fill(remap.begin(), remap.end(), -1);
+				chunkVertices.clear();
+				chunkIndices.clear();
+				chunkLightmapCoords.clear();
+			}
+
+			for (size_t k = 0; k < 3; k++) {
+
+				GLuint index = indices[t + k];
+				if (remap[index] == -1) {
+
+					remap[index] = (GLint)chunkVertices.size();
+					chunkVertices.push_back(vertices[index]);
+					if (!lightmapCoords.empty())
+						chunkLightmapCoords.push_back(lightmapCoords[index]);
+				}
+				chunkIndices.push_back((GLuint)remap[index]);
+			}
+		}
+
+		if (!chunkIndices.empty())
+			meshes.push_back(gps::Mesh(chunkVertices, chunkIndices, textures, residency, chunkLightmapCoords));
+	}
+
 	// Retrieves a texture associated with the object - by its name and type
 	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
@@ -163,7 +353,7 @@ namespace gps {
 			}
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = ReadTextureFromFile(path.c_str(), currentTexture.hasCutout);
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
@@ -173,8 +363,9 @@ namespace gps {
 		}
 
 	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	GLuint Model3D::ReadTextureFromFile(const char* file_name, bool& hasCutout) {
 
+		hasCutout = false;
 		int x, y, n;
 		int force_channels = 4;
 		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
@@ -211,6 +402,13 @@ namespace gps {
 			}
 		}
 
+		// basic.frag discards texels below 0.001 after sRGB decoding - 3/255 is the brightest byte that still does
+		for (size_t i = 0; i < (size_t)x * y * 4 && !hasCutout; i += 4) {
+
+			if (image_data[i] <= 3 && image_data[i + 1] <= 3 && image_data[i + 2] <= 3)
+				hasCutout = true;
+		}
+
 		GLuint textureID;
 		glGenTextures(1, &textureID);
 		glBindTexture(GL_TEXTURE_2D, textureID);
@@ -226,6 +424,8 @@ namespace gps {
 			image_data
 		);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		// the mip chain adds about a third
+		renderStats.textureBytes += (size_t)x * y * 4 * 4 / 3;
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -248,9 +448,17 @@ namespace gps {
             GLuint VBO = meshes.at(i).getBuffers().VBO;
             GLuint EBO = meshes.at(i).getBuffers().EBO;
             GLuint VAO = meshes.at(i).getBuffers().VAO;
+            GLuint positionVBO = meshes.at(i).getBuffers().positionVBO;
+            GLuint positionVAO = meshes.at(i).getBuffers().positionVAO;
+            GLuint lightmapVBO = meshes.at(i).getBuffers().lightmapVBO;
             glDeleteBuffers(1, &VBO);
             glDeleteBuffers(1, &EBO);
             glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &positionVBO);
+            glDeleteVertexArrays(1, &positionVAO);
+            if (lightmapVBO != 0)
+                glDeleteBuffers(1, &lightmapVBO);
+            meshes.at(i).DeleteQueries();
         }
 	}
 }
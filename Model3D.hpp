@@ -6,12 +6,18 @@
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <algorithm>
 #include <iostream>
+#include <map>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace gps {
 
+    // Which meshes a Draw call submits - cutout meshes discard fragments, so they stay out of depth-only passes
+    enum MESH_SELECTION { ALL_MESHES, OPAQUE_MESHES, CUTOUT_MESHES };
+
     class Model3D {
 
     public:
@@ -21,22 +27,68 @@ namespace gps {
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		void Draw(gps::Shader& shaderProgram, gps::MESH_SELECTION selection = gps::ALL_MESHES);
+
+		// Draws only the meshlets that survive culling - culling is in the model's object space
+		void Draw(gps::Shader& shaderProgram, gps::CullingInfo culling, gps::MESH_SELECTION selection = gps::ALL_MESHES);
+
+		// Depth-only drawing of the opaque meshes with the bound program
+		void DrawDepth();
+		void DrawDepth(gps::CullingInfo culling);
+
+		// Occlusion queries for the meshlet groups of every mesh, see Mesh::QueryOcclusion
+		void QueryOcclusion(gps::OcclusionBoxes& boxes, glm::mat4 modelMatrix, gps::CullingInfo culling);
+
+		// Split shapes with more vertices than 16-bit indices can address (enabled by default)
+		void SetSplitLargeMeshes(bool split);
+
+		// Keep CPU copies of the geometry after upload - call before LoadModel (released by default)
+		void SetResidency(gps::MESH_RESIDENCY residency);
+
+		// Generate a second UV set packed into a size x size lightmap - call before LoadModel (0, the default, generates none)
+		void SetLightmapSize(int size);
+
+		// Drops the CPU copies kept with KEEP_CPU_COPY, once the baking is done
+		void ReleaseCpuCopies();
+
+		// The component meshes - read by the lightmap baker
+		std::vector<gps::Mesh>& GetMeshes();
+
+		// Object space bounding sphere of all the meshes
+		gps::BoundingSphere GetBounds();
+
+		// Prints the host memory taken by the geometry at upload time and what is still retained
+		void PrintMemoryReport();
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		// Whether large shapes are split so every mesh can use 16-bit indices
+		bool splitLargeMeshes = true;
+		// CPU residency policy applied to every mesh of the model
+		gps::MESH_RESIDENCY residency = gps::RELEASE_AFTER_UPLOAD;
+		// Lightmap the second UV set is packed for, 0 without one
+		int lightmapSize = 0;
+		// File the model was loaded from - used in reports
+		std::string modelName;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
 
+		// Adds a shape as one or more meshes, splitting it when it exceeds the 16-bit index range
+		void AddMesh(const std::vector<gps::Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<gps::Texture>& textures,
+			const std::vector<glm::vec2>& lightmapCoords);
+
+		bool IsSelected(gps::Mesh& mesh, gps::MESH_SELECTION selection);
+
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
 		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// hasCutout is set when some texels are dark enough to be discarded by the shader
+		GLuint ReadTextureFromFile(const char* file_name, bool& hasCutout);
     };
 }
 
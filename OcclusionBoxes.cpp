@@ -0,0 +1,75 @@
+#include "OcclusionBoxes.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace gps {
+
+    void OcclusionBoxes::Init() {
+
+        // unit cube from -1 to 1, faces wound counter-clockwise seen from outside
+        GLfloat corners[] = {
+            -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   -1.0f, 1.0f, -1.0f,   1.0f, 1.0f, -1.0f,
+            -1.0f, -1.0f, 1.0f,    1.0f, -1.0f, 1.0f,    -1.0f, 1.0f, 1.0f,    1.0f, 1.0f, 1.0f };
+        GLubyte indices[] = {
+            0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,
+            0, 1, 4, 1, 5, 4,   2, 6, 3, 3, 6, 7,
+            0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5 };
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        glBindVertexArray(0);
+
+        renderStats.bufferBytes += sizeof(corners) + sizeof(indices);
+    }
+
+    void OcclusionBoxes::Delete() {
+
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+    }
+
+    void OcclusionBoxes::Begin(gps::Shader& shader) {
+
+        shader.useShaderProgram();
+        modelLocation = shader.getUniformLocation("model");
+
+        // the boxes only test - their front faces are enough, the camera is kept out of them (see Mesh::QueryOcclusion)
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+        glBindVertexArray(VAO);
+    }
+
+    void OcclusionBoxes::Query(GLuint query, glm::mat4 modelMatrix, glm::vec3 center, glm::vec3 halfExtent) {
+
+        glm::mat4 box = glm::scale(glm::translate(modelMatrix, center), halfExtent);
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(box));
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+        renderStats.drawCalls++;
+        renderStats.occlusionQueries++;
+    }
+
+    void OcclusionBoxes::End() {
+
+        glBindVertexArray(0);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+}
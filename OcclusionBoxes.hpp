@@ -0,0 +1,42 @@
+#ifndef OcclusionBoxes_hpp
+#define OcclusionBoxes_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    // Occlusion queries of bounding boxes against the depth already in the framebuffer
+    // Each box is drawn with color and depth writes off inside a GL_ANY_SAMPLES_PASSED query;
+    // the shaded pass then wraps the geometry in glBeginConditionalRender, so the GPU skips it
+    // without the result ever being read back on the CPU
+    class OcclusionBoxes {
+
+    public:
+        void Init();
+        void Delete();
+
+        // Binds the depth-only program (it needs a "model" uniform) and the box state
+        void Begin(gps::Shader& shader);
+        // The box from center - halfExtent to center + halfExtent in the object space of modelMatrix
+        void Query(GLuint query, glm::mat4 modelMatrix, glm::vec3 center, glm::vec3 halfExtent);
+        void End();
+
+    private:
+        GLuint VAO;
+        GLuint VBO;
+        GLuint EBO;
+        GLint modelLocation;
+    };
+}
+
+#endif /* OcclusionBoxes_hpp */
@@ -0,0 +1,314 @@
+#include "Overlay.hpp"
+
+#include <cctype>
+#include <cstdio>
+
+namespace gps {
+
+    // 5x7 glyphs, one byte per row with the leftmost pixel in bit 4 - lowercase is drawn as uppercase
+    struct Glyph {
+
+        char character;
+        unsigned char rows[7];
+    };
+
+    static const Glyph FONT[] = {
+        { '0', { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E } },
+        { '1', { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+        { '2', { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F } },
+        { '3', { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E } },
+        { '4', { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 } },
+        { '5', { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E } },
+        { '6', { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E } },
+        { '7', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+        { '8', { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E } },
+        { '9', { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C } },
+        { 'A', { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+        { 'B', { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E } },
+        { 'C', { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E } },
+        { 'D', { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C } },
+        { 'E', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F } },
+        { 'F', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 } },
+        { 'G', { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F } },
+        { 'H', { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+        { 'I', { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+        { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C } },
+        { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+        { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F } },
+        { 'M', { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+        { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+        { 'O', { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+        { 'P', { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 } },
+        { 'Q', { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D } },
+        { 'R', { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 } },
+        { 'S', { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E } },
+        { 'T', { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+        { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+        { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 } },
+        { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A } },
+        { 'X', { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 } },
+        { 'Y', { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 } },
+        { 'Z', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F } },
+        { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C } },
+        { ':', { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 } },
+        { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+        { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+        { '-', { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 } },
+        { '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+        { ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } },
+        { ',', { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 } },
+        { '+', { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 } },
+        { '=', { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 } },
+        { '_', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F } },
+    };
+
+    // atlas of 16 x 8 cells indexed by ASCII code, the last cell is fully set and used for solid quads
+    static const int ATLAS_COLUMNS = 16;
+    static const int ATLAS_ROWS = 8;
+    static const int SOLID_CELL = 127;
+
+    // graph scale - a full bar is 33.3 ms, the line marks 16.7 ms
+    static const GLfloat GRAPH_MILLISECONDS = 1000.0f / 30.0f;
+
+    void Overlay::Init() {
+
+        overlayShader.loadShader("shaders/overlay.vert", "shaders/overlay.frag");
+        screenSizeLoc = glGetUniformLocation(overlayShader.shaderProgram, "screenSize");
+        fontAtlasLoc = glGetUniformLocation(overlayShader.shaderProgram, "fontAtlas");
+
+        CreateFontAtlas();
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (GLvoid*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (GLvoid*)offsetof(OverlayVertex, TexCoords));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (GLvoid*)offsetof(OverlayVertex, Color));
+        glBindVertexArray(0);
+    }
+
+    void Overlay::Delete() {
+
+        glDeleteBuffers(1, &VBO);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteTextures(1, &fontTexture);
+        glDeleteProgram(overlayShader.shaderProgram);
+    }
+
+    void Overlay::setVisible(bool visible) {
+
+        this->visible = visible;
+    }
+
+    bool Overlay::isVisible() {
+
+        return this->visible;
+    }
+
+    void Overlay::CreateFontAtlas() {
+
+        int width = ATLAS_COLUMNS * GLYPH_WIDTH;
+        int height = ATLAS_ROWS * GLYPH_HEIGHT;
+        std::vector<unsigned char> pixels(width * height, 0);
+
+        for (const Glyph& glyph : FONT) {
+
+            int cellX = (glyph.character % ATLAS_COLUMNS) * GLYPH_WIDTH;
+            int cellY = (glyph.character / ATLAS_COLUMNS) * GLYPH_HEIGHT;
+            for (int row = 0; row < 7; row++) {
+                for (int col = 0; col < 5; col++) {
+                    if (glyph.rows[row] & (0x10 >> col))
+                        pixels[(cellY + row) * width + cellX + col] = 255;
+                }
+            }
+        }
+
+        int solidX = (SOLID_CELL % ATLAS_COLUMNS) * GLYPH_WIDTH;
+        int solidY = (SOLID_CELL / ATLAS_COLUMNS) * GLYPH_HEIGHT;
+        for (int row = 0; row < GLYPH_HEIGHT; row++) {
+            for (int col = 0; col < GLYPH_WIDTH; col++) {
+                pixels[(solidY + row) * width + solidX + col] = 255;
+            }
+        }
+
+        glGenTextures(1, &fontTexture);
+        glBindTexture(GL_TEXTURE_2D, fontTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void Overlay::AddFrame(GLfloat frameMilliseconds, const RenderStats& stats) {
+
+        frameTimes[frameCount % HISTORY] = frameMilliseconds;
+        frameCount++;
+        lastStats = stats;
+    }
+
+    GLfloat Overlay::AverageFrameTime() {
+
+        int count = frameCount < HISTORY ? frameCount : HISTORY;
+        if (count == 0)
+            return 0.0f;
+
+        GLfloat total = 0.0f;
+        for (int i = 0; i < count; i++)
+            total += frameTimes[i];
+        return total / count;
+    }
+
+    std::vector<std::string> Overlay::Lines() {
+
+        GLfloat average = AverageFrameTime();
+        char line[128];
+        std::vector<std::string> lines;
+
+        snprintf(line, sizeof(line), "FPS %.1f  %.2f ms", average > 0.0f ? 1000.0f / average : 0.0f, average);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "Draws %u  Tris %u", lastStats.drawCalls, lastStats.trianglesSubmitted);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "Tex binds %u  Programs %u", lastStats.textureBinds, lastStats.programSwitches);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "Culled %u/%u meshlets  Queries %u", lastStats.meshletsCulled, lastStats.meshletsTotal,
+            lastStats.occlusionQueries);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "VRAM %.1f MB (buf %.1f tex %.1f)",
+            (lastStats.bufferBytes + lastStats.textureBytes) / 1048576.0,
+            lastStats.bufferBytes / 1048576.0, lastStats.textureBytes / 1048576.0);
+        lines.push_back(line);
+
+        return lines;
+    }
+
+    std::string Overlay::FormatCounters() {
+
+        std::vector<std::string> lines = Lines();
+        std::string text;
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (i > 0)
+                text += " | ";
+            text += lines[i];
+        }
+        return text;
+    }
+
+    void Overlay::AddQuad(glm::vec2 min, glm::vec2 max, glm::vec2 uvMin, glm::vec2 uvMax, glm::vec4 color) {
+
+        OverlayVertex quad[6] = {
+            { glm::vec2(min.x, min.y), glm::vec2(uvMin.x, uvMin.y), color },
+            { glm::vec2(min.x, max.y), glm::vec2(uvMin.x, uvMax.y), color },
+            { glm::vec2(max.x, max.y), glm::vec2(uvMax.x, uvMax.y), color },
+            { glm::vec2(min.x, min.y), glm::vec2(uvMin.x, uvMin.y), color },
+            { glm::vec2(max.x, max.y), glm::vec2(uvMax.x, uvMax.y), color },
+            { glm::vec2(max.x, min.y), glm::vec2(uvMax.x, uvMin.y), color }
+        };
+        vertices.insert(vertices.end(), quad, quad + 6);
+    }
+
+    void Overlay::AddSolidQuad(glm::vec2 min, glm::vec2 max, glm::vec4 color) {
+
+        // centre of the solid cell
+        glm::vec2 uv(((SOLID_CELL % ATLAS_COLUMNS) + 0.5f) / ATLAS_COLUMNS, ((SOLID_CELL / ATLAS_COLUMNS) + 0.5f) / ATLAS_ROWS);
+        AddQuad(min, max, uv, uv, color);
+    }
+
+    void Overlay::AddText(glm::vec2 position, std::string text, glm::vec4 color) {
+
+        glm::vec2 cellSize(1.0f / ATLAS_COLUMNS, 1.0f / ATLAS_ROWS);
+        glm::vec2 glyphSize(GLYPH_WIDTH * SCALE, GLYPH_HEIGHT * SCALE);
+
+        for (size_t i = 0; i < text.size(); i++) {
+
+            unsigned char c = (unsigned char)toupper((unsigned char)text[i]);
+            if (c != ' ' && c < SOLID_CELL) {
+
+                glm::vec2 uvMin((c % ATLAS_COLUMNS) * cellSize.x, (c / ATLAS_COLUMNS) * cellSize.y);
+                AddQuad(position, position + glyphSize, uvMin, uvMin + cellSize, color);
+            }
+            position.x += glyphSize.x;
+        }
+    }
+
+    void Overlay::Draw() {
+
+        if (!visible)
+            return;
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        vertices.clear();
+
+        std::vector<std::string> lines = Lines();
+        GLfloat lineHeight = (GLfloat)(GLYPH_HEIGHT * SCALE + 2);
+        GLfloat graphHeight = 60.0f;
+        glm::vec2 origin(10.0f, 10.0f);
+        GLfloat panelWidth = HISTORY * 3.0f;
+        for (size_t i = 0; i < lines.size(); i++)
+            panelWidth = glm::max(panelWidth, (GLfloat)(lines[i].size() * GLYPH_WIDTH * SCALE));
+        glm::vec2 panelSize(panelWidth + 16.0f, lines.size() * lineHeight + graphHeight + 24.0f);
+
+        AddSolidQuad(origin, origin + panelSize, glm::vec4(0.0f, 0.0f, 0.0f, 0.6f));
+
+        glm::vec2 cursor = origin + glm::vec2(8.0f, 8.0f);
+        for (size_t i = 0; i < lines.size(); i++) {
+            AddText(cursor, lines[i], glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+            cursor.y += lineHeight;
+        }
+
+        // frame time graph, oldest frame on the left
+        GLfloat graphBottom = cursor.y + 8.0f + graphHeight;
+        int count = frameCount < HISTORY ? frameCount : HISTORY;
+        for (int i = 0; i < count; i++) {
+
+            GLfloat milliseconds = frameTimes[(frameCount - count + i) % HISTORY];
+            GLfloat height = glm::min(milliseconds / GRAPH_MILLISECONDS, 1.0f) * graphHeight;
+            glm::vec4 color = milliseconds > GRAPH_MILLISECONDS / 2.0f ? glm::vec4(1.0f, 0.4f, 0.2f, 1.0f) : glm::vec4(0.3f, 1.0f, 0.3f, 1.0f);
+            GLfloat x = cursor.x + i * 3.0f;
+            AddSolidQuad(glm::vec2(x, graphBottom - height), glm::vec2(x + 2.0f, graphBottom), color);
+        }
+        AddSolidQuad(glm::vec2(cursor.x, graphBottom - graphHeight / 2.0f), glm::vec2(cursor.x + HISTORY * 3.0f, graphBottom - graphHeight / 2.0f + 1.0f),
+            glm::vec4(1.0f, 1.0f, 1.0f, 0.5f));
+
+        // state the scene passes rely on is put back afterwards
+        GLint previousProgram;
+        GLint polygonMode[2];
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+        glUseProgram(overlayShader.shaderProgram);
+        glUniform2f(screenSizeLoc, (GLfloat)viewport[2], (GLfloat)viewport[3]);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(fontAtlasLoc, 0);
+        glBindTexture(GL_TEXTURE_2D, fontTexture);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(OverlayVertex), &vertices[0], GL_STREAM_DRAW);
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vertices.size());
+        glBindVertexArray(0);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(previousProgram);
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+        glDisable(GL_BLEND);
+        glEnable(GL_CULL_FACE);
+        glEnable(GL_DEPTH_TEST);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef Overlay_hpp
+#define Overlay_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Shader.hpp"
+#include "RenderStats.hpp"
+
+namespace gps {
+
+    struct OverlayVertex {
+
+        glm::vec2 Position;
+        glm::vec2 TexCoords;
+        glm::vec4 Color;
+    };
+
+    // Performance overlay - frame time graph and the render counters
+    // Everything is batched into one draw call after the scene, and the counters are taken before it,
+    // so the overlay never shows up in the numbers it displays
+    class Overlay {
+
+    public:
+        void Init();
+        void Delete();
+
+        void setVisible(bool visible);
+        bool isVisible();
+
+        // Records the frame that just finished - call before Draw
+        void AddFrame(GLfloat frameMilliseconds, const RenderStats& stats);
+        void Draw();
+
+        // The overlay text on a single line, for stdout
+        std::string FormatCounters();
+
+    private:
+        static const int HISTORY = 120;
+        static const int GLYPH_WIDTH = 6;
+        static const int GLYPH_HEIGHT = 8;
+        static const int SCALE = 2;
+
+        bool visible = false;
+        gps::Shader overlayShader;
+        GLint screenSizeLoc;
+        GLint fontAtlasLoc;
+        GLuint fontTexture = 0;
+        GLuint VAO = 0;
+        GLuint VBO = 0;
+
+        GLfloat frameTimes[HISTORY] = {};
+        int frameCount = 0;
+        RenderStats lastStats = {};
+
+        std::vector<OverlayVertex> vertices;
+
+        void CreateFontAtlas();
+        GLfloat AverageFrameTime();
+        std::vector<std::string> Lines();
+        void AddQuad(glm::vec2 min, glm::vec2 max, glm::vec2 uvMin, glm::vec2 uvMax, glm::vec4 color);
+        void AddSolidQuad(glm::vec2 min, glm::vec2 max, glm::vec4 color);
+        void AddText(glm::vec2 position, std::string text, glm::vec4 color);
+    };
+}
+
+#endif /* Overlay_hpp */
@@ -0,0 +1,239 @@
+#include "PointShadowAtlas.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace gps {
+
+    // cube map face order - +X, -X, +Y, -Y, +Z, -Z, each looking along its axis with the up vector GL expects
+    static const glm::vec3 FACE_DIRECTIONS[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+    static const glm::vec3 FACE_UPS[6] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+
+    // the stored depth is the distance over the range, so the near plane only clips
+    static const float NEAR_PLANE = 0.1f;
+
+    void PointShadowAtlas::Init(int size, int slots) {
+
+        this->size = size;
+        slots = std::max(1, std::min(slots, (int)MAX_SLOTS));
+        Slot freeSlot = {};
+        freeSlot.light = -1;
+        this->slots.assign(slots, freeSlot);
+
+        // 16 bits of distance are plenty over a light's range
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTexture);
+        glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT16, size, size, slots * 6, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+        // hardware 2x2 comparison filtering, across the face edges too
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        renderStats.textureBytes += (size_t)size * size * 2 * 6 * slots;
+
+        // restored afterwards, like the cascades do
+        GLint previousFramebuffer;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Could not create the point shadow framebuffer!");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    }
+
+    void PointShadowAtlas::Delete() {
+
+        glDeleteTextures(1, &depthTexture);
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+
+    bool PointShadowAtlas::Update(std::vector<PointLight>& lights, glm::vec3 cameraPosition, BoundingSphere dynamicBounds) {
+
+        int lightCount = (int)lights.size();
+
+        // owners that are gone lose their slot, owners that moved draw it again
+        for (int i = 0; i < (int)slots.size(); i++) {
+            Slot& slot = slots[i];
+            if (slot.light < 0) {
+                continue;
+            }
+            if (slot.light >= lightCount) {
+                ReleaseSlot(i);
+            }
+            else if (lights[slot.light].position != slot.position || lights[slot.light].range != slot.range) {
+                slot.position = lights[slot.light].position;
+                slot.range = lights[slot.light].range;
+                std::fill(slot.dirty, slot.dirty + 6, true);
+                slot.ready = false;
+            }
+        }
+        lightSlots.resize(lightCount, -1);
+
+        // closest to the camera first - distance to the edge of the light's range
+        priorities.resize(lightCount);
+        order.resize(lightCount);
+        for (int i = 0; i < lightCount; i++) {
+            priorities[i] = std::max(0.0f, glm::length(lights[i].position - cameraPosition) - lights[i].range);
+            order[i] = i;
+        }
+        int wanted = std::min(lightCount, (int)slots.size());
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return priorities[a] < priorities[b]; });
+
+        // the lights that fell out of the closest ones free their slots for those that came in
+        float cutoff = (wanted > 0) ? priorities[order[wanted - 1]] : 0.0f;
+        for (int i = 0; i < (int)slots.size(); i++) {
+            int light = slots[i].light;
+            if (light >= 0 && priorities[light] > cutoff) {
+                ReleaseSlot(i);
+            }
+        }
+        int freeSlot = 0;
+        for (int k = 0; k < wanted; k++) {
+            int light = order[k];
+            if (lightSlots[light] >= 0) {
+                continue;
+            }
+            while (freeSlot < (int)slots.size() && slots[freeSlot].light >= 0) {
+                freeSlot++;
+            }
+            if (freeSlot == (int)slots.size()) {
+                break;
+            }
+            Slot& slot = slots[freeSlot];
+            slot.light = light;
+            slot.position = lights[light].position;
+            slot.range = lights[light].range;
+            std::fill(slot.dirty, slot.dirty + 6, true);
+            slot.ready = false;
+            lightSlots[light] = freeSlot;
+        }
+
+        // faces the dynamic casters reach now, or reached last frame and have to be cleared of
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].light >= 0) {
+                MarkDynamicFaces(slots[i], dynamicBounds);
+                MarkDynamicFaces(slots[i], lastDynamicBounds);
+            }
+        }
+        lastDynamicBounds = dynamicBounds;
+
+        // this frame's faces, the closest lights first
+        faces.clear();
+        for (int k = 0; k < lightCount; k++) {
+            if (lightSlots[order[k]] < 0) {
+                continue;
+            }
+            Slot& slot = slots[lightSlots[order[k]]];
+            bool pending = false;
+            for (int face = 0; face < 6; face++) {
+                if (!slot.dirty[face]) {
+                    continue;
+                }
+                if ((int)faces.size() < FACE_BUDGET) {
+                    faces.push_back({ lightSlots[order[k]], face });
+                    slot.dirty[face] = false;
+                }
+                else {
+                    pending = true;
+                }
+            }
+            slot.ready = slot.ready || !pending;
+        }
+
+        bool changed = false;
+        for (int i = 0; i < lightCount; i++) {
+            int slot = lightSlots[i];
+            int shadowSlot = (slot >= 0 && slots[slot].ready) ? slot : -1;
+            if (lights[i].shadowSlot != shadowSlot) {
+                lights[i].shadowSlot = shadowSlot;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    void PointShadowAtlas::ReleaseSlot(int slot) {
+
+        if (slots[slot].light < (int)lightSlots.size()) {
+            lightSlots[slots[slot].light] = -1;
+        }
+        slots[slot].light = -1;
+        slots[slot].ready = false;
+    }
+
+    void PointShadowAtlas::MarkDynamicFaces(Slot& slot, BoundingSphere bounds) {
+
+        if (bounds.radius <= 0.0f || glm::length(bounds.center - slot.position) >= slot.range + bounds.radius) {
+            return;
+        }
+        for (int face = 0; face < 6; face++) {
+            Frustum frustum;
+            frustum.Extract(FaceProjection(slot.range) * FaceView(slot.position, face));
+            if (frustum.Intersects(bounds.center, bounds.radius)) {
+                slot.dirty[face] = true;
+            }
+        }
+    }
+
+    glm::mat4 PointShadowAtlas::FaceView(glm::vec3 position, int face) {
+
+        return glm::lookAt(position, position + FACE_DIRECTIONS[face], FACE_UPS[face]);
+    }
+
+    glm::mat4 PointShadowAtlas::FaceProjection(float range) {
+
+        return glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, range);
+    }
+
+    int PointShadowAtlas::getFaceCount() {
+
+        return (int)faces.size();
+    }
+
+    void PointShadowAtlas::BeginFace(int face) {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, faces[face].slot * 6 + faces[face].face);
+        glViewport(0, 0, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    glm::mat4 PointShadowAtlas::getFaceView(int face) {
+
+        return FaceView(slots[faces[face].slot].position, faces[face].face);
+    }
+
+    glm::mat4 PointShadowAtlas::getFaceProjection(int face) {
+
+        return FaceProjection(slots[faces[face].slot].range);
+    }
+
+    glm::vec4 PointShadowAtlas::getFaceLight(int face) {
+
+        return glm::vec4(slots[faces[face].slot].position, slots[faces[face].slot].range);
+    }
+
+    void PointShadowAtlas::Bind(GLuint unit) {
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTexture);
+        renderStats.textureBinds++;
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef PointShadowAtlas_hpp
+#define PointShadowAtlas_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Culling.hpp"
+#include "LightClusters.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Point light shadows - one depth cube per shadowed light, all slots in one cube map array
+    // the cubes hold the distance to the light over its range, written by pointShadow.frag, so the lookup
+    // compares distances and any face can be sampled with the same reference
+    //   the lights closest to the camera get the slots, a light only reads its cube once all six faces are drawn
+    //   faces are kept until a dynamic caster reaches them, and at most FACE_BUDGET faces are drawn per frame,
+    //   the closest lights first
+    class PointShadowAtlas {
+
+    public:
+        static const int MAX_SLOTS = 64;
+        static const int FACE_BUDGET = 24;
+
+        // slots - cubes allocated, at most MAX_SLOTS
+        void Init(int size, int slots);
+        void Delete();
+
+        // Hands the slots to the lights closest to the camera, picks this frame's faces and sets
+        // the lights' shadowSlot - true when a shadowSlot changed
+        bool Update(std::vector<PointLight>& lights, glm::vec3 cameraPosition, BoundingSphere dynamicBounds);
+
+        // Faces picked by the last Update - binds the face as the depth target, sets the viewport and clears it
+        int getFaceCount();
+        void BeginFace(int face);
+
+        glm::mat4 getFaceView(int face);
+        glm::mat4 getFaceProjection(int face);
+        // world position and range of the face's light
+        glm::vec4 getFaceLight(int face);
+
+        void Bind(GLuint unit);
+
+    private:
+        struct Slot {
+
+            // -1 when free
+            int light;
+            glm::vec3 position;
+            float range;
+            bool dirty[6];
+            // every face drawn since the light got the slot
+            bool ready;
+        };
+
+        struct Face {
+
+            int slot;
+            int face;
+        };
+
+        int size = 0;
+        GLuint depthTexture = 0;
+        GLuint framebuffer = 0;
+        std::vector<Slot> slots;
+        // slot of each light, -1 without one
+        std::vector<int> lightSlots;
+        std::vector<Face> faces;
+        BoundingSphere lastDynamicBounds = { glm::vec3(0.0f), 0.0f };
+
+        // rebuilt every frame, kept to reuse their memory
+        std::vector<int> order;
+        std::vector<float> priorities;
+
+        static glm::mat4 FaceView(glm::vec3 position, int face);
+        static glm::mat4 FaceProjection(float range);
+
+        void ReleaseSlot(int slot);
+        void MarkDynamicFaces(Slot& slot, BoundingSphere bounds);
+    };
+}
+
+#endif /* PointShadowAtlas_hpp */
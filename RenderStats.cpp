@@ -0,0 +1,17 @@
+#include "RenderStats.hpp"
+
+namespace gps {
+
+    RenderStats renderStats = {};
+
+    void RenderStats::Reset() {
+
+        drawCalls = 0;
+        trianglesSubmitted = 0;
+        meshletsTotal = 0;
+        meshletsCulled = 0;
+        occlusionQueries = 0;
+        textureBinds = 0;
+        programSwitches = 0;
+    }
+}
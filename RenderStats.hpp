@@ -0,0 +1,38 @@
+#ifndef RenderStats_hpp
+#define RenderStats_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+
+namespace gps {
+
+    // Counters for what was submitted to the GPU during the current frame
+    struct RenderStats {
+
+        GLuint drawCalls;
+        GLuint trianglesSubmitted;
+        GLuint meshletsTotal;
+        GLuint meshletsCulled;
+        // groups of meshlets tested against the depth pre-pass - the GPU decides what they cull, so that is not counted
+        GLuint occlusionQueries;
+        GLuint textureBinds;
+        GLuint programSwitches;
+
+        // Estimated video memory of everything uploaded so far - not cleared by Reset
+        size_t bufferBytes;
+        size_t textureBytes;
+
+        void Reset();
+    };
+
+    extern RenderStats renderStats;
+}
+
+#endif /* RenderStats_hpp */
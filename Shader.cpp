@@ -7,8 +7,38 @@
 //
 
 #include "Shader.hpp"
+#include "RenderStats.hpp"
+
+#include <cstdio>
+#include <cstdint>
+
+#if defined (_WIN32)
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
 
 namespace gps {
+
+    // program made current by the last useShaderProgram, to count real switches
+    static GLuint boundProgram = 0;
+
+    std::string Shader::binaryCacheDirectory = "shader_cache";
+    int Shader::programsFromCache = 0;
+    int Shader::programsCompiled = 0;
+
+    // identifies the cache files - "GPSB" followed by the binary format
+    static const uint32_t BINARY_MAGIC = 0x42535047;
+
+    static uint64_t Fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ULL) {
+
+        for (size_t i = 0; i < data.size(); i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
     std::string Shader::readShaderFile(std::string fileName) {
 
         std::ifstream shaderFile;
@@ -30,7 +60,7 @@ namespace gps {
         return shaderString;
     }
     
-    void Shader::shaderCompileLog(GLuint shaderId) {
+    bool Shader::shaderCompileLog(GLuint shaderId) {
 
         GLint success;
         GLchar infoLog[512];
@@ -43,9 +73,10 @@ namespace gps {
             glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
             std::cout << "Shader compilation error\n" << infoLog << std::endl;
         }
+        return success == GL_TRUE;
     }
     
-    void Shader::shaderLinkLog(GLuint shaderProgramId) {
+    bool Shader::shaderLinkLog(GLuint shaderProgramId) {
 
         GLint success;
         GLchar infoLog[512];
@@ -56,44 +87,314 @@ namespace gps {
             glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
             std::cout << "Shader linking error\n" << infoLog << std::endl;
         }
+        return success == GL_TRUE;
     }
     
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
+    std::string Shader::injectDefines(std::string source, std::vector<std::string>& defines) {
+
+        if (defines.empty())
+            return source;
+
+        std::string block;
+        for (size_t i = 0; i < defines.size(); i++)
+            block += "#define " + defines[i] + "\n";
+
+        //#version has to stay the first statement
+        size_t versionLine = source.find("#version");
+        if (versionLine == std::string::npos)
+            return block + source;
+        size_t lineEnd = source.find('\n', versionLine);
+        if (lineEnd == std::string::npos)
+            return source + "\n" + block;
+        return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+    }
+
+    void Shader::setBinaryCacheDirectory(std::string directory) {
+
+        binaryCacheDirectory = directory;
+    }
+
+    void Shader::PrintCacheStats() {
+
+        std::cout << "Shader programs: " << programsFromCache << " loaded from the binary cache, "
+            << programsCompiled << " compiled" << std::endl;
+    }
+
+    // named after the final sources and the driver, so any change to either misses the cache
+    std::string Shader::binaryCacheFile(const std::string& vertexSource, const std::string& fragmentSource) {
+
+        if (binaryCacheDirectory.empty())
+            return "";
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0)
+            return "";
+
+        uint64_t hash = Fnv1a(vertexSource);
+        hash = Fnv1a(std::string(1, '\0') + fragmentSource, hash);
+        hash = Fnv1a(std::string((const char*)glGetString(GL_VENDOR)), hash);
+        hash = Fnv1a(std::string((const char*)glGetString(GL_RENDERER)), hash);
+        hash = Fnv1a(std::string((const char*)glGetString(GL_VERSION)), hash);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+        return binaryCacheDirectory + "/" + name;
+    }
+
+    bool Shader::loadProgramBinary(const std::string& fileName) {
+
+        FILE* file = fopen(fileName.c_str(), "rb");
+        if (!file)
+            return false;
+
+        uint32_t header[2];
+        std::vector<char> binary;
+        bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == BINARY_MAGIC;
+        if (valid) {
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file) - (long)sizeof(header);
+            fseek(file, sizeof(header), SEEK_SET);
+            valid = size > 0;
+            if (valid) {
+                binary.resize(size);
+                valid = fread(&binary[0], 1, size, file) == (size_t)size;
+            }
+        }
+        fclose(file);
+        if (!valid)
+            return false;
+
+        this->shaderProgram = glCreateProgram();
+        glProgramBinary(this->shaderProgram, (GLenum)header[1], &binary[0], (GLsizei)binary.size());
+
+        // the driver rejects binaries it can no longer use, e.g. after an update
+        GLint success = 0;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(this->shaderProgram);
+            this->shaderProgram = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void Shader::saveProgramBinary(const std::string& fileName) {
+
+        GLint success = 0;
+        GLint length = 0;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!success || length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(this->shaderProgram, length, NULL, &format, &binary[0]);
+
+#if defined (_WIN32)
+        _mkdir(binaryCacheDirectory.c_str());
+#else
+        mkdir(binaryCacheDirectory.c_str(), 0755);
+#endif
+        FILE* file = fopen(fileName.c_str(), "wb");
+        if (!file)
+            return;
+
+        uint32_t header[2] = { BINARY_MAGIC, (uint32_t)format };
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(&binary[0], 1, binary.size(), file);
+        fclose(file);
+    }
+
+    bool Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::vector<std::string> defines) {
+
+        uniformLocations.clear();
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        this->defines = defines;
+
+        std::string v = injectDefines(readShaderFile(vertexShaderFileName), defines);
+        std::string f = injectDefines(readShaderFile(fragmentShaderFileName), defines);
+
+        //reuse the program linked on an earlier run when the sources and the driver are unchanged
+        std::string cacheFile = binaryCacheFile(v, f);
+        if (!cacheFile.empty() && loadProgramBinary(cacheFile)) {
+            programsFromCache++;
+            return true;
+        }
 
         //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
         const GLchar* vertexShaderString = v.c_str();
         GLuint vertexShader;
         vertexShader = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
         glCompileShader(vertexShader);
         //check compilation status
-        shaderCompileLog(vertexShader);
+        bool compiled = shaderCompileLog(vertexShader);
         
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        //read, parse and compile the fragment shader
         const GLchar* fragmentShaderString = f.c_str();
         GLuint fragmentShader;
         fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
         glCompileShader(fragmentShader);
         //check compilation status
-        shaderCompileLog(fragmentShader);
+        compiled = shaderCompileLog(fragmentShader) && compiled;
         
         //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
         glAttachShader(this->shaderProgram, vertexShader);
         glAttachShader(this->shaderProgram, fragmentShader);
+        if (!cacheFile.empty())
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->shaderProgram);
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
         //check linking info
-        shaderLinkLog(this->shaderProgram);
+        bool linked = compiled && shaderLinkLog(this->shaderProgram);
+        programsCompiled++;
+
+        if (linked && !cacheFile.empty())
+            saveProgramBinary(cacheFile);
+        return linked;
+    }
+
+    bool Shader::reload() {
+
+        return reloadAll(std::vector<Shader*>(1, this));
+    }
+
+    bool Shader::reloadAll(std::vector<Shader*> shaders) {
+
+        // build all programs first so a failing one leaves the whole set untouched
+        std::vector<Shader> rebuilt(shaders.size());
+        size_t built = 0;
+        bool success = true;
+        for (; built < shaders.size() && success; built++)
+            success = rebuilt[built].loadShader(shaders[built]->vertexShaderFileName, shaders[built]->fragmentShaderFileName, shaders[built]->defines);
+
+        if (!success) {
+            for (size_t i = 0; i < built; i++)
+                glDeleteProgram(rebuilt[i].shaderProgram);
+            for (size_t i = 0; i < shaders.size(); i++)
+                std::cout << "Keeping the previous " << shaders[i]->fragmentShaderFileName << " program" << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < shaders.size(); i++) {
+            glDeleteProgram(shaders[i]->shaderProgram);
+            shaders[i]->shaderProgram = rebuilt[i].shaderProgram;
+            // locations belong to the old program
+            shaders[i]->uniformLocations.clear();
+        }
+        // the deleted programs' names may be handed out again
+        boundProgram = 0;
+        return true;
+    }
+
+    bool Shader::usesFile(const std::string& fileName) {
+
+        return fileName == vertexShaderFileName || fileName == fragmentShaderFileName;
     }
     
     void Shader::useShaderProgram() {
 
+        if (this->shaderProgram != boundProgram) {
+            renderStats.programSwitches++;
+            boundProgram = this->shaderProgram;
+        }
         glUseProgram(this->shaderProgram);
     }
 
+    GLint Shader::getUniformLocation(const std::string& name) {
+
+        std::unordered_map<std::string, GLint>::iterator it = uniformLocations.find(name);
+        if (it != uniformLocations.end())
+            return it->second;
+
+        GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+        uniformLocations[name] = location;
+        return location;
+    }
+
+    void ShaderPermutations::Load(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::vector<std::string> features) {
+
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        this->features = features;
+    }
+
+    void ShaderPermutations::BindUniformBlock(std::string blockName, GLuint binding) {
+
+        uniformBlocks.push_back(std::make_pair(blockName, binding));
+    }
+
+    Shader& ShaderPermutations::Get(unsigned key) {
+
+        std::map<unsigned, Shader>::iterator it = variants.find(key);
+        if (it != variants.end())
+            return it->second;
+
+        Shader& shader = variants[key];
+        shader.loadShader(vertexShaderFileName, fragmentShaderFileName, definesFor(key));
+        bindUniformBlocks(shader);
+        return shader;
+    }
+
+    std::vector<std::string> ShaderPermutations::definesFor(unsigned key) {
+
+        std::vector<std::string> defines;
+        for (size_t i = 0; i < features.size(); i++) {
+            if (key & (1u << i))
+                defines.push_back(features[i]);
+        }
+        return defines;
+    }
+
+    void ShaderPermutations::bindUniformBlocks(Shader& shader) {
+
+        for (size_t i = 0; i < uniformBlocks.size(); i++) {
+            GLuint blockIndex = glGetUniformBlockIndex(shader.shaderProgram, uniformBlocks[i].first.c_str());
+            if (blockIndex != GL_INVALID_INDEX)
+                glUniformBlockBinding(shader.shaderProgram, blockIndex, uniformBlocks[i].second);
+        }
+    }
+
+    bool ShaderPermutations::Reload() {
+
+        // build all variants first so a failing one leaves the whole set untouched
+        std::map<unsigned, Shader> rebuilt;
+        bool success = true;
+        for (std::map<unsigned, Shader>::iterator it = variants.begin(); it != variants.end() && success; ++it)
+            success = rebuilt[it->first].loadShader(vertexShaderFileName, fragmentShaderFileName, definesFor(it->first));
+
+        if (!success) {
+            for (std::map<unsigned, Shader>::iterator it = rebuilt.begin(); it != rebuilt.end(); ++it)
+                glDeleteProgram(it->second.shaderProgram);
+            std::cout << "Keeping the previous " << fragmentShaderFileName << " variants" << std::endl;
+            return false;
+        }
+
+        for (std::map<unsigned, Shader>::iterator it = variants.begin(); it != variants.end(); ++it) {
+            glDeleteProgram(it->second.shaderProgram);
+            it->second = rebuilt[it->first];
+            bindUniformBlocks(it->second);
+        }
+        boundProgram = 0;
+        return true;
+    }
+
+    bool ShaderPermutations::usesFile(const std::string& fileName) {
+
+        return fileName == vertexShaderFileName || fileName == fragmentShaderFileName;
+    }
+
+    void ShaderPermutations::Delete() {
+
+        for (std::map<unsigned, Shader>::iterator it = variants.begin(); it != variants.end(); ++it)
+            glDeleteProgram(it->second.shaderProgram);
+        variants.clear();
+    }
+
 }
@@ -20,6 +20,10 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
 
 
 namespace gps {
@@ -28,13 +32,68 @@ namespace gps {
 
     public:
         GLuint shaderProgram;
-        void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+        // defines are inserted as #define lines right after the #version line of both stages
+        // false when compiling or linking failed
+        bool loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+            std::vector<std::string> defines = std::vector<std::string>());
         void useShaderProgram();
+
+        // Rebuilds the program from its source files - on failure the current program is kept
+        bool reload();
+        // Rebuilds programs that run as a set (e.g. sharing a vertex stage) - they are swapped together,
+        // and only if all of them compile
+        static bool reloadAll(std::vector<Shader*> shaders);
+        bool usesFile(const std::string& fileName);
+        // cached per program - -1 for uniforms the variant does not use
+        GLint getUniformLocation(const std::string& name);
+
+        // Linked programs are stored here with glGetProgramBinary and reused on later runs - empty disables it
+        static void setBinaryCacheDirectory(std::string directory);
+        static void PrintCacheStats();
     
     private:
+        std::unordered_map<std::string, GLint> uniformLocations;
+        std::string vertexShaderFileName;
+        std::string fragmentShaderFileName;
+        std::vector<std::string> defines;
+
+        static std::string binaryCacheDirectory;
+        static int programsFromCache;
+        static int programsCompiled;
+
         std::string readShaderFile(std::string fileName);
-        void shaderCompileLog(GLuint shaderId);
-        void shaderLinkLog(GLuint shaderProgramId);
+        std::string binaryCacheFile(const std::string& vertexSource, const std::string& fragmentSource);
+        bool loadProgramBinary(const std::string& fileName);
+        void saveProgramBinary(const std::string& fileName);
+        std::string injectDefines(std::string source, std::vector<std::string>& defines);
+        bool shaderCompileLog(GLuint shaderId);
+        bool shaderLinkLog(GLuint shaderProgramId);
+    };
+
+    // Variants of one shader source specialised with #defines instead of uniform branches
+    // Bit i of the key enables features[i]; variants are compiled on first use and cached by key
+    class ShaderPermutations {
+
+    public:
+        void Load(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::vector<std::string> features);
+        // applied to every variant when it is compiled
+        void BindUniformBlock(std::string blockName, GLuint binding);
+        Shader& Get(unsigned key);
+        void Delete();
+
+        // Rebuilds every compiled variant - they are swapped together, and only if all of them compile
+        bool Reload();
+        bool usesFile(const std::string& fileName);
+
+    private:
+        std::string vertexShaderFileName;
+        std::string fragmentShaderFileName;
+        std::vector<std::string> features;
+        std::vector<std::pair<std::string, GLuint>> uniformBlocks;
+        std::map<unsigned, Shader> variants;
+
+        std::vector<std::string> definesFor(unsigned key);
+        void bindUniformBlocks(Shader& shader);
     };
     
 }
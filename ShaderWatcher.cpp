@@ -0,0 +1,140 @@
+#include "ShaderWatcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sys/stat.h>
+
+#if defined (__linux__)
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+namespace gps {
+
+    // how often the thread checks for changes and for Stop
+    static const int WATCH_INTERVAL_MS = 250;
+
+    static long long modificationTime(const std::string& fileName) {
+
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0)
+            return -1;
+        return (long long)info.st_mtime;
+    }
+
+    static std::string directoryOf(const std::string& fileName) {
+
+        size_t slash = fileName.find_last_of("/\\");
+        return slash == std::string::npos ? std::string(".") : fileName.substr(0, slash);
+    }
+
+    ShaderWatcher::~ShaderWatcher() {
+
+        Stop();
+    }
+
+    void ShaderWatcher::Watch(const std::string& fileName) {
+
+        if (std::find(files.begin(), files.end(), fileName) == files.end())
+            files.push_back(fileName);
+    }
+
+    void ShaderWatcher::Start() {
+
+        if (running)
+            return;
+        running = true;
+
+#if defined (__linux__)
+        // editors either rewrite the file or rename a new one over it, so the directories are watched
+        inotifyFd = inotify_init1(IN_NONBLOCK);
+        if (inotifyFd >= 0) {
+            for (size_t i = 0; i < files.size(); i++) {
+                std::string directory = directoryOf(files[i]);
+                int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (wd >= 0)
+                    directories[wd] = directory;
+            }
+            thread = std::thread(&ShaderWatcher::watchInotify, this);
+            return;
+        }
+        std::cout << "inotify unavailable, polling the shader files" << std::endl;
+#endif
+        for (size_t i = 0; i < files.size(); i++)
+            modificationTimes[files[i]] = modificationTime(files[i]);
+        thread = std::thread(&ShaderWatcher::watchPolling, this);
+    }
+
+    void ShaderWatcher::Stop() {
+
+        running = false;
+        if (thread.joinable())
+            thread.join();
+#if defined (__linux__)
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+        directories.clear();
+#endif
+    }
+
+    std::vector<std::string> ShaderWatcher::TakeChanges() {
+
+        std::lock_guard<std::mutex> lock(changesMutex);
+        std::vector<std::string> taken(changes.begin(), changes.end());
+        changes.clear();
+        return taken;
+    }
+
+    void ShaderWatcher::addChange(const std::string& fileName) {
+
+        std::lock_guard<std::mutex> lock(changesMutex);
+        changes.insert(fileName);
+    }
+
+#if defined (__linux__)
+    void ShaderWatcher::watchInotify() {
+
+        alignas(inotify_event) char buffer[4096];
+        pollfd descriptor = { inotifyFd, POLLIN, 0 };
+
+        while (running) {
+            if (poll(&descriptor, 1, WATCH_INTERVAL_MS) <= 0)
+                continue;
+
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+                    inotify_event* event = (inotify_event*)p;
+                    if (event->len == 0 || directories.count(event->wd) == 0)
+                        continue;
+
+                    std::string fileName = directories[event->wd] + "/" + event->name;
+                    if (std::find(files.begin(), files.end(), fileName) != files.end())
+                        addChange(fileName);
+                }
+            }
+        }
+    }
+#endif
+
+    void ShaderWatcher::watchPolling() {
+
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_INTERVAL_MS));
+
+            for (size_t i = 0; i < files.size(); i++) {
+                long long time = modificationTime(files[i]);
+                if (time != modificationTimes[files[i]]) {
+                    modificationTimes[files[i]] = time;
+                    // a file that is being replaced may be missing for a moment
+                    if (time >= 0)
+                        addChange(files[i]);
+                }
+            }
+        }
+    }
+}
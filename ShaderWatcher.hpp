@@ -0,0 +1,49 @@
+#ifndef ShaderWatcher_hpp
+#define ShaderWatcher_hpp
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Watches shader source files on a background thread
+    // inotify on Linux, modification times polled elsewhere
+    // The render thread collects the changes with TakeChanges and reloads between frames
+    class ShaderWatcher {
+
+    public:
+        ~ShaderWatcher();
+
+        // Files are added before Start
+        void Watch(const std::string& fileName);
+        void Start();
+        void Stop();
+
+        // Files written since the last call, each listed once
+        std::vector<std::string> TakeChanges();
+
+    private:
+        std::vector<std::string> files;
+        std::thread thread;
+        std::atomic<bool> running{ false };
+
+        std::mutex changesMutex;
+        std::set<std::string> changes;
+
+        void addChange(const std::string& fileName);
+#if defined (__linux__)
+        int inotifyFd = -1;
+        std::map<int, std::string> directories;
+        void watchInotify();
+#endif
+        std::map<std::string, long long> modificationTimes;
+        void watchPolling();
+    };
+}
+
+#endif /* ShaderWatcher_hpp */
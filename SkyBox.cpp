@@ -7,73 +7,376 @@
 //
 
 #include "SkyBox.hpp"
+#include "AssetCache.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 
 namespace gps {
+
+    // edge of the specular cube's first level - each level after it is half as wide
+    static const int ENVIRONMENT_SIZE = 128;
+    // Phong exponent of the first level, divided by 4 per level - basic.frag's highlight exponent of 32 is level 2.5
+    static const float ENVIRONMENT_EXPONENT = 1024.0f;
+    // directions importance sampled per specular texel
+    static const int ENVIRONMENT_SAMPLES = 64;
+    // the irradiance is projected from the first level of the sky's pyramid at most this wide
+    static const int IRRADIANCE_SIZE = 64;
+    // identifies the cache files - "GPSK", the version changes with the precomputation
+    static const uint32_t CACHE_MAGIC = 0x4b535047;
+    static const uint32_t CACHE_VERSION = 1;
+    // identifies the compressed face caches - "GPSF"
+    static const uint32_t FACE_CACHE_MAGIC = 0x46535047;
+    static const uint32_t FACE_CACHE_VERSION = 1;
+    // bytes of a DXT1 block, which holds 4x4 texels
+    static const int BLOCK_BYTES = 8;
     
     SkyBox::SkyBox()
     {
         
     }
     
-    void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
+    void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces, const std::string& cacheDirectory, bool compress)
     {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
+        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces, cacheDirectory, compress);
         InitSkyBox();
+
+        environmentDone = false;
+        environmentWorker = std::thread(&SkyBox::ComputeEnvironment, this, cacheDirectory);
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(gps::Shader& shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
     {
         shader.useShaderProgram();
         
-        //set the view and projection matrices
+        //set the view and projection matrices - the locations are cached by the shader
         glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        glUniformMatrix4fv(shader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(transformedView));
+        glUniformMatrix4fv(shader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
         
+        //drawn last at the far plane - only the pixels no mesh covered pass, nothing behind it needs its depth
         glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
         
         glBindVertexArray(skyboxVAO);
         glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
+        glUniform1i(shader.getUniformLocation("skybox"), 0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        renderStats.textureBinds++;
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
+
+        renderStats.drawCalls++;
+        renderStats.trianglesSubmitted += 12;
         
+        glDepthMask(GL_TRUE);
         glDepthFunc(GL_LESS);
     }
     
-    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
+    // whole file, empty when it cannot be read
+    static std::vector<unsigned char> ReadFile(const char* fileName)
+    {
+        std::vector<unsigned char> data;
+        FILE* file = fopen(fileName, "rb");
+        if (!file) {
+            return data;
+        }
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data.resize(length > 0 ? (size_t)length : 0);
+        if (!data.empty() && fread(&data[0], 1, data.size(), file) != data.size()) {
+            data.clear();
+        }
+        fclose(file);
+        return data;
+    }
+
+    static int MipCount(int size)
+    {
+        int levels = 1;
+        while (size > 1) {
+            size /= 2;
+            levels++;
+        }
+        return levels;
+    }
+
+    static size_t LevelBytes(int size, bool compressed)
+    {
+        return compressed ? (size_t)((size + 3) / 4) * ((size + 3) / 4) * BLOCK_BYTES : (size_t)size * size * 3;
+    }
+
+    // RGB level half the size of source, each texel the average of the 2x2 it covers - clamped at an odd edge
+    static std::vector<unsigned char> Downsample(const std::vector<unsigned char>& source, int size)
+    {
+        int half = std::max(1, size / 2);
+        std::vector<unsigned char> level((size_t)half * half * 3);
+        for (int y = 0; y < half; y++) {
+            int y0 = std::min(y * 2, size - 1);
+            int y1 = std::min(y * 2 + 1, size - 1);
+            for (int x = 0; x < half; x++) {
+                int x0 = std::min(x * 2, size - 1);
+                int x1 = std::min(x * 2 + 1, size - 1);
+                for (int c = 0; c < 3; c++) {
+                    int sum = source[((size_t)y0 * size + x0) * 3 + c] + source[((size_t)y0 * size + x1) * 3 + c] +
+                        source[((size_t)y1 * size + x0) * 3 + c] + source[((size_t)y1 * size + x1) * 3 + c];
+                    level[((size_t)y * half + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        return level;
+    }
+
+    static unsigned short PackColor(const int rgb[3])
+    {
+        return (unsigned short)(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+    }
+
+    static void UnpackColor(unsigned short color, int rgb[3])
+    {
+        rgb[0] = ((color >> 11) & 31) * 255 / 31;
+        rgb[1] = ((color >> 5) & 63) * 255 / 63;
+        rgb[2] = (color & 31) * 255 / 31;
+    }
+
+    // DXT1 block of the 4x4 texels from x, y - the end colours span the block's bounding box, pulled in by a sixteenth
+    // of it so the in-between colours land on the texels, and every texel takes the closest of the four
+    static void CompressBlock(const unsigned char* rgb, int size, int x, int y, unsigned char* block)
+    {
+        int texels[16][3];
+        int low[3] = { 255, 255, 255 };
+        int high[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++) {
+            const unsigned char* texel = rgb + ((size_t)std::min(y + i / 4, size - 1) * size + std::min(x + i % 4, size - 1)) * 3;
+            for (int c = 0; c < 3; c++) {
+                texels[i][c] = texel[c];
+                low[c] = std::min(low[c], texels[i][c]);
+                high[c] = std::max(high[c], texels[i][c]);
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            int inset = (high[c] - low[c]) / 16;
+            low[c] += inset;
+            high[c] -= inset;
+        }
+        // the first end colour must be the larger one, the other order means three colours and black
+        unsigned short color0 = PackColor(high);
+        unsigned short color1 = PackColor(low);
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+        int palette[4][3];
+        UnpackColor(color0, palette[0]);
+        UnpackColor(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        uint32_t indices = 0;
+        for (int i = 0; i < 16 && color0 != color1; i++) {
+            int best = 0;
+            int bestDistance = INT32_MAX;
+            for (int p = 0; p < 4; p++) {
+                int distance = 0;
+                for (int c = 0; c < 3; c++) {
+                    distance += (texels[i][c] - palette[p][c]) * (texels[i][c] - palette[p][c]);
+                }
+                if (distance < bestDistance) {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+        block[0] = (unsigned char)(color0 & 0xff);
+        block[1] = (unsigned char)(color0 >> 8);
+        block[2] = (unsigned char)(color1 & 0xff);
+        block[3] = (unsigned char)(color1 >> 8);
+        for (int i = 0; i < 4; i++) {
+            block[4 + i] = (unsigned char)(indices >> (8 * i));
+        }
+    }
+
+    static std::vector<unsigned char> CompressLevel(const std::vector<unsigned char>& rgb, int size)
+    {
+        std::vector<unsigned char> blocks(LevelBytes(size, true));
+        unsigned char* block = &blocks[0];
+        for (int y = 0; y < size; y += 4) {
+            for (int x = 0; x < size; x += 4) {
+                CompressBlock(&rgb[0], size, x, y, block);
+                block += BLOCK_BYTES;
+            }
+        }
+        return blocks;
+    }
+
+    // The faces are read, decoded, mip mapped and compressed on a thread each, or read back from the cache when it holds
+    // them compressed - nothing is created on the GPU until all six are there
+    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces, const std::string& cacheDirectory, bool compress)
     {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#if defined (__APPLE__)
+        compress = false;
+        bool immutable = false;
+#else
+        compress = compress && GLEW_EXT_texture_compression_s3tc;
+        bool immutable = GLEW_ARB_texture_storage ? true : false;
+#endif
+        if (skyBoxFaces.size() != 6) {
+            fprintf(stderr, "ERROR: a sky box needs six faces\n");
+            return 0;
+        }
+
+        faceFiles.assign(6, std::vector<unsigned char>());
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 6; i++) {
+            readers.push_back(std::thread([&, i]() { faceFiles[i] = ReadFile(skyBoxFaces[i]); }));
+        }
+        for (int i = 0; i < 6; i++) {
+            readers[i].join();
+        }
+        uint32_t settings[2] = { FACE_CACHE_VERSION, (uint32_t)BLOCK_BYTES };
+        uint64_t hash = AssetCache::Hash(settings, sizeof(settings));
+        for (int i = 0; i < 6; i++) {
+            if (faceFiles[i].empty()) {
+                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
+                return 0;
+            }
+            hash = AssetCache::Hash(&faceFiles[i][0], faceFiles[i].size(), hash);
+        }
+
+        // levels[face][level] - RGB texels, or DXT1 blocks when compressing
+        std::vector<std::vector<unsigned char> > levels[6];
+        int size = 0;
+        std::string fileName = AssetCache::FileName(cacheDirectory, "skyfaces", hash);
+        bool cached = compress && !cacheDirectory.empty() && ReadFaceCache(fileName, levels, size);
+        if (!cached) {
+            int sizes[6] = {};
+            std::vector<std::thread> decoders;
+            for (int i = 0; i < 6; i++) {
+                decoders.push_back(std::thread([&, i]() {
+                    int width, height, n;
+                    unsigned char* image = stbi_load_from_memory(&faceFiles[i][0], (int)faceFiles[i].size(), &width, &height, &n, 3);
+                    if (!image || width != height) {
+                        stbi_image_free(image);
+                        return;
+                    }
+                    sizes[i] = width;
+                    levels[i].push_back(std::vector<unsigned char>(image, image + (size_t)width * height * 3));
+                    stbi_image_free(image);
+                    for (int level = 1, levelSize = width; level < MipCount(width); level++, levelSize /= 2) {
+                        levels[i].push_back(Downsample(levels[i].back(), levelSize));
+                    }
+                    for (int level = 0, levelSize = width; compress && level < (int)levels[i].size(); level++, levelSize = std::max(1, levelSize / 2)) {
+                        levels[i][level] = CompressLevel(levels[i][level], levelSize);
+                    }
+                }));
+            }
+            for (int i = 0; i < 6; i++) {
+                decoders[i].join();
+            }
+            size = sizes[0];
+            for (int i = 0; i < 6; i++) {
+                if (sizes[i] == 0 || sizes[i] != size) {
+                    fprintf(stderr, "ERROR: could not load %s - the faces must be square and of one size\n", skyBoxFaces[i]);
+                    return 0;
+                }
+            }
+            if (compress && !cacheDirectory.empty()) {
+                WriteFaceCache(cacheDirectory, fileName, levels, size);
+            }
+        }
+
         GLuint textureID;
         glGenTextures(1, &textureID);
         glActiveTexture(GL_TEXTURE0);
-        
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-        {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+        // the small levels' rows are not 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        int levelCount = MipCount(size);
+        GLenum format = compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+        if (immutable) {
+            glTexStorage2D(GL_TEXTURE_CUBE_MAP, levelCount, format, size, size);
+        }
+        for (int level = 0, levelSize = size; level < levelCount; level++, levelSize = std::max(1, levelSize / 2)) {
+            for (GLenum i = 0; i < 6; i++) {
+                const unsigned char* data = &levels[i][level][0];
+                GLsizei bytes = (GLsizei)LevelBytes(levelSize, compress);
+                if (immutable && compress) {
+                    glCompressedTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, levelSize, levelSize, format, bytes, data);
+                }
+                else if (immutable) {
+                    glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, levelSize, levelSize, GL_RGB, GL_UNSIGNED_BYTE, data);
+                }
+                else if (compress) {
+                    glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, format, levelSize, levelSize, 0, bytes, data);
+                }
+                else {
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, format, levelSize, levelSize, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+                }
+                // drivers usually pad RGB texels to 4 bytes
+                renderStats.textureBytes += compress ? (size_t)bytes : (size_t)levelSize * levelSize * 4;
             }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
         }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
         glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-        
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Sky box : %dx%d faces, %d levels, %s%s in %.0f ms\n", size, size, levelCount, compress ? "DXT1" : "RGB8",
+            cached ? " from the cache" : "", milliseconds);
         return textureID;
     }
+
+    bool SkyBox::ReadFaceCache(const std::string& fileName, std::vector<std::vector<unsigned char> > levels[6], int& size)
+    {
+        FILE* file = fopen(fileName.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        uint32_t header[3];
+        bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == FACE_CACHE_MAGIC && header[1] == FACE_CACHE_VERSION &&
+            header[2] > 0 && header[2] <= 16384;
+        size = valid ? (int)header[2] : 0;
+        for (int level = 0, levelSize = size; valid && level < MipCount(size); level++, levelSize = std::max(1, levelSize / 2)) {
+            for (int i = 0; valid && i < 6; i++) {
+                levels[i].push_back(std::vector<unsigned char>(LevelBytes(levelSize, true)));
+                valid = fread(&levels[i].back()[0], 1, levels[i].back().size(), file) == levels[i].back().size();
+            }
+        }
+        fclose(file);
+        if (!valid) {
+            for (int i = 0; i < 6; i++) {
+                levels[i].clear();
+            }
+        }
+        return valid;
+    }
+
+    void SkyBox::WriteFaceCache(const std::string& cacheDirectory, const std::string& fileName, std::vector<std::vector<unsigned char> > levels[6], int size)
+    {
+        FILE* file = AssetCache::Create(cacheDirectory, fileName);
+        if (!file) {
+            return;
+        }
+        uint32_t header[3] = { FACE_CACHE_MAGIC, FACE_CACHE_VERSION, (uint32_t)size };
+        fwrite(header, sizeof(header), 1, file);
+        for (size_t level = 0; level < levels[0].size(); level++) {
+            for (int i = 0; i < 6; i++) {
+                fwrite(&levels[i][level][0], 1, levels[i][level].size(), file);
+            }
+        }
+        fclose(file);
+    }
     
     void SkyBox::InitSkyBox()
     {
@@ -127,6 +430,7 @@ namespace gps {
         glBindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+        renderStats.bufferBytes += sizeof(skyboxVertices);
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
@@ -138,4 +442,339 @@ namespace gps {
     {
         return cubemapTexture;
     }
+
+    // GL's cube map layout - u, v in [-1, 1] across face, v grows down the rows as the files store them
+    static glm::vec3 FaceDirection(int face, float u, float v)
+    {
+        switch (face) {
+        case 0: return glm::vec3(1.0f, -v, -u);
+        case 1: return glm::vec3(-1.0f, -v, u);
+        case 2: return glm::vec3(u, 1.0f, v);
+        case 3: return glm::vec3(u, -1.0f, -v);
+        case 4: return glm::vec3(u, -v, 1.0f);
+        default: return glm::vec3(-u, -v, -1.0f);
+        }
+    }
+
+    // the face a direction leaves the cube through and where - the inverse of FaceDirection
+    static int DirectionFace(glm::vec3 d, float& u, float& v)
+    {
+        glm::vec3 a = glm::abs(d);
+        if (a.x >= a.y && a.x >= a.z) {
+            v = -d.y / a.x;
+            u = d.x > 0.0f ? -d.z / a.x : d.z / a.x;
+            return d.x > 0.0f ? 0 : 1;
+        }
+        if (a.y >= a.z) {
+            u = d.x / a.y;
+            v = d.y > 0.0f ? d.z / a.y : -d.z / a.y;
+            return d.y > 0.0f ? 2 : 3;
+        }
+        v = -d.y / a.z;
+        u = d.z > 0.0f ? d.x / a.z : -d.x / a.z;
+        return d.z > 0.0f ? 4 : 5;
+    }
+
+    // One level of a cube, face after face and row after row
+    struct CubeLevel {
+
+        int size;
+        std::vector<glm::vec3> texels;
+    };
+
+    // bilinear within the face the direction falls on, clamped at its edges
+    static glm::vec3 SampleLevel(const CubeLevel& level, glm::vec3 direction)
+    {
+        float u, v;
+        int face = DirectionFace(direction, u, v);
+        float x = std::min(std::max((u * 0.5f + 0.5f) * level.size - 0.5f, 0.0f), level.size - 1.0f);
+        float y = std::min(std::max((v * 0.5f + 0.5f) * level.size - 0.5f, 0.0f), level.size - 1.0f);
+        int x0 = (int)x;
+        int y0 = (int)y;
+        int x1 = std::min(x0 + 1, level.size - 1);
+        int y1 = std::min(y0 + 1, level.size - 1);
+        float fx = x - x0;
+        float fy = y - y0;
+        const glm::vec3* texels = &level.texels[(size_t)face * level.size * level.size];
+        glm::vec3 top = texels[y0 * level.size + x0] * (1.0f - fx) + texels[y0 * level.size + x1] * fx;
+        glm::vec3 bottom = texels[y1 * level.size + x0] * (1.0f - fx) + texels[y1 * level.size + x1] * fx;
+        return top * (1.0f - fy) + bottom * fy;
+    }
+
+    // solid angle of a texel centred at u, v on a face size texels wide
+    static float TexelSolidAngle(float u, float v, int size)
+    {
+        float texel = 2.0f / size;
+        float distance2 = 1.0f + u * u + v * v;
+        return texel * texel / (distance2 * std::sqrt(distance2));
+    }
+
+    // real L2 spherical harmonics, in the order basic.frag evaluates them
+    static void EvaluateBasis(glm::vec3 n, float basis[SkyBox::IRRADIANCE_COEFFICIENTS])
+    {
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * n.y;
+        basis[2] = 0.488603f * n.z;
+        basis[3] = 0.488603f * n.x;
+        basis[4] = 1.092548f * n.x * n.y;
+        basis[5] = 1.092548f * n.y * n.z;
+        basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+        basis[7] = 1.092548f * n.x * n.z;
+        basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+    }
+
+    static float RadicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return bits * (1.0f / 4294967296.0f);
+    }
+
+    void SkyBox::ComputeEnvironment(std::string cacheDirectory)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // the files themselves are the cache key, so an edited face is picked up under the same name
+        std::vector<std::vector<unsigned char> > files;
+        files.swap(faceFiles);
+        uint32_t settings[5] = { CACHE_VERSION, (uint32_t)ENVIRONMENT_SIZE, (uint32_t)ENVIRONMENT_LEVELS, (uint32_t)ENVIRONMENT_SAMPLES, (uint32_t)IRRADIANCE_SIZE };
+        uint64_t hash = AssetCache::Hash(settings, sizeof(settings));
+        bool valid = files.size() == 6;
+        for (size_t i = 0; i < files.size() && valid; i++) {
+            valid = !files[i].empty();
+            hash = valid ? AssetCache::Hash(&files[i][0], files[i].size(), hash) : hash;
+        }
+        if (!valid) {
+            fprintf(stderr, "WARNING: the sky's lighting needs six readable faces\n");
+            environmentDone = true;
+            return;
+        }
+        std::string fileName = AssetCache::FileName(cacheDirectory, "skybox", hash);
+        if (!cacheDirectory.empty() && ReadEnvironmentCache(fileName)) {
+            printf("Sky lighting : loaded %s\n", fileName.c_str());
+            environmentDone = true;
+            return;
+        }
+
+        // the sky's pyramid, box filtered down to a texel per face - the texels are lit as they are stored, like the textures
+        std::vector<CubeLevel> pyramid(1);
+        for (int face = 0; face < 6 && valid; face++) {
+            int width, height, n;
+            unsigned char* image = stbi_load_from_memory(&files[face][0], (int)files[face].size(), &width, &height, &n, 3);
+            valid = image != NULL && width == height && (face == 0 || width == pyramid[0].size);
+            if (valid) {
+                pyramid[0].size = width;
+                pyramid[0].texels.resize((size_t)6 * width * width);
+                glm::vec3* texels = &pyramid[0].texels[(size_t)face * width * width];
+                for (int i = 0; i < width * width; i++) {
+                    texels[i] = glm::vec3(image[i * 3], image[i * 3 + 1], image[i * 3 + 2]) / 255.0f;
+                }
+            }
+            stbi_image_free(image);
+        }
+        if (!valid) {
+            fprintf(stderr, "WARNING: the sky's faces must be square and of one size for its lighting\n");
+            environmentDone = true;
+            return;
+        }
+        std::vector<std::vector<unsigned char> >().swap(files);
+        while (pyramid.back().size > 1) {
+            const CubeLevel& source = pyramid.back();
+            CubeLevel level;
+            level.size = source.size / 2;
+            level.texels.resize((size_t)6 * level.size * level.size);
+            for (int face = 0; face < 6; face++) {
+                for (int y = 0; y < level.size; y++) {
+                    for (int x = 0; x < level.size; x++) {
+                        const glm::vec3* texel = &source.texels[((size_t)face * source.size + y * 2) * source.size + x * 2];
+                        level.texels[((size_t)face * level.size + y) * level.size + x] =
+                            (texel[0] + texel[1] + texel[source.size] + texel[source.size + 1]) * 0.25f;
+                    }
+                }
+            }
+            pyramid.push_back(level);
+        }
+
+        // irradiance - the radiance projected on the basis, weighted by each texel's solid angle, then convolved with
+        // the cosine lobe over pi, and scaled so the sky's mean luminance is 1
+        const float BAND_SCALES[IRRADIANCE_COEFFICIENTS] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        size_t irradianceLevel = 0;
+        while (pyramid[irradianceLevel].size > IRRADIANCE_SIZE) {
+            irradianceLevel++;
+        }
+        const CubeLevel& projected = pyramid[irradianceLevel];
+        glm::vec3 sums[IRRADIANCE_COEFFICIENTS] = {};
+        float totalSolidAngle = 0.0f;
+        for (int face = 0; face < 6; face++) {
+            for (int y = 0; y < projected.size; y++) {
+                for (int x = 0; x < projected.size; x++) {
+                    float u = (x + 0.5f) * 2.0f / projected.size - 1.0f;
+                    float v = (y + 0.5f) * 2.0f / projected.size - 1.0f;
+                    float solidAngle = TexelSolidAngle(u, v, projected.size);
+                    float basis[IRRADIANCE_COEFFICIENTS];
+                    EvaluateBasis(glm::normalize(FaceDirection(face, u, v)), basis);
+                    glm::vec3 radiance = projected.texels[((size_t)face * projected.size + y) * projected.size + x];
+                    for (int c = 0; c < IRRADIANCE_COEFFICIENTS; c++) {
+                        sums[c] += radiance * (basis[c] * solidAngle);
+                    }
+                    totalSolidAngle += solidAngle;
+                }
+            }
+        }
+        glm::vec3 meanRadiance = sums[0] / (0.282095f * totalSolidAngle);
+        float luminance = glm::dot(meanRadiance, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+        float scale = 4.0f * 3.14159265f / totalSolidAngle / std::max(luminance, 1e-4f);
+        for (int c = 0; c < IRRADIANCE_COEFFICIENTS; c++) {
+            irradiance[c] = sums[c] * (scale * BAND_SCALES[c]);
+        }
+
+        // specular - each texel is the Phong lobe of its level around its direction, importance sampled, each sample
+        // read from the pyramid level whose texels cover about the sample's share of the lobe
+        float sourceTexelAngle = 4.0f * 3.14159265f / (6.0f * pyramid[0].size * pyramid[0].size);
+        size_t levelCount = 0;
+        for (int level = 0; level < ENVIRONMENT_LEVELS; level++) {
+            int size = ENVIRONMENT_SIZE >> level;
+            levelCount += (size_t)6 * size * size;
+        }
+        environmentTexels.resize(levelCount);
+        glm::vec3* output = &environmentTexels[0];
+        for (int level = 0; level < ENVIRONMENT_LEVELS; level++) {
+            int size = ENVIRONMENT_SIZE >> level;
+            float exponent = ENVIRONMENT_EXPONENT / (float)(1 << (2 * level));
+            for (int face = 0; face < 6; face++) {
+                for (int y = 0; y < size; y++) {
+                    for (int x = 0; x < size; x++) {
+                        glm::vec3 normal = glm::normalize(FaceDirection(face, (x + 0.5f) * 2.0f / size - 1.0f, (y + 0.5f) * 2.0f / size - 1.0f));
+                        glm::vec3 tangent = glm::normalize(glm::cross(std::abs(normal.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), normal));
+                        glm::vec3 bitangent = glm::cross(normal, tangent);
+                        glm::vec3 sum(0.0f);
+                        for (int s = 0; s < ENVIRONMENT_SAMPLES; s++) {
+                            float cosine = std::pow((s + 0.5f) / ENVIRONMENT_SAMPLES, 1.0f / (exponent + 1.0f));
+                            float sine = std::sqrt(std::max(0.0f, 1.0f - cosine * cosine));
+                            float angle = 6.2831853f * RadicalInverse((uint32_t)s);
+                            glm::vec3 direction = tangent * (sine * std::cos(angle)) + bitangent * (sine * std::sin(angle)) + normal * cosine;
+                            float density = (exponent + 1.0f) / 6.2831853f * std::pow(cosine, exponent);
+                            float sampleAngle = 1.0f / (ENVIRONMENT_SAMPLES * std::max(density, 1e-6f));
+                            float lod = std::max(0.0f, 0.5f * std::log2(sampleAngle / sourceTexelAngle) + 1.0f);
+                            size_t source = std::min((size_t)(lod + 0.5f), pyramid.size() - 1);
+                            sum += SampleLevel(pyramid[source], direction);
+                        }
+                        *output++ = sum / (float)ENVIRONMENT_SAMPLES;
+                    }
+                }
+            }
+        }
+        environmentSize = ENVIRONMENT_SIZE;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Sky lighting : computed in %.1f s\n", seconds);
+        if (!cacheDirectory.empty()) {
+            WriteEnvironmentCache(cacheDirectory, fileName);
+        }
+        environmentDone = true;
+    }
+
+    bool SkyBox::ReadEnvironmentCache(const std::string& fileName)
+    {
+        FILE* file = fopen(fileName.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        uint32_t header[4];
+        bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == CACHE_MAGIC && header[1] == CACHE_VERSION &&
+            header[2] == (uint32_t)ENVIRONMENT_SIZE && header[3] == (uint32_t)ENVIRONMENT_LEVELS &&
+            fread(irradiance, sizeof(irradiance), 1, file) == 1;
+        if (valid) {
+            size_t levelCount = 0;
+            for (int level = 0; level < ENVIRONMENT_LEVELS; level++) {
+                int size = ENVIRONMENT_SIZE >> level;
+                levelCount += (size_t)6 * size * size;
+            }
+            environmentTexels.resize(levelCount);
+            valid = fread(&environmentTexels[0], sizeof(glm::vec3), levelCount, file) == levelCount;
+        }
+        fclose(file);
+        if (!valid) {
+            std::vector<glm::vec3>().swap(environmentTexels);
+            return false;
+        }
+        environmentSize = ENVIRONMENT_SIZE;
+        return true;
+    }
+
+    void SkyBox::WriteEnvironmentCache(const std::string& cacheDirectory, const std::string& fileName)
+    {
+        FILE* file = AssetCache::Create(cacheDirectory, fileName);
+        if (!file) {
+            return;
+        }
+        uint32_t header[4] = { CACHE_MAGIC, CACHE_VERSION, (uint32_t)ENVIRONMENT_SIZE, (uint32_t)ENVIRONMENT_LEVELS };
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(irradiance, sizeof(irradiance), 1, file);
+        fwrite(&environmentTexels[0], sizeof(glm::vec3), environmentTexels.size(), file);
+        fclose(file);
+    }
+
+    bool SkyBox::UpdateEnvironment(bool wait)
+    {
+        if (environmentTexture != 0) {
+            return true;
+        }
+        if (!environmentWorker.joinable() || (!wait && !environmentDone)) {
+            return false;
+        }
+        environmentWorker.join();
+        if (environmentSize == 0) {
+            return false;
+        }
+
+        glGenTextures(1, &environmentTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentTexture);
+        const glm::vec3* texels = &environmentTexels[0];
+        for (int level = 0; level < ENVIRONMENT_LEVELS; level++) {
+            int size = environmentSize >> level;
+            for (int face = 0; face < 6; face++) {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, texels);
+                texels += (size_t)size * size;
+                // drivers usually pad RGB16F texels to 8 bytes
+                renderStats.textureBytes += (size_t)size * size * 8;
+            }
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, ENVIRONMENT_LEVELS - 1);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        std::vector<glm::vec3>().swap(environmentTexels);
+        return true;
+    }
+
+    void SkyBox::BindEnvironment(GLuint unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentTexture);
+        renderStats.textureBinds++;
+    }
+
+    const glm::vec3* SkyBox::GetIrradiance()
+    {
+        return irradiance;
+    }
+
+    void SkyBox::Delete()
+    {
+        if (environmentWorker.joinable()) {
+            environmentWorker.join();
+        }
+        if (environmentTexture != 0) {
+            glDeleteTextures(1, &environmentTexture);
+            environmentTexture = 0;
+        }
+    }
 }
@@ -16,6 +16,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <atomic>
+#include <string>
+#include <thread>
 #include <vector>
 #include <stdio.h>
 
@@ -23,16 +26,53 @@ namespace gps {
     class SkyBox
     {
     public:
+        // mip levels of the prefiltered specular cube - level l is blurred by a Phong lobe of exponent 1024 / 4^l
+        static const int ENVIRONMENT_LEVELS = 6;
+        static const int IRRADIANCE_COEFFICIENTS = 9;
+
         SkyBox();
-        void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // Also starts computing the sky's image based lighting on a worker thread, see UpdateEnvironment - read back from
+        // cacheDirectory when it holds it for these six faces, stored there otherwise; empty disables the cache
+        // compress - DXT1 faces where the driver has S3TC, kept in the cache directory as well
+        void Load(std::vector<const GLchar*> cubeMapFaces, const std::string& cacheDirectory = "", bool compress = false);
+        void Draw(gps::Shader& shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
         GLuint GetTextureId();
+
+        // Uploads the image based lighting once its worker is done, waiting for it when wait is set - true when it is available
+        bool UpdateEnvironment(bool wait = false);
+        // the prefiltered specular cube
+        void BindEnvironment(GLuint unit);
+        // L2 spherical harmonics of the sky's irradiance over pi, scaled so the sky's mean brightness gives 1 -
+        // the shader keeps its ambient strength and the sky adds direction and colour
+        const glm::vec3* GetIrradiance();
+
+        void Delete();
+
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        // 0 when a face is missing or the faces do not make a cube
+        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces, const std::string& cacheDirectory, bool compress);
+        // the compressed mip chains, level after level and face after face
+        bool ReadFaceCache(const std::string& fileName, std::vector<std::vector<unsigned char> > levels[6], int& size);
+        void WriteFaceCache(const std::string& cacheDirectory, const std::string& fileName, std::vector<std::vector<unsigned char> > levels[6], int size);
         void InitSkyBox();
+
+        // the face files as read by LoadSkyBoxTextures, handed on to the environment worker which frees them
+        std::vector<std::vector<unsigned char> > faceFiles;
+        std::thread environmentWorker;
+        // set by the worker when it is done, whether it succeeded or not
+        std::atomic<bool> environmentDone{ false };
+        glm::vec3 irradiance[IRRADIANCE_COEFFICIENTS];
+        int environmentSize = 0;
+        // the specular cube's texels, level after level and face after face - freed once uploaded
+        std::vector<glm::vec3> environmentTexels;
+        GLuint environmentTexture = 0;
+
+        void ComputeEnvironment(std::string cacheDirectory);
+        bool ReadEnvironmentCache(const std::string& fileName);
+        void WriteEnvironmentCache(const std::string& cacheDirectory, const std::string& fileName);
     };
 }
 
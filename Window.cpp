@@ -1,5 +1,9 @@
 #include "Window.h"
 
+#if defined (__linux__)
+    #include <EGL/eglext.h>
+#endif
+
 namespace gps {
 
     void Window::Create(int width, int height, const char *title) {
@@ -31,8 +35,94 @@ namespace gps {
 
         glfwSwapInterval(1);
 
+        InitGL();
+
+        //for RETINA display
+        glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
+    }
+
+    void Window::CreateHeadless(int width, int height) {
+        this->headless = true;
+        this->dimensions.width = width;
+        this->dimensions.height = height;
+
+#if defined (__linux__)
+        if (!CreateEGLContext())
+#endif
+        {
+            // no EGL - fall back to a hidden GLFW window, vsync off
+            if (!glfwInit()) {
+                throw std::runtime_error("Could not start GLFW3!");
+            }
+
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+            this->window = glfwCreateWindow(width, height, "OpenGL Project (headless)", NULL, NULL);
+            if (!this->window) {
+                throw std::runtime_error("Could not create a headless OpenGL context!");
+            }
+
+            glfwMakeContextCurrent(window);
+            glfwSwapInterval(0);
+        }
+
+        InitGL();
+        CreateOffscreenFramebuffer();
+    }
+
+#if defined (__linux__)
+    // Surfaceless EGL context - needs no display server and no GPU (Mesa llvmpipe)
+    bool Window::CreateEGLContext() {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (!getPlatformDisplay) {
+            return false;
+        }
+
+        this->eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (this->eglDisplay == EGL_NO_DISPLAY || !eglInitialize(this->eglDisplay, NULL, NULL)) {
+            return false;
+        }
+
+        eglBindAPI(EGL_OPENGL_API);
+
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(this->eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0) {
+            eglTerminate(this->eglDisplay);
+            return false;
+        }
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 1,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        this->eglContext = eglCreateContext(this->eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+        if (this->eglContext == EGL_NO_CONTEXT) {
+            eglTerminate(this->eglDisplay);
+            return false;
+        }
+
+        // no surface at all - everything is drawn into the offscreen framebuffer
+        return eglMakeCurrent(this->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, this->eglContext) == EGL_TRUE;
+    }
+#endif
+
+    void Window::InitGL() {
 #if not defined (__APPLE__)
         // start GLEW extension handler
+        // (with an EGL context glewInit may report a missing GLX display, the GL entry points are loaded regardless)
         glewExperimental = GL_TRUE;
         glewInit();
 #endif
@@ -42,18 +132,120 @@ namespace gps {
         const GLubyte* version = glGetString(GL_VERSION); // version as a string
         std::cout << "Renderer: " << renderer << std::endl;
         std::cout << "OpenGL version: " << version << std::endl;
+    }
 
-        //for RETINA display
-        glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
+    // Color and depth render targets standing in for the window's default framebuffer
+    void Window::CreateOffscreenFramebuffer() {
+        glGenRenderbuffers(1, &this->offscreenColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->offscreenColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, this->dimensions.width, this->dimensions.height);
+
+        glGenRenderbuffers(1, &this->offscreenDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->offscreenDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, this->dimensions.width, this->dimensions.height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &this->offscreenFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->offscreenFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->offscreenColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->offscreenDepth);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Could not create the offscreen framebuffer!");
+        }
+        // stays bound - the renderer draws into it as if it were the window
     }
 
     void Window::Delete() {
+        for (GLsync fence : frameFences) {
+            glDeleteSync(fence);
+        }
+        frameFences.clear();
+        if (offscreenFBO) {
+            glDeleteFramebuffers(1, &offscreenFBO);
+            glDeleteRenderbuffers(1, &offscreenColor);
+            glDeleteRenderbuffers(1, &offscreenDepth);
+        }
+#if defined (__linux__)
+        if (eglContext != EGL_NO_CONTEXT) {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+            return;
+        }
+#endif
         if (window)
             glfwDestroyWindow(window);
         //close GL context and any other GLFW resources
         glfwTerminate();
     }
 
+    bool Window::ShouldClose() {
+        if (headless)
+            return closeRequested;
+        return glfwWindowShouldClose(window);
+    }
+
+    void Window::SetShouldClose(bool close) {
+        closeRequested = close;
+        if (window)
+            glfwSetWindowShouldClose(window, close);
+    }
+
+    void Window::SwapBuffers() {
+        if (headless) {
+            // nothing to present - just make sure the frame is submitted
+            glFlush();
+        }
+        else {
+            glfwSwapBuffers(window);
+        }
+
+        if (maxFramesInFlight <= 0)
+            return;
+
+        // wait until the GPU is at most maxFramesInFlight frames behind, which bounds the input latency
+        frameFences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+        while ((int)frameFences.size() > maxFramesInFlight) {
+            glClientWaitSync(frameFences.front(), GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync(frameFences.front());
+            frameFences.pop_front();
+        }
+    }
+
+    void Window::SetVSync(VSYNC_MODE mode) {
+        if (headless)
+            return;
+
+        int interval = (mode == VSYNC_OFF) ? 0 : 1;
+        if (mode == VSYNC_ADAPTIVE) {
+            if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+                interval = -1;
+            }
+            else {
+                std::cout << "Adaptive vsync not supported, using vsync" << std::endl;
+            }
+        }
+        glfwSwapInterval(interval);
+    }
+
+    void Window::SetMaxFramesInFlight(int frames) {
+        this->maxFramesInFlight = frames;
+    }
+
+    void Window::PollEvents() {
+        if (!headless)
+            glfwPollEvents();
+    }
+
+    bool Window::isHeadless() {
+        return this->headless;
+    }
+
+    GLuint Window::getFramebuffer() {
+        return this->offscreenFBO;
+    }
+
     GLFWwindow* Window::getWindow() {
         return this->window;
     }
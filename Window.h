@@ -11,8 +11,13 @@
 
 #include <GLFW/glfw3.h>
 
+#if defined (__linux__)
+    #include <EGL/egl.h>
+#endif
+
 #include <stdexcept>
 #include <iostream>
+#include <deque>
 
 struct WindowDimensions {
     int width;
@@ -21,19 +26,59 @@ struct WindowDimensions {
 
 namespace gps {
 
+    // ADAPTIVE syncs when the frame is on time and tears instead of waiting a whole vblank when it is late
+    enum VSYNC_MODE { VSYNC_OFF, VSYNC_ON, VSYNC_ADAPTIVE };
+
     class Window {
 
     public:
         void Create(int width=800, int height=600, const char *title="OpenGL Project");
+        // No visible window and no vsync - the scene is rendered into an offscreen framebuffer
+        // Uses an EGL surfaceless context on Linux (works with Mesa llvmpipe), a hidden GLFW window elsewhere
+        void CreateHeadless(int width=800, int height=600);
         void Delete();
 
+        // Replacements for the glfw calls that need a window, so the render loop works in both modes
+        bool ShouldClose();
+        void SetShouldClose(bool close);
+        // Presents the frame - called exactly once per frame
+        void SwapBuffers();
+        void PollEvents();
+
+        // Swap interval of the on-screen window, ignored when headless
+        void SetVSync(VSYNC_MODE mode);
+        // Frames the CPU may run ahead of the GPU before SwapBuffers waits on a fence - 0 leaves it to the driver
+        void SetMaxFramesInFlight(int frames);
+
+        bool isHeadless();
+        // Framebuffer the scene ends up in - 0 for the on-screen window, the offscreen one when headless
+        GLuint getFramebuffer();
+
         GLFWwindow* getWindow();
         WindowDimensions getWindowDimensions();
         void setWindowDimensions(WindowDimensions dimensions);
 
     private:
         WindowDimensions dimensions;
-        GLFWwindow *window;
+        GLFWwindow *window = NULL;
+
+        bool headless = false;
+        bool closeRequested = false;
+        GLuint offscreenFBO = 0;
+        GLuint offscreenColor = 0;
+        GLuint offscreenDepth = 0;
+
+        int maxFramesInFlight = 2;
+        std::deque<GLsync> frameFences;
+
+#if defined (__linux__)
+        EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+        EGLContext eglContext = EGL_NO_CONTEXT;
+
+        bool CreateEGLContext();
+#endif
+        void InitGL();
+        void CreateOffscreenFramebuffer();
     };
 }
 
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -13,9 +16,46 @@
 #include "SkyBox.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "Culling.hpp"
+#include "RenderStats.hpp"
+#include "CameraPath.hpp"
+#include "Benchmark.hpp"
+#include "GpuProfiler.hpp"
+#include "CpuProfiler.hpp"
+#include "Overlay.hpp"
+#include "ShaderWatcher.hpp"
+#include "LightClusters.hpp"
+#include "DeferredRenderer.hpp"
+#include "CascadedShadowMap.hpp"
+#include "PointShadowAtlas.hpp"
+#include "Lightmap.hpp"
+#include "LightProbeGrid.hpp"
+#include "OcclusionBoxes.hpp"
 
 // window
 gps::Window myWindow;
+GLboolean headlessMode = false;
+GLint headlessFrameLimit = 730;
+gps::VSYNC_MODE vsyncMode = gps::VSYNC_ON;
+GLint maxFramesInFlight = 2;
+
+// benchmark - replays the cinematic uncapped, one simulation step per frame
+GLboolean benchmarkMode = false;
+std::string benchmarkOutput = "benchmark";
+gps::Benchmark benchmark;
+
+// gpu profiler - per pass timings, T toggles it, --gpu-profile FILE records from the start and writes a trace
+gps::GpuProfiler gpuProfiler;
+std::string gpuTraceFile;
+
+// cpu profiler - zones compiled in with GPS_ENABLE_PROFILING, --cpu-profile FILE records them and writes a trace
+std::string cpuTraceFile;
+
+// performance overlay - O toggles it, --overlay shows it from the start; headless runs never draw it, --overlay
+// prints its counters every OVERLAY_PRINT_INTERVAL frames instead
+gps::Overlay overlay;
+GLboolean overlayOnStart = false;
+const GLint OVERLAY_PRINT_INTERVAL = 60;
 
 // matrices
 glm::mat4 model;
@@ -27,27 +67,82 @@ glm::mat3 normalMatrix;
 // light parameters
 glm::vec3 lightDir;
 glm::vec3 lightColor;
-glm::vec3 lightPos;
-
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
-GLint lightPosLoc;
-GLint lightPosLoc2;
-GLint lampOnLoc;
-GLint lampOnLoc2;
-GLint sunOnLoc;
-GLint isShinyLoc;
+glm::vec3 lampPositions[2];
+
+// per-frame uniform block - matrices and lights transformed to eye space once per frame
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 lightDirEye;
+    glm::vec4 lightColor;
+    glm::vec4 clusterScale;
+    glm::ivec4 clusterGrid;
+    glm::mat4 shadowMatrices[gps::CascadedShadowMap::CASCADES];
+    glm::vec4 cascadeSplits;
+    glm::vec4 shadowTexelSizes;
+};
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+FrameUniforms frameUniforms;
+GLuint frameUniformBuffer;
+
+// point lights - the two lamps plus --lights N street lights, shaded through clusters
+const GLfloat LAMP_RANGE = 180.0f;
+const GLfloat STREET_LIGHT_RANGE = 30.0f;
+const GLuint LIGHT_CLUSTER_UNIT = 8;
+std::vector<gps::PointLight> pointLights;
+gps::LightClusters lightClusters;
+GLint streetLightCount = 0;
+
+// deferred shading - G toggles it against the forward path, --deferred starts with it
+gps::DeferredRenderer deferredRenderer;
+GLboolean deferredOn = false;
+
+// sun shadows - H toggles them, --no-shadows starts without
+const int SHADOW_MAP_SIZE = 1024;
+const GLfloat SHADOW_DISTANCE = 500.0f;
+const GLuint SHADOW_MAP_UNIT = 11;
+gps::CascadedShadowMap shadowMaps;
+// holds every shadow caster, for the near plane of the cascades
+gps::BoundingSphere sceneBounds;
+// the sphere swept by the windmill's blades - the only caster redrawn every frame
+gps::BoundingSphere windmillBounds;
+GLboolean shadowsOn = true;
+
+// point light shadows - a distance cube per lamp, for the lamps closest to the camera; H toggles them with the sun's
+const int POINT_SHADOW_MAP_SIZE = 256;
+const GLuint POINT_SHADOW_MAP_UNIT = 12;
+gps::PointShadowAtlas pointShadowAtlas;
+
+// baked lighting - static_scene's sun and lamps path traced into a lightmap at startup, or read back from the asset cache;
+// B toggles it with the light probes and the sky's lighting, --no-lightmap starts without, --rebake-lightmap ignores the cache
+const int LIGHTMAP_SIZE = 1024;
+const GLuint LIGHTMAP_UNIT = 13;
+// the scene's two lamps lead pointLights and are baked, the shader leaves them to the lightmap
+const int LIGHTMAP_BAKED_LIGHTS = 2;
+gps::Lightmap lightmap;
+// the windmill moves, so it takes the same sky and bounce light from probes baked alongside, a probe every 16 units
+const float LIGHT_PROBE_SPACING = 16.0f;
+const GLuint LIGHT_PROBE_UNIT = 14;
+gps::LightProbeGrid lightProbes;
+// the shiny objects and the lamps take their ambient and reflections from the sky's image based lighting, see SkyBox
+const GLuint ENVIRONMENT_UNIT = 15;
+GLboolean lightmapOn = true;
+GLboolean lightmapRebake = false;
+std::string assetCacheDirectory = "asset_cache";
+
+// depth pre-pass - E toggles it, --depth-prepass starts with it; opaque meshes are shaded with GL_EQUAL afterwards
+GLboolean depthPrepassOn = false;
+// with the pre-pass, groups of meshlets are tested against its depth and the hidden ones skipped by the GPU
+// Q toggles it, --occlusion-culling starts with it - off by default, the open scene hides too little to pay for the boxes
+GLboolean occlusionCullingOn = false;
+gps::OcclusionBoxes occlusionBoxes;
 
 // boolean
 GLboolean lampOn = false;
 GLboolean lampOn2 = false;
 GLboolean sunOn = false;
 GLboolean startAnimation = true;
+GLboolean meshletCullingOn = true;
 
 // models
 gps::Model3D static_scene;
@@ -63,10 +158,34 @@ gps::Camera myCamera(
     glm::vec3(40.0f, 10.0f, -30.0f),
     glm::vec3(0.0f, 1.0f, 0.0f));
 
-GLfloat cameraSpeed = 1.0f;
+// camera used for drawing - the simulated camera interpolated between the last two steps
+gps::Camera renderCamera = myCamera;
+
+GLfloat cameraSpeed = 60.0f; // units per second
+GLfloat windmillSpeed = 60.0f; // degrees per second
 GLfloat windmillRotFactor = 1.0f;
+GLfloat windmillRenderAngle = 1.0f;
 GLfloat angle = 0.0f;
-GLint frame = 0;
+// time the simulation advances this frame - the fixed step in benchmark runs
+GLfloat deltaTime = 0.0f;
+// measured wall clock time since the last frame, what the overlay shows
+GLfloat frameTime = 0.0f;
+std::chrono::steady_clock::time_point lastFrame;
+GLfloat frameCinematicTime = 0.0f;
+
+// fixed timestep simulation - the frame time is consumed in SIMULATION_STEP updates,
+// the remainder interpolates between the previous and the current state when drawing
+const GLfloat SIMULATION_STEP = 1.0f / 60.0f;
+// longest frame time simulated at once, so a stall cannot trigger an endless catch-up
+const GLfloat MAX_FRAME_TIME = 0.25f;
+GLfloat simulationAccumulator = 0.0f;
+glm::vec3 previousCameraPosition;
+glm::vec3 previousCameraTarget;
+GLfloat previousWindmillRotFactor = 1.0f;
+
+// startup cinematic
+gps::CameraPath cinematicPath;
+GLfloat cinematicTime = 0.0f;
 
 GLboolean pressedKeys[1024];
 GLfloat lastX = 400, lastY = 300;
@@ -75,12 +194,27 @@ GLboolean firstMouse = true;
 GLboolean isMouseGrabbed = false;
 
 // shaders
-gps::Shader myBasicShader;
+// basic.vert/frag specialised per light setup, see basicShader()
+gps::ShaderPermutations basicShaders;
 gps::Shader skyboxShader;
-
-// skybox
+// position only, for the depth pre-pass and the shadow maps
+gps::Shader depthShader;
+gps::Shader shadowShader;
+// shadow casters with cutout texels, alpha tested from the full vertex stream
+gps::Shader shadowCutoutShader;
+// point light cube faces, writing the distance to the light
+gps::Shader pointShadowShader;
+gps::Shader pointShadowCutoutShader;
+
+// shader hot reload - edited sources are rebuilt between frames, R forces it
+gps::ShaderWatcher shaderWatcher;
+GLboolean shaderReloadRequested = false;
+GLboolean shaderWatchOn = true;
+
+// skybox - its faces are DXT1 compressed and kept in the asset cache, --no-skybox-compression uploads them as RGB8
 std::vector<const GLchar*> faces;
 gps::SkyBox mySkyBox;
+GLboolean skyboxCompressionOn = true;
 
 GLenum glCheckError_(const char* file, int line) {
     GLenum errorCode;
@@ -111,43 +245,94 @@ GLenum glCheckError_(const char* file, int line) {
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
 // windmill rotation
-glm::mat4 windmill_anim() {
+glm::mat4 windmill_anim(GLfloat rotation) {
     windmillModel = glm::mat4(1.0f);
     windmillModel = glm::translate(windmillModel, glm::vec3(207.92f, 32.116f, 361.69f));
-    windmillModel = glm::rotate(windmillModel, glm::radians(windmillRotFactor), glm::vec3(1.0f, 0.0f, 0.0f));
-    windmillRotFactor += 1.0f;
+    windmillModel = glm::rotate(windmillModel, glm::radians(rotation), glm::vec3(1.0f, 0.0f, 0.0f));
     return windmillModel;
 }
 
+// upload the per-frame uniform block
+void updateFrameUniforms() {
+    frameUniforms.view = view;
+    frameUniforms.projection = projection;
+    frameUniforms.lightDirEye = glm::vec4(glm::normalize(glm::vec3(view * glm::vec4(lightDir, 0.0f))), 0.0f);
+    frameUniforms.lightColor = glm::vec4(lightColor, 1.0f);
+    frameUniforms.clusterScale = lightClusters.getClusterScale();
+    frameUniforms.clusterGrid = glm::ivec4(gps::LightClusters::TILES_X, gps::LightClusters::TILES_Y, gps::LightClusters::SLICES, (int)pointLights.size());
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frameUniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 // update view after camera movement
 void updateView() {
-    view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    GPS_PROFILE_ZONE("updateView");
+    view = renderCamera.getViewMatrix();
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    updateFrameUniforms();
 }
 
 // process camera movement
 void processCameraMovement() {
+    GPS_PROFILE_ZONE("processCameraMovement");
     if (pressedKeys[GLFW_KEY_W]) {
-        myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
+        myCamera.move(gps::MOVE_FORWARD, cameraSpeed * SIMULATION_STEP);
     }
     if (pressedKeys[GLFW_KEY_S]) {
-        myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
+        myCamera.move(gps::MOVE_BACKWARD, cameraSpeed * SIMULATION_STEP);
     }
     if (pressedKeys[GLFW_KEY_A]) {
-        myCamera.move(gps::MOVE_LEFT, cameraSpeed);
+        myCamera.move(gps::MOVE_LEFT, cameraSpeed * SIMULATION_STEP);
     }
     if (pressedKeys[GLFW_KEY_D]) {
-        myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
+        myCamera.move(gps::MOVE_RIGHT, cameraSpeed * SIMULATION_STEP);
     }
     if (pressedKeys[GLFW_KEY_Z]) {
-        myCamera.move(gps::MOVE_UP, cameraSpeed);
+        myCamera.move(gps::MOVE_UP, cameraSpeed * SIMULATION_STEP);
     }
     if (pressedKeys[GLFW_KEY_X]) {
-        myCamera.move(gps::MOVE_DOWN, cameraSpeed);
+        myCamera.move(gps::MOVE_DOWN, cameraSpeed * SIMULATION_STEP);
     }
+}
+
+// advance the simulation by one fixed step
+void updateSimulation() {
+    GPS_PROFILE_ZONE("updateSimulation");
+
+    previousCameraPosition = myCamera.getCameraPosition();
+    previousCameraTarget = myCamera.getCameraTarget();
+    previousWindmillRotFactor = windmillRotFactor;
+
+    // scene presentation
+    if (startAnimation == true) {
+        glm::vec3 cameraPosition;
+        glm::vec3 cameraTarget;
+        bool cut;
+        if (!cinematicPath.Sample(cinematicTime, cameraPosition, cameraTarget, cinematicTime - SIMULATION_STEP, &cut)) {
+            startAnimation = false;
+        }
+        myCamera.setCameraPosition(cameraPosition);
+        myCamera.setCameraTarget(cameraTarget);
+        // the frames up to the next step show the new shot, not a blend of the two
+        if (cut) {
+            previousCameraPosition = cameraPosition;
+            previousCameraTarget = cameraTarget;
+        }
+        cinematicTime += SIMULATION_STEP;
+    }
+    else {
+        processCameraMovement();
+    }
+
+    windmillRotFactor += windmillSpeed * SIMULATION_STEP;
+}
+
+// state drawn this frame, between the previous (alpha 0) and the current step (alpha 1)
+void interpolateRenderState(GLfloat alpha) {
+    renderCamera.setCameraPosition(glm::mix(previousCameraPosition, myCamera.getCameraPosition(), alpha));
+    renderCamera.setCameraTarget(glm::mix(previousCameraTarget, myCamera.getCameraTarget(), alpha));
+    windmillRenderAngle = glm::mix(previousWindmillRotFactor, windmillRotFactor, alpha);
     updateView();
 }
 
@@ -174,7 +359,8 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
         pitch += yoffset;
 
         myCamera.rotate(yaw, pitch);
-        updateView();
+        // looking around is not simulated, so the previous state turns with it and the mouse has no extra latency
+        previousCameraTarget = previousCameraPosition + (myCamera.getCameraTarget() - myCamera.getCameraPosition());
     }
 }
 
@@ -226,23 +412,67 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
     if (glfwGetKey(myWindow.getWindow(), GLFW_KEY_L)) {
         if (sunOn == true) sunOn = false;
         else sunOn = true;
-        glUniform1i(sunOnLoc, sunOn);
     }
     if (glfwGetKey(myWindow.getWindow(), GLFW_KEY_K)) {
         if (lampOn == true) lampOn = false;
         else lampOn = true;
-
-        glUniform1i(lampOnLoc, lampOn);
+    }
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        meshletCullingOn = !meshletCullingOn;
+        printf("Meshlet culling %s\n", meshletCullingOn ? "on" : "off");
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        overlay.setVisible(!overlay.isVisible());
+    }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        deferredOn = !deferredOn;
+        printf("%s shading\n", deferredOn ? "Deferred" : "Forward");
+    }
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        shadowsOn = !shadowsOn;
+        printf("Shadows %s\n", shadowsOn ? "on" : "off");
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        lightmapOn = !lightmapOn;
+        printf("Baked lighting %s\n", lightmapOn ? "on" : "off");
+    }
+    if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+        depthPrepassOn = !depthPrepassOn;
+        printf("Depth pre-pass %s\n", depthPrepassOn ? "on" : "off");
+    }
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+        occlusionCullingOn = !occlusionCullingOn;
+        printf("Occlusion culling %s\n", occlusionCullingOn ? "on" : "off");
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+        shaderReloadRequested = true;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        gpuProfiler.setEnabled(!gpuProfiler.isEnabled());
+        if (!gpuProfiler.isEnabled()) {
+            gpuProfiler.PrintSummary();
+        }
+        else {
+            printf("GPU profiler on\n");
+        }
     }
 }
 
 // initialize window
 void initOpenGLWindow() {
-    myWindow.Create(1024, 768, "OpenGL Project Core");
+    if (headlessMode) {
+        myWindow.CreateHeadless(1024, 768);
+    }
+    else {
+        myWindow.Create(1024, 768, "OpenGL Project Core");
+    }
 }
 
 // window callbacks
 void setWindowCallbacks() {
+    if (myWindow.isHeadless()) {
+        return;
+    }
     glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
     glfwSetKeyCallback(myWindow.getWindow(), keyboardCallback);
     glfwSetCursorPosCallback(myWindow.getWindow(), mouseCallback);
@@ -263,20 +493,172 @@ void initOpenGLState() {
 
 // initialize models
 void initModels() {
+    // the baker reads the static geometry on the CPU, see initBakedLighting
+    static_scene.SetLightmapSize(LIGHTMAP_SIZE);
+    static_scene.SetResidency(gps::KEEP_CPU_COPY);
+    lamp.SetResidency(gps::KEEP_CPU_COPY);
+    villageLamp.SetResidency(gps::KEEP_CPU_COPY);
+    shiny_scene.SetResidency(gps::KEEP_CPU_COPY);
     static_scene.LoadModel("models/static_scene/static_scene.obj");
     water.LoadModel("models/water/water.obj");
     lamp.LoadModel("models/lamp/lamp.obj");
     villageLamp.LoadModel("models/villageLamp/villageLamp.obj");
     windmill.LoadModel("models/windmill/windmill.obj");
     shiny_scene.LoadModel("models/shiny_scene/shiny_scene.obj");
+
+    // geometry now lives on the GPU, report what is left in host memory
+    static_scene.PrintMemoryReport();
+    water.PrintMemoryReport();
+    lamp.PrintMemoryReport();
+    villageLamp.PrintMemoryReport();
+    windmill.PrintMemoryReport();
+    shiny_scene.PrintMemoryReport();
+
+    // everything that casts a sun shadow - the windmill's blades sweep a sphere around their hub
+    windmillBounds = windmill.GetBounds();
+    windmillBounds.radius += glm::length(windmillBounds.center);
+    windmillBounds.center = glm::vec3(windmill_anim(0.0f) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    sceneBounds = gps::Merge(static_scene.GetBounds(), shiny_scene.GetBounds());
+    sceneBounds = gps::Merge(sceneBounds, lamp.GetBounds());
+    sceneBounds = gps::Merge(sceneBounds, villageLamp.GetBounds());
+    sceneBounds = gps::Merge(sceneBounds, windmillBounds);
+}
+
+// load the startup cinematic
+void initCinematic() {
+    if (!cinematicPath.Load("paths/cinematic.path")) {
+        startAnimation = false;
+    }
+}
+
+// first step interpolates from the starting state
+void initSimulation() {
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraTarget;
+    if (startAnimation && cinematicPath.Sample(0.0f, cameraPosition, cameraTarget)) {
+        myCamera.setCameraPosition(cameraPosition);
+        myCamera.setCameraTarget(cameraTarget);
+    }
+    previousCameraPosition = myCamera.getCameraPosition();
+    previousCameraTarget = myCamera.getCameraTarget();
+    previousWindmillRotFactor = windmillRotFactor;
+    simulationAccumulator = 0.0f;
+}
+
+// where a model's ambient light comes from - the lightmap for the static scene, the light probes for moving models,
+// the sky's image based lighting for the shiny objects and the lamps (the shiny objects sit on the town lamp)
+enum AmbientSource {
+    AMBIENT_CONSTANT,
+    AMBIENT_LIGHTMAP,
+    AMBIENT_PROBES,
+    AMBIENT_ENVIRONMENT
+};
+
+// variant key - lamps, highlights, shadows and the baked lighting only exist with the sun on, so the unlit passes all share one program
+unsigned basicShaderKey(bool sun, bool lamps, bool shiny, bool shadows, AmbientSource ambient) {
+    if (!sun) {
+        return 0;
+    }
+    const unsigned AMBIENT_BITS[4] = { 0u, 32u, 64u, 128u };
+    return 1u | (lamps ? 2u : 0u) | (shiny ? 4u : 0u) | (shadows ? 16u : 0u) | AMBIENT_BITS[ambient];
+}
+
+// one lit variant - initShaders compiles every one of them and initBasicShaderSamplers sets their samplers
+struct LitVariant {
+    bool lamps;
+    bool shiny;
+    bool shadows;
+    AmbientSource ambient;
+};
+
+// each lit variant once, for every combination of the toggles and ambient sources
+std::vector<LitVariant> litVariants() {
+    std::vector<LitVariant> variants;
+    for (int ambient = AMBIENT_CONSTANT; ambient <= AMBIENT_ENVIRONMENT; ambient++) {
+        for (unsigned toggles = 0; toggles < 8; toggles++) {
+            LitVariant variant = { (toggles & 1) != 0, (toggles & 2) != 0, (toggles & 4) != 0, (AmbientSource)ambient };
+            variants.push_back(variant);
+        }
+    }
+    return variants;
+}
+
+// G-buffer variant key - the lights are applied later, only the specular source differs
+unsigned gbufferShaderKey(bool shiny) {
+    return 8u | (shiny ? 4u : 0u);
+}
+
+// whether the ambient source is on and available - the constant ambient stands in otherwise
+bool ambientAvailable(AmbientSource ambient) {
+    switch (ambient) {
+    case AMBIENT_LIGHTMAP: return lightmapOn && lightmap.isLoaded();
+    case AMBIENT_PROBES: return lightmapOn && lightProbes.isLoaded();
+    case AMBIENT_ENVIRONMENT: return lightmapOn && mySkyBox.UpdateEnvironment();
+    default: return true;
+    }
+}
+
+// basic shader variant for the current light toggles and shading path - the deferred path only has the constant ambient
+gps::Shader& basicShader(bool shiny, AmbientSource ambient = AMBIENT_CONSTANT) {
+    if (deferredOn) {
+        return basicShaders.Get(gbufferShaderKey(shiny));
+    }
+    return basicShaders.Get(basicShaderKey(sunOn, lampOn, shiny, shadowsOn, ambientAvailable(ambient) ? ambient : AMBIENT_CONSTANT));
+}
+
+// point the lit variants at the light cluster buffer textures, the shadow cascades and the baked lighting
+void initBasicShaderSamplers() {
+    std::vector<LitVariant> variants = litVariants();
+    for (size_t i = 0; i < variants.size(); i++) {
+        bool lamps = variants[i].lamps, shadows = variants[i].shadows;
+        AmbientSource ambient = variants[i].ambient;
+        gps::Shader& shader = basicShaders.Get(basicShaderKey(true, lamps, variants[i].shiny, shadows, ambient));
+        shader.useShaderProgram();
+        if (lamps) {
+            glUniform1i(shader.getUniformLocation("pointLights"), LIGHT_CLUSTER_UNIT);
+            glUniform1i(shader.getUniformLocation("lightClusters"), LIGHT_CLUSTER_UNIT + 1);
+            glUniform1i(shader.getUniformLocation("lightIndices"), LIGHT_CLUSTER_UNIT + 2);
+        }
+        if (shadows) {
+            glUniform1i(shader.getUniformLocation("shadowMap"), SHADOW_MAP_UNIT);
+        }
+        if (lamps && shadows) {
+            glUniform1i(shader.getUniformLocation("pointShadowMap"), POINT_SHADOW_MAP_UNIT);
+        }
+        if (ambient == AMBIENT_LIGHTMAP) {
+            glUniform1i(shader.getUniformLocation("lightmap"), LIGHTMAP_UNIT);
+        }
+        if (lamps && ambient == AMBIENT_LIGHTMAP) {
+            glUniform1i(shader.getUniformLocation("bakedLights"), LIGHTMAP_BAKED_LIGHTS);
+        }
+        if (ambient == AMBIENT_PROBES) {
+            glUniform1i(shader.getUniformLocation("lightProbes"), LIGHT_PROBE_UNIT);
+        }
+        if (ambient == AMBIENT_ENVIRONMENT) {
+            glUniform1i(shader.getUniformLocation("environmentSpecular"), ENVIRONMENT_UNIT);
+        }
+    }
+}
+
+// single programs read the per-frame block from the same binding as the permutations
+void bindFrameUniforms(gps::Shader& shader) {
+    glUniformBlockBinding(shader.shaderProgram, glGetUniformBlockIndex(shader.shaderProgram, "FrameUniforms"), FRAME_UNIFORMS_BINDING);
 }
 
 // initialize shaders
 void initShaders() {
 
-    myBasicShader.loadShader(
-        "shaders/basic.vert",
-        "shaders/basic.frag");
+    basicShaders.Load("shaders/basic.vert", "shaders/basic.frag", { "SUN_ON", "LAMPS_ON", "SHINY", "GBUFFER", "SHADOWS", "LIGHTMAP", "PROBES", "ENVIRONMENT" });
+    basicShaders.BindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+    // compile every variant up front so toggling a light never waits on the compiler
+    basicShaders.Get(basicShaderKey(false, false, false, false, AMBIENT_CONSTANT));
+    std::vector<LitVariant> variants = litVariants();
+    for (size_t i = 0; i < variants.size(); i++) {
+        basicShaders.Get(basicShaderKey(true, variants[i].lamps, variants[i].shiny, variants[i].shadows, variants[i].ambient));
+    }
+    basicShaders.Get(gbufferShaderKey(false));
+    basicShaders.Get(gbufferShaderKey(true));
+    initBasicShaderSamplers();
 
     faces.push_back("skybox/right.tga");
     faces.push_back("skybox/left.tga");
@@ -287,250 +669,742 @@ void initShaders() {
 
     skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
     skyboxShader.useShaderProgram();
-    mySkyBox.Load(faces);
+    mySkyBox.Load(faces, assetCacheDirectory, skyboxCompressionOn);
+
+    depthShader.loadShader("shaders/depth.vert", "shaders/depth.frag");
+    bindFrameUniforms(depthShader);
+    shadowShader.loadShader("shaders/shadow.vert", "shaders/depth.frag");
+    shadowCutoutShader.loadShader("shaders/shadow.vert", "shaders/shadowCutout.frag", { "CUTOUT" });
+    pointShadowShader.loadShader("shaders/shadow.vert", "shaders/pointShadow.frag", { "POINT_LIGHT" });
+    pointShadowCutoutShader.loadShader("shaders/shadow.vert", "shaders/pointShadow.frag", { "POINT_LIGHT", "CUTOUT" });
+
+    if (shaderWatchOn) {
+        shaderWatcher.Watch("shaders/basic.vert");
+        shaderWatcher.Watch("shaders/basic.frag");
+        shaderWatcher.Watch("shaders/skyboxShader.vert");
+        shaderWatcher.Watch("shaders/skyboxShader.frag");
+        shaderWatcher.Watch("shaders/deferred.vert");
+        shaderWatcher.Watch("shaders/deferred.frag");
+        shaderWatcher.Watch("shaders/depth.vert");
+        shaderWatcher.Watch("shaders/depth.frag");
+        shaderWatcher.Watch("shaders/shadow.vert");
+        shaderWatcher.Watch("shaders/shadowCutout.frag");
+        shaderWatcher.Watch("shaders/pointShadow.frag");
+        shaderWatcher.Start();
+    }
+}
+
+// rebuild the programs whose sources changed, a program that fails to build keeps running unchanged
+void reloadShaders(const std::vector<std::string>& changedFiles, bool all) {
+    bool basicChanged = all, skyboxChanged = all, deferredChanged = all, depthChanged = all, shadowChanged = all, pointShadowChanged = all;
+    for (size_t i = 0; i < changedFiles.size(); i++) {
+        basicChanged = basicChanged || basicShaders.usesFile(changedFiles[i]);
+        skyboxChanged = skyboxChanged || skyboxShader.usesFile(changedFiles[i]);
+        deferredChanged = deferredChanged || deferredRenderer.usesFile(changedFiles[i]);
+        depthChanged = depthChanged || depthShader.usesFile(changedFiles[i]);
+        shadowChanged = shadowChanged || shadowShader.usesFile(changedFiles[i]) || shadowCutoutShader.usesFile(changedFiles[i]);
+        pointShadowChanged = pointShadowChanged || pointShadowShader.usesFile(changedFiles[i]) || pointShadowCutoutShader.usesFile(changedFiles[i]);
+    }
+
+    if (basicChanged && basicShaders.Reload()) {
+        initBasicShaderSamplers();
+        printf("Reloaded shaders/basic.vert/frag\n");
+    }
+    if (skyboxChanged && skyboxShader.reload()) {
+        printf("Reloaded shaders/skyboxShader.vert/frag\n");
+    }
+    if (deferredChanged && deferredRenderer.ReloadShaders()) {
+        printf("Reloaded shaders/deferred.vert/frag\n");
+    }
+    if (depthChanged && depthShader.reload()) {
+        bindFrameUniforms(depthShader);
+        printf("Reloaded shaders/depth.vert/frag\n");
+    }
+    if (shadowChanged && gps::Shader::reloadAll({ &shadowShader, &shadowCutoutShader })) {
+        printf("Reloaded shaders/shadow.vert, shadowCutout.frag\n");
+    }
+    if (pointShadowChanged && gps::Shader::reloadAll({ &pointShadowShader, &pointShadowCutoutShader })) {
+        printf("Reloaded shaders/shadow.vert, pointShadow.frag\n");
+    }
+}
+
+// the scene's two lamps, then the street lights - rows along the streets parallel to the main road (z = -70),
+// alternating sides, spread over the length of the village
+void initLights() {
+    const int STREETS = 5;
+    const GLfloat STREET_SPACING = 30.0f;
+    const GLfloat STREET_START = -120.0f, STREET_END = 200.0f;
+
+    pointLights.clear();
+    for (int i = 0; i < 2; i++) {
+        pointLights.push_back({ lampPositions[i], LAMP_RANGE, glm::vec3(1.0f, 1.0f, 1.0f), -1 });
+    }
+
+    int perStreet = (streetLightCount + STREETS - 1) / STREETS;
+    for (int i = 0; i < streetLightCount; i++) {
+        int street = i % STREETS;
+        int index = i / STREETS;
+        GLfloat x = STREET_START + (STREET_END - STREET_START) * (index + 0.5f) / perStreet;
+        GLfloat z = -70.0f + (street - STREETS / 2) * STREET_SPACING + ((index & 1) ? 6.0f : -6.0f);
+        pointLights.push_back({ glm::vec3(x, 12.0f, z), STREET_LIGHT_RANGE, glm::vec3(1.0f, 0.8f, 0.5f), -1 });
+    }
+    printf("Point lights: %d\n", (int)pointLights.size());
+}
+
+// bake static_scene's lightmap from the sun and the two lamps and the light probes around it, or load them from the asset
+// cache - the lamp models hold their own lights, so they only block the sun; the windmill moves and is left to the shadow map
+void initBakedLighting() {
+    std::vector<gps::BakeScene::Caster> casters;
+    casters.push_back({ &static_scene, model, false });
+    casters.push_back({ &shiny_scene, model, false });
+    casters.push_back({ &lamp, model, true });
+    casters.push_back({ &villageLamp, model, true });
+    std::vector<gps::PointLight> bakedLights(pointLights.begin(), pointLights.begin() + LIGHTMAP_BAKED_LIGHTS);
+    gps::BakeScene bakeScene(casters, lightDir, lightColor, bakedLights);
+    lightmap.LoadOrBake(assetCacheDirectory, lightmapRebake, bakeScene, static_scene, model, LIGHTMAP_SIZE);
+    lightProbes.LoadOrBake(assetCacheDirectory, lightmapRebake, bakeScene, LIGHT_PROBE_SPACING);
+
+    // nothing reads the geometry on the CPU anymore
+    static_scene.ReleaseCpuCopies();
+    lamp.ReleaseCpuCopies();
+    villageLamp.ReleaseCpuCopies();
+    shiny_scene.ReleaseCpuCopies();
 }
 
 // initialize uniform variables
 void initUniforms() {
-    myBasicShader.useShaderProgram();
-
     // create model matrix for static_scene
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-
-    // send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix for static_scene
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
     // create projection matrix
     projection = glm::perspective(glm::radians(45.0f),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
         0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+
+    lightClusters.Init();
+    lightClusters.SetProjection(projection, 0.1f, 1000.0f,
+        myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    deferredRenderer.Init(myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height, FRAME_UNIFORMS_BINDING, SHADOW_MAP_UNIT, POINT_SHADOW_MAP_UNIT);
+    shadowMaps.Init(SHADOW_MAP_SIZE);
 
     // set the light direction (direction towards the light)
     lightDir = glm::vec3(301.6f, 168.0f, -186.08f);
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    // send light dir to shader
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
     // set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); // white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    // boolean
-    isShinyLoc = glGetUniformLocation(myBasicShader.shaderProgram, "isShiny");
-
-    sunOnLoc = glGetUniformLocation(myBasicShader.shaderProgram, "sunOn");
-    lampOnLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lampOn");
 
     // town lamp
-    lightPos = glm::vec3(-82.21f, 12.47f, -58.23f);
-    lightPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightPosition");
-    glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
+    lampPositions[0] = glm::vec3(-82.21f, 12.47f, -58.23f);
 
     // village light
-    lightPos = glm::vec3(162.38f, 26.14f, -71.27f);
-    lightPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightPosition2");
-    glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
+    lampPositions[1] = glm::vec3(162.38f, 26.14f, -71.27f);
+
+    initLights();
+    deferredRenderer.SetLights(pointLights);
+    pointShadowAtlas.Init(POINT_SHADOW_MAP_SIZE, (int)pointLights.size());
+
+    // per-frame uniform block, sent by updateView
+    glGenBuffers(1, &frameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameUniformBuffer);
+    updateFrameUniforms();
+}
+
+// draw the selected meshes of a model, culling its meshlets against the current camera when enabled
+void drawMeshes(gps::Shader& shader, gps::Model3D& model3D, glm::mat4 modelMatrix, gps::MESH_SELECTION selection) {
+    if (meshletCullingOn) {
+        gps::CullingInfo culling = gps::MakeCullingInfo(projection, view * modelMatrix);
+        culling.occlusionCulling = depthPrepassOn && occlusionCullingOn;
+        model3D.Draw(shader, culling, selection);
+    }
+    else {
+        model3D.Draw(shader, selection);
+    }
+}
+
+// draw a model - after a depth pre-pass its opaque meshes only shade the fragments that won it
+void drawModel(gps::Shader& shader, gps::Model3D& model3D, glm::mat4 modelMatrix) {
+    if (!depthPrepassOn) {
+        drawMeshes(shader, model3D, modelMatrix, gps::ALL_MESHES);
+        return;
+    }
+
+    // cutout meshes were left out of the pre-pass, they test and write depth as usual
+    drawMeshes(shader, model3D, modelMatrix, gps::CUTOUT_MESHES);
+
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+    drawMeshes(shader, model3D, modelMatrix, gps::OPAQUE_MESHES);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+}
+
+// depth of a model's opaque meshes, same culling as drawModel so both passes see the same meshlets
+void drawModelDepth(gps::Model3D& model3D, glm::mat4 modelMatrix) {
+    glUniformMatrix4fv(depthShader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    if (meshletCullingOn) {
+        model3D.DrawDepth(gps::MakeCullingInfo(projection, view * modelMatrix));
+    }
+    else {
+        model3D.DrawDepth();
+    }
+}
+
+// test the meshlet groups of a model against the pre-pass depth - every mesh, the cutout ones are hidden by it too
+void queryModelOcclusion(gps::Model3D& model3D, glm::mat4 modelMatrix) {
+    model3D.QueryOcclusion(occlusionBoxes, modelMatrix, gps::MakeCullingInfo(projection, view * modelMatrix));
+}
+
+// lay down the depth of the opaque geometry with color writes off, so the shaded pass runs once per pixel
+void renderDepthPrepass() {
+
+    depthShader.useShaderProgram();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    windmillModel = windmill_anim(windmillRenderAngle);
+    drawModelDepth(windmill, windmillModel);
+    drawModelDepth(lamp, model);
+    drawModelDepth(villageLamp, model);
+    drawModelDepth(water, model);
+    drawModelDepth(static_scene, model);
+    drawModelDepth(shiny_scene, model);
+
+    // the results stay on the GPU - drawMeshes renders each group conditionally on its query
+    if (meshletCullingOn && occlusionCullingOn) {
+        occlusionBoxes.Begin(depthShader);
+        queryModelOcclusion(windmill, windmillModel);
+        queryModelOcclusion(lamp, model);
+        queryModelOcclusion(villageLamp, model);
+        queryModelOcclusion(water, model);
+        queryModelOcclusion(static_scene, model);
+        queryModelOcclusion(shiny_scene, model);
+        occlusionBoxes.End();
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// depth of a shadow caster, culled against the cascade's light volume - the opaque meshes from the position-only
+// stream (shadowShader), or the cutout meshes with their textures (shadowCutoutShader)
+void drawShadowCaster(gps::Shader& shader, bool cutout, gps::Model3D& model3D, glm::mat4 modelMatrix, glm::mat4 lightView, glm::mat4 lightProjection) {
+    glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    if (meshletCullingOn) {
+        gps::CullingInfo culling = gps::MakeShadowCullingInfo(lightProjection, lightView * modelMatrix);
+        if (cutout) {
+            model3D.Draw(shader, culling, gps::CUTOUT_MESHES);
+        }
+        else {
+            model3D.DrawDepth(culling);
+        }
+    }
+    else if (cutout) {
+        model3D.Draw(shader, gps::CUTOUT_MESHES);
+    }
+    else {
+        model3D.DrawDepth();
+    }
+}
+
+// the static or the dynamic shadow casters of a cascade - the water only receives, nothing is seen below it
+void drawShadowCasters(bool dynamic, glm::mat4 lightView, glm::mat4 lightProjection) {
+    for (int cutout = 0; cutout < 2; cutout++) {
+        gps::Shader& shader = cutout ? shadowCutoutShader : shadowShader;
+        shader.useShaderProgram();
+        glUniformMatrix4fv(shader.getUniformLocation("lightMatrix"), 1, GL_FALSE, glm::value_ptr(lightProjection * lightView));
+        if (dynamic) {
+            drawShadowCaster(shader, cutout, windmill, windmillModel, lightView, lightProjection);
+            continue;
+        }
+        drawShadowCaster(shader, cutout, lamp, model, lightView, lightProjection);
+        drawShadowCaster(shader, cutout, villageLamp, model, lightView, lightProjection);
+        drawShadowCaster(shader, cutout, static_scene, model, lightView, lightProjection);
+        drawShadowCaster(shader, cutout, shiny_scene, model, lightView, lightProjection);
+    }
+}
+
+// fit the sun's cascades to the camera, redraw the static casters of the cascades that moved into their cache,
+// then put the cache back under the windmill and draw the windmill alone
+void renderShadowMaps() {
+    GPS_PROFILE_ZONE("Shadow maps");
+    int width = myWindow.getWindowDimensions().width;
+    int height = myWindow.getWindowDimensions().height;
+    shadowMaps.Update(view, glm::radians(45.0f), (float)width / (float)height, 0.1f, SHADOW_DISTANCE, lightDir, sceneBounds);
+
+    // casters are drawn filled and from both sides - single-sided surfaces still block the light from behind
+    // the slope scaled offset keeps the lit surfaces from shadowing themselves
+    GLint polygonMode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 2.0f);
+
+    windmillModel = windmill_anim(windmillRenderAngle);
+    for (int i = 0; i < gps::CascadedShadowMap::CASCADES; i++) {
+        glm::mat4 lightView = shadowMaps.getLightView(i);
+        glm::mat4 lightProjection = shadowMaps.getLightProjection(i);
+        if (shadowMaps.needsStaticRedraw(i)) {
+            shadowMaps.BeginStatic(i);
+            drawShadowCasters(false, lightView, lightProjection);
+        }
+        if (shadowMaps.BeginDynamic(i, windmillBounds)) {
+            drawShadowCasters(true, lightView, lightProjection);
+        }
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_CULL_FACE);
+    glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+    glViewport(0, 0, width, height);
+
+    // lookups from this frame's eye space into the cascades
+    for (int i = 0; i < gps::CascadedShadowMap::CASCADES; i++) {
+        frameUniforms.shadowMatrices[i] = shadowMaps.getShadowMatrix(i, view);
+        frameUniforms.cascadeSplits[i] = shadowMaps.getSplit(i);
+        frameUniforms.shadowTexelSizes[i] = shadowMaps.getTexelSize(i);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, offsetof(FrameUniforms, shadowMatrices), sizeof(FrameUniforms) - offsetof(FrameUniforms, shadowMatrices),
+        &frameUniforms.shadowMatrices[0]);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    shadowMaps.Bind(SHADOW_MAP_UNIT);
+}
+
+// hand the shadow slots to the lamps closest to the camera and draw this frame's share of their cube faces -
+// only faces the windmill reaches are drawn again once a cube is complete
+// the lamp models hold their own lights, so they are left out of the casters
+void renderPointShadows() {
+    GPS_PROFILE_ZONE("Point shadows");
+    if (pointShadowAtlas.Update(pointLights, renderCamera.getCameraPosition(), windmillBounds)) {
+        deferredRenderer.SetLights(pointLights);
+    }
+
+    if (pointShadowAtlas.getFaceCount() > 0) {
+        // filled and from both sides as for the sun, the depth is written by the fragment shader so no offset
+        GLint polygonMode[2];
+        glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glDisable(GL_CULL_FACE);
+
+        windmillModel = windmill_anim(windmillRenderAngle);
+        for (int i = 0; i < pointShadowAtlas.getFaceCount(); i++) {
+            glm::mat4 lightView = pointShadowAtlas.getFaceView(i);
+            glm::mat4 lightProjection = pointShadowAtlas.getFaceProjection(i);
+            pointShadowAtlas.BeginFace(i);
+            for (int cutout = 0; cutout < 2; cutout++) {
+                gps::Shader& shader = cutout ? pointShadowCutoutShader : pointShadowShader;
+                shader.useShaderProgram();
+                glUniformMatrix4fv(shader.getUniformLocation("lightMatrix"), 1, GL_FALSE, glm::value_ptr(lightProjection * lightView));
+                glUniform4fv(shader.getUniformLocation("lightPositionRange"), 1, glm::value_ptr(pointShadowAtlas.getFaceLight(i)));
+                drawShadowCaster(shader, cutout, windmill, windmillModel, lightView, lightProjection);
+                drawShadowCaster(shader, cutout, static_scene, model, lightView, lightProjection);
+                drawShadowCaster(shader, cutout, shiny_scene, model, lightView, lightProjection);
+            }
+        }
+
+        glEnable(GL_CULL_FACE);
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+        glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+        int width = myWindow.getWindowDimensions().width;
+        int height = myWindow.getWindowDimensions().height;
+        glViewport(0, 0, width, height);
+    }
+    pointShadowAtlas.Bind(POINT_SHADOW_MAP_UNIT);
 }
 
 // render skybox
 void renderSkybox() {
 
-    skyboxShader.useShaderProgram();
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
-        glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE,
-        glm::value_ptr(projection));
+    view = renderCamera.getViewMatrix();
     mySkyBox.Draw(skyboxShader, view, projection);
 }
 
 // render static scene
 void renderStaticScene() {
 
-    myBasicShader.useShaderProgram();
-    glUniform1i(isShinyLoc, false);
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    gps::Shader& shader = basicShader(false, AMBIENT_LIGHTMAP);
+    shader.useShaderProgram();
+    if (ambientAvailable(AMBIENT_LIGHTMAP)) {
+        lightmap.Bind(LIGHTMAP_UNIT);
+    }
+    {
+        GPS_PROFILE_ZONE("Uniforms");
+        glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    }
 
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    drawModel(shader, static_scene, model);
+}
 
-    static_scene.Draw(myBasicShader);
+// the sky's lighting for a model drawn with AMBIENT_ENVIRONMENT
+void setEnvironmentUniforms(gps::Shader& shader) {
+    if (ambientAvailable(AMBIENT_ENVIRONMENT)) {
+        mySkyBox.BindEnvironment(ENVIRONMENT_UNIT);
+        glUniform3fv(shader.getUniformLocation("environmentIrradiance"), gps::SkyBox::IRRADIANCE_COEFFICIENTS, glm::value_ptr(mySkyBox.GetIrradiance()[0]));
+    }
 }
 
 // render shiny objects
 void renderShiny() {
 
-    myBasicShader.useShaderProgram();
-    glUniform1i(isShinyLoc, true);
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    gps::Shader& shader = basicShader(true, AMBIENT_ENVIRONMENT);
+    shader.useShaderProgram();
+    {
+        GPS_PROFILE_ZONE("Uniforms");
+        glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        setEnvironmentUniforms(shader);
+    }
 
-    shiny_scene.Draw(myBasicShader);
+    drawModel(shader, shiny_scene, model);
 }
 
 // render water
 void renderWater() {
 
-    myBasicShader.useShaderProgram();
-    glUniform1i(isShinyLoc, true);
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    gps::Shader& shader = basicShader(true);
+    shader.useShaderProgram();
+    {
+        GPS_PROFILE_ZONE("Uniforms");
+        glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    }
 
-    water.Draw(myBasicShader);
+    drawModel(shader, water, model);
 }
 
 // render town lamp
 void renderLamp() {
 
-    myBasicShader.useShaderProgram();
-    glUniform1i(isShinyLoc, true);
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    gps::Shader& shader = basicShader(true, AMBIENT_ENVIRONMENT);
+    shader.useShaderProgram();
+    {
+        GPS_PROFILE_ZONE("Uniforms");
+        glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        setEnvironmentUniforms(shader);
+    }
 
-    lamp.Draw(myBasicShader);
+    drawModel(shader, lamp, model);
 }
 
 // render village lamp
 void renderVillageLamp() {
 
-    myBasicShader.useShaderProgram();
-    glUniform1i(isShinyLoc, true);
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    gps::Shader& shader = basicShader(true, AMBIENT_ENVIRONMENT);
+    shader.useShaderProgram();
+    {
+        GPS_PROFILE_ZONE("Uniforms");
+        glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        setEnvironmentUniforms(shader);
+    }
 
-    villageLamp.Draw(myBasicShader);
+    drawModel(shader, villageLamp, model);
 }
 
 // render windmill wings
 void renderWindmill() {
 
-    myBasicShader.useShaderProgram();
-    windmillModel = windmill_anim();
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(windmillModel));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    gps::Shader& shader = basicShader(true, AMBIENT_PROBES);
+    shader.useShaderProgram();
+    windmillModel = windmill_anim(windmillRenderAngle);
+    {
+        GPS_PROFILE_ZONE("Uniforms");
+        glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(windmillModel));
+        glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        if (ambientAvailable(AMBIENT_PROBES)) {
+            lightProbes.Bind(LIGHT_PROBE_UNIT);
+            glUniform3fv(shader.getUniformLocation("lightProbesOrigin"), 1, glm::value_ptr(lightProbes.getOrigin()));
+            glUniform3fv(shader.getUniformLocation("lightProbesExtent"), 1, glm::value_ptr(lightProbes.getExtent()));
+        }
+    }
 
-    windmill.Draw(myBasicShader);
+    drawModel(shader, windmill, windmillModel);
 }
 
 // render scene
 void renderScene() {
+    GPS_PROFILE_ZONE("renderScene");
 
-    // scene presentation
-    if (startAnimation == true) {
-        frame++;
-        if (frame == 10) {
-            myCamera.setCameraPosition(glm::vec3(-60.0f, 10.0f, -70.0f));
-            myCamera.setCameraTarget(glm::vec3(-59.0f, 10.0f, -70.0f));
-        }
-        if (frame > 10 && frame <= 169) {
-            pressedKeys[GLFW_KEY_W] = true;
-        }
-        if (frame == 170) {
-            pressedKeys[GLFW_KEY_W] = false;
-        }
-        if (frame == 171) {
-            myCamera.setCameraPosition(glm::vec3(-29.16f, 25.67f, -10.27f));
-            myCamera.setCameraTarget(glm::vec3(-29.83f, 25.23f, -10.87f));
-        }
-        if (frame == 200) {
-            myCamera.setCameraPosition(glm::vec3(-41.91f, 18.76f, -64.53f));
-            myCamera.setCameraTarget(glm::vec3(-42.49f, 18.46f, -63.77f));
-        }
-        if (frame == 230) {
-            myCamera.setCameraPosition(glm::vec3(-311.97f, 13.23f, -69.40f));
-            myCamera.setCameraTarget(glm::vec3(-310.98f, 13.16f, -69.42f));
-        }
-        if (frame > 230 && frame <= 282) {
-            pressedKeys[GLFW_KEY_Z] = true;
-        }
-        if (frame == 283) {
-            pressedKeys[GLFW_KEY_Z] = false;
-        }
-        if (frame > 283 && frame < 310) {
-            myCamera.setCameraTarget(glm::vec3(-311.65f, 65.26f, -68.45f));
-        }
-        if (frame == 310) {
-            myCamera.setCameraPosition(glm::vec3(-379.76f, 28.93f, -111.14f));
-            myCamera.setCameraTarget(glm::vec3(-379.01f, 28.95f, -110.48f));
-        }
-        if (frame > 310 && frame < 680) {
-            pressedKeys[GLFW_KEY_W] = true;
-            pressedKeys[GLFW_KEY_D] = true;
-        }
-        if (frame == 680) {
-            pressedKeys[GLFW_KEY_W] = false;
-            pressedKeys[GLFW_KEY_D] = false;
-        }
-        if (frame > 680 && frame < 730) {
-            myCamera.setCameraPosition(glm::vec3(-449.02f, 96.34f, -197.84f));
-            myCamera.setCameraTarget(glm::vec3(-448.23f, 96.25f, -197.23f));
-        }
-        if (frame == 730) {
-            myCamera.setCameraPosition(glm::vec3(-60.0f, 10.0f, -70.0f));
-            myCamera.setCameraTarget(glm::vec3(-59.0f, 10.0f, -70.0f));
-            startAnimation = false;
-        }
+    gps::renderStats.Reset();
+
+    // the window's framebuffer (offscreen in headless mode) - no earlier pass is relied on to leave it bound
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+
+    // Sun shadows first, they use their own framebuffer
+    if (sunOn && shadowsOn) {
+        gps::GpuScope scope(gpuProfiler, "Shadow maps");
+        renderShadowMaps();
+    }
+    if (sunOn && lampOn && shadowsOn) {
+        gps::GpuScope scope(gpuProfiler, "Point shadows");
+        renderPointShadows();
+    }
+
+    if (deferredOn) {
+        // Clear the G-buffer, the meshes only write their materials
+        deferredRenderer.BeginGeometry();
     }
     else {
-        frame = 0;
+        // Clear color and depth buffer
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Assign the point lights to the clusters of this view
+        if (sunOn && lampOn) {
+            GPS_PROFILE_ZONE("Light clusters");
+            lightClusters.Update(pointLights, view);
+            lightClusters.Bind(LIGHT_CLUSTER_UNIT);
+        }
     }
 
-    // Clear color and depth buffer for the skybox
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (depthPrepassOn) {
+        gps::GpuScope scope(gpuProfiler, "Depth pre-pass");
+        benchmark.BeginDepthOnly();
+        renderDepthPrepass();
+        benchmark.EndDepthOnly();
+    }
 
     // Render the windmill
-    renderWindmill();
+    {
+        gps::GpuScope scope(gpuProfiler, "Windmill");
+        renderWindmill();
+    }
 
     // Render the lamps
-    renderLamp();
-    renderVillageLamp();
+    {
+        gps::GpuScope scope(gpuProfiler, "Lamps");
+        {
+            gps::GpuScope lampScope(gpuProfiler, "Town lamp");
+            renderLamp();
+        }
+        {
+            gps::GpuScope lampScope(gpuProfiler, "Village lamp");
+            renderVillageLamp();
+        }
+    }
 
     // Render the water
-    renderWater();
-
-    // Render the skybox
-    renderSkybox();
+    {
+        gps::GpuScope scope(gpuProfiler, "Water");
+        renderWater();
+    }
 
     // Render the static scene
-    renderStaticScene();
+    {
+        gps::GpuScope scope(gpuProfiler, "Static scene");
+        renderStaticScene();
+    }
 
     // Render the shiny objects
-    renderShiny();
+    {
+        gps::GpuScope scope(gpuProfiler, "Shiny");
+        renderShiny();
+    }
+
+    if (deferredOn) {
+        // Back to the window - the sun pass also copies the G-buffer depth for the skybox test
+        glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        {
+            gps::GpuScope scope(gpuProfiler, "Lighting");
+            deferredRenderer.Light(sunOn, lampOn, shadowsOn);
+        }
+    }
 
-    // Swap the back buffer with the front buffer
-    glfwSwapBuffers(myWindow.getWindow());
+    // Render the skybox last, on the far plane - only the pixels left uncovered by the meshes are shaded
+    {
+        gps::GpuScope scope(gpuProfiler, "Skybox");
+        renderSkybox();
+    }
+
+    // Render the performance overlay - the counters are taken before it draws
+    overlay.AddFrame(frameTime * 1000.0f, gps::renderStats);
+    if (!myWindow.isHeadless()) {
+        overlay.Draw();
+    }
+}
+
+// frame lifecycle - begin, update, render, present, with a single present per frame
+
+// measure the frame time
+void beginFrame() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    frameTime = std::chrono::duration<GLfloat>(now - lastFrame).count();
+    deltaTime = frameTime;
+    lastFrame = now;
+
+    if (benchmarkMode) {
+        // exactly one step per frame - same camera for the same frame on every run, however fast the frames are
+        deltaTime = SIMULATION_STEP;
+        benchmark.BeginFrame();
+    }
+    frameCinematicTime = cinematicTime;
+
+    // swap programs here, never in the middle of a frame
+    std::vector<std::string> changedShaders;
+    if (shaderWatchOn) {
+        changedShaders = shaderWatcher.TakeChanges();
+    }
+    if (!changedShaders.empty() || shaderReloadRequested) {
+        reloadShaders(changedShaders, shaderReloadRequested);
+        shaderReloadRequested = false;
+    }
+}
+
+// run the simulation steps the frame time covers
+void updateFrame() {
+    simulationAccumulator += glm::min(deltaTime, MAX_FRAME_TIME);
+    while (simulationAccumulator >= SIMULATION_STEP) {
+        updateSimulation();
+        simulationAccumulator -= SIMULATION_STEP;
+    }
+    interpolateRenderState(simulationAccumulator / SIMULATION_STEP);
+}
+
+// draw the scene into the back buffer
+void renderFrame() {
+    gpuProfiler.BeginFrame();
+    renderScene();
+    gpuProfiler.EndFrame();
+}
+
+// swap the back buffer with the front buffer and handle the input that arrived meanwhile
+void presentFrame() {
+    {
+        GPS_PROFILE_ZONE("SwapBuffers");
+        myWindow.SwapBuffers();
+    }
+    {
+        GPS_PROFILE_ZONE("PollEvents");
+        myWindow.PollEvents();
+    }
 }
 
 void cleanup() {
+    shaderWatcher.Stop();
+    basicShaders.Delete();
+    glDeleteBuffers(1, &frameUniformBuffer);
+    lightClusters.Delete();
+    deferredRenderer.Delete();
+    shadowMaps.Delete();
+    pointShadowAtlas.Delete();
+    lightmap.Delete();
+    lightProbes.Delete();
+    occlusionBoxes.Delete();
+    mySkyBox.Delete();
+    overlay.Delete();
+    gpuProfiler.Delete();
     myWindow.Delete();
     // cleanup code for your own data
 }
 
+// command line: --headless renders offscreen without vsync, --frames N sets how many frames it renders
+// --benchmark replays the cinematic uncapped and writes <prefix>.json/.csv, --benchmark-output sets the prefix
+// --gpu-profile FILE times every pass on the GPU and writes a Chrome trace to FILE at exit
+// --cpu-profile FILE records the CPU zones and writes a Chrome trace to FILE at exit
+// --overlay shows the performance overlay from the start
+// --lights N adds N street lights to the two lamps
+// --deferred starts with deferred shading instead of forward
+// --no-shader-watch disables the shader hot reload (headless and benchmark runs never watch)
+// --no-skybox-compression uploads the skybox faces uncompressed
+// --shader-cache DIR sets where linked programs are cached, --no-shader-cache always compiles from source
+// --asset-cache DIR sets where baked lightmaps, light probes and the sky's lighting are kept, --no-lightmap starts without, --rebake-lightmap ignores the cache
+// --vsync on|off|adaptive sets the swap interval, --max-frames-in-flight N how far the CPU may run ahead (0 - driver default)
+void parseArguments(int argc, const char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headlessMode = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            headlessFrameLimit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmarkMode = true;
+        }
+        else if (strcmp(argv[i], "--benchmark-output") == 0 && i + 1 < argc) {
+            benchmarkOutput = argv[++i];
+        }
+        else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc) {
+            gpuTraceFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cpu-profile") == 0 && i + 1 < argc) {
+            cpuTraceFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc) {
+            gps::Shader::setBinaryCacheDirectory(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-shader-cache") == 0) {
+            gps::Shader::setBinaryCacheDirectory("");
+        }
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            streetLightCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--deferred") == 0) {
+            deferredOn = true;
+        }
+        else if (strcmp(argv[i], "--no-shadows") == 0) {
+            shadowsOn = false;
+        }
+        else if (strcmp(argv[i], "--no-lightmap") == 0) {
+            lightmapOn = false;
+        }
+        else if (strcmp(argv[i], "--rebake-lightmap") == 0) {
+            lightmapRebake = true;
+        }
+        else if (strcmp(argv[i], "--asset-cache") == 0 && i + 1 < argc) {
+            assetCacheDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-skybox-compression") == 0) {
+            skyboxCompressionOn = false;
+        }
+        else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            depthPrepassOn = true;
+        }
+        else if (strcmp(argv[i], "--occlusion-culling") == 0) {
+            occlusionCullingOn = true;
+        }
+        else if (strcmp(argv[i], "--no-shader-watch") == 0) {
+            shaderWatchOn = false;
+        }
+        else if (strcmp(argv[i], "--overlay") == 0) {
+            overlayOnStart = true;
+        }
+        else if (strcmp(argv[i], "--vsync") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "off") == 0) {
+                vsyncMode = gps::VSYNC_OFF;
+            }
+            else if (strcmp(argv[i], "adaptive") == 0) {
+                vsyncMode = gps::VSYNC_ADAPTIVE;
+            }
+            else {
+                vsyncMode = gps::VSYNC_ON;
+            }
+        }
+        else if (strcmp(argv[i], "--max-frames-in-flight") == 0 && i + 1 < argc) {
+            maxFramesInFlight = atoi(argv[++i]);
+        }
+    }
+}
+
 int main(int argc, const char* argv[]) {
 
+    parseArguments(argc, argv);
+    if (headlessMode || benchmarkMode) {
+        // reproducible runs - nothing may change the shaders underneath them
+        shaderWatchOn = false;
+    }
+
     try {
         initOpenGLWindow();
     }
@@ -543,18 +1417,91 @@ int main(int argc, const char* argv[]) {
     initModels();
     initShaders();
     initUniforms();
+    initBakedLighting();
+    if (headlessMode || benchmarkMode) {
+        // reproducible runs - the shiny objects are lit by the sky from the first frame
+        mySkyBox.UpdateEnvironment(true);
+    }
+    initCinematic();
+    initSimulation();
     setWindowCallbacks();
 
+    if (benchmarkMode) {
+        vsyncMode = gps::VSYNC_OFF;
+        startAnimation = true;
+        benchmark.Init();
+    }
+    myWindow.SetVSync(vsyncMode);
+    myWindow.SetMaxFramesInFlight(maxFramesInFlight);
+
+    overlay.Init();
+    overlay.setVisible(overlayOnStart && !myWindow.isHeadless());
+    occlusionBoxes.Init();
+    gps::Shader::PrintCacheStats();
+
+    gpuProfiler.Init();
+    if (!gpuTraceFile.empty()) {
+        gpuProfiler.setEnabled(true);
+    }
+    if (!cpuTraceFile.empty()) {
+#ifdef GPS_ENABLE_PROFILING
+        gps::CpuProfiler::SetThreadName("Main");
+        gps::CpuProfiler::setEnabled(true);
+#else
+        fprintf(stderr, "WARNING: --cpu-profile needs a build with GPS_ENABLE_PROFILING\n");
+#endif
+    }
+
     glCheckError();
-    // application loop
-    while (!glfwWindowShouldClose(myWindow.getWindow())) {
-        processCameraMovement();
-        renderScene();
+    GLint renderedFrames = 0;
+    std::chrono::steady_clock::time_point loopStart = std::chrono::steady_clock::now();
+    lastFrame = loopStart;
 
-        glfwPollEvents();
-        glfwSwapBuffers(myWindow.getWindow());
+    // application loop
+    while (!myWindow.ShouldClose()) {
+        GPS_PROFILE_ZONE("Frame");
+        beginFrame();
+        updateFrame();
+        renderFrame();
+        presentFrame();
 
         glCheckError();
+
+        renderedFrames++;
+        if (myWindow.isHeadless() && overlayOnStart && renderedFrames % OVERLAY_PRINT_INTERVAL == 0) {
+            printf("Frame %d: %s\n", renderedFrames, overlay.FormatCounters().c_str());
+        }
+        if (benchmarkMode) {
+            benchmark.EndFrame(frameCinematicTime, gps::renderStats);
+            if (startAnimation == false) {
+                myWindow.SetShouldClose(true);
+            }
+        }
+        else if (myWindow.isHeadless() && renderedFrames >= headlessFrameLimit) {
+            myWindow.SetShouldClose(true);
+        }
+    }
+
+    if (benchmarkMode) {
+        benchmark.Finish(benchmarkOutput);
+    }
+
+    if (!gpuTraceFile.empty()) {
+        gpuProfiler.PrintSummary();
+        gpuProfiler.WriteChromeTrace(gpuTraceFile);
+    }
+
+    if (!cpuTraceFile.empty()) {
+        gps::CpuProfiler::setEnabled(false);
+        gps::CpuProfiler::PrintSummary();
+        gps::CpuProfiler::WriteChromeTrace(cpuTraceFile);
+    }
+
+    if (myWindow.isHeadless()) {
+        glFinish();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+        printf("Headless: rendered %d frames in %.2f s (%.2f ms/frame)\n", renderedFrames, seconds,
+            renderedFrames > 0 ? seconds * 1000.0 / renderedFrames : 0.0);
     }
 
     cleanup();
@@ -1,32 +1,89 @@
 #version 410 core
 
-in vec3 fPosition;
-in vec3 fNormal;
+in vec3 fPosEye;
+in vec3 fNormalEye;
 in vec2 fTexCoords;
+#ifdef LIGHTMAP
+in vec2 fLightmapCoords;
+#endif
+#ifdef PROBES
+in vec3 fProbeAmbient;
+#endif
 
+#ifdef GBUFFER
+// material and normal for the deferred lighting passes, see DeferredRenderer
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec4 gSpecular;
+layout(location = 2) out vec4 gNormal;
+#else
 out vec4 fColor;
+#endif
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-
-//positional lights coords
-uniform vec3 lightPosition;
-uniform vec3 lightPosition2;
+//per-frame values - light direction (normalized) is already in eye space
+//clusterScale - x, y: tiles per pixel, z, w: scale and bias from log(depth) to a depth slice
+//clusterGrid  - tiles across, tiles down, depth slices, point lights
+//shadowMatrices - eye space to shadow map coordinates, one per cascade
+//cascadeSplits  - eye distance where each cascade ends
+//shadowTexelSizes - world size of a shadow map texel, per cascade
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 clusterScale;
+    ivec4 clusterGrid;
+    mat4 shadowMatrices[4];
+    vec4 cascadeSplits;
+    vec4 shadowTexelSizes;
+};
 
 // textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 
-//bools
-uniform bool sunOn;
-uniform bool lampOn;
-uniform bool isShiny;
+#ifdef SHADOWS
+// sun shadow cascades, one per layer, see CascadedShadowMap
+uniform sampler2DArrayShadow shadowMap;
+#ifdef LAMPS_ON
+// point light distance cubes, one per shadow slot, see PointShadowAtlas
+uniform samplerCubeArrayShadow pointShadowMap;
+#endif
+#endif
+
+#ifdef LIGHTMAP
+// baked static lighting, see Lightmap - sun direct, sky and bounce, lamps
+uniform sampler2DArray lightmap;
+#ifdef LAMPS_ON
+// the first lights are in the lightmap, the clusters only add the others
+uniform int bakedLights;
+#endif
+#endif
+
+#ifdef ENVIRONMENT
+// the sky's image based lighting, see SkyBox - irradiance as L2 spherical harmonics relative to the sky's mean
+// brightness, and the sky prefiltered for ever rougher reflections down the mip chain
+uniform vec3 environmentIrradiance[9];
+uniform samplerCube environmentSpecular;
+#endif
+
+#ifdef LAMPS_ON
+// clustered point lights, filled by LightClusters every frame
+uniform samplerBuffer pointLights;      // two texels per light - eye space position + range, color + shadow slot
+uniform usamplerBuffer lightClusters;   // offset and count of the cluster's lights in lightIndices
+uniform usamplerBuffer lightIndices;
+#endif
+
+//variants - compiled in with #define instead of branching on uniforms
+//SUN_ON   - directional light (without it the texture is shown unlit)
+//LAMPS_ON - the clustered point lights, only with SUN_ON
+//SHINY    - white specular highlights instead of the specular texture
+//SHADOWS  - the sun is shadowed through the cascaded shadow map, only with SUN_ON,
+//           and with LAMPS_ON the point lights that have a shadow slot as well
+//LIGHTMAP - ambient and diffuse come from the lightmap, only with SUN_ON; with SHADOWS the shadow map
+//           can still darken the baked sun, with LAMPS_ON the baked lamps are added from it
+//PROBES   - ambient comes from the light probes, sampled per vertex, for moving models next to lightmapped ones
+//ENVIRONMENT - ambient is tinted and shaped by the sky, which is also reflected, only with SUN_ON
+//GBUFFER  - write the G-buffer instead of lighting, the other variants except SHINY are ignored
 
 //components
 vec3 ambient;
@@ -39,68 +96,191 @@ float constant = 1.0f;
 float linear = 0.0045f;
 float quadratic = 0.0075f;
 
+#ifdef SHADOWS
+//fraction of the sun reaching the fragment, from the cascade covering its depth - lit past the last cascade
+float computeShadow(vec3 posEye, vec3 normalEye)
+{
+    int cascade = int(dot(step(cascadeSplits, vec4(-posEye.z)), vec4(1.0f)));
+    if (cascade >= 4) {
+        return 1.0f;
+    }
+    //pushed out along the normal by a texel and a half, so a surface does not shadow itself
+    vec3 offsetPosEye = posEye + normalEye * shadowTexelSizes[cascade] * 1.5f;
+    vec4 shadowCoord = shadowMatrices[cascade] * vec4(offsetPosEye, 1.0f);
+    return texture(shadowMap, vec4(shadowCoord.xy, float(cascade), shadowCoord.z));
+}
+#endif
+
+#ifdef ENVIRONMENT
+//the sky's light arriving around a world space normal, relative to its mean brightness
+vec3 computeIrradiance(vec3 n)
+{
+    float basis[9] = float[9](0.282095f, 0.488603f * n.y, 0.488603f * n.z, 0.488603f * n.x,
+        1.092548f * n.x * n.y, 1.092548f * n.y * n.z, 0.315392f * (3.0f * n.z * n.z - 1.0f), 1.092548f * n.x * n.z, 0.546274f * (n.x * n.x - n.y * n.y));
+    vec3 irradiance = vec3(0.0f);
+    for (int i = 0; i < 9; i++) {
+        irradiance += basis[i] * environmentIrradiance[i];
+    }
+    //L2 rings slightly below zero opposite bright light
+    return max(irradiance, 0.0f);
+}
+#endif
+
 void computeDirLight()
 {
-    //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+    //eye space normal from the vertex shader
+    vec3 normalEye = normalize(fNormalEye);
 
-    //normalize light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
+    vec3 lightDirN = lightDirEye.xyz;
 
     //compute view direction (in eye coordinates, the viewer is situated at the origin
-    vec3 viewDir = normalize(- fPosEye.xyz);
+    vec3 viewDir = normalize(- fPosEye);
 
     //compute ambient light
-    ambient = ambientStrength * lightColor;
+    ambient = ambientStrength * lightColor.rgb;
 
     //compute diffuse light
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor.rgb;
 
     //compute specular light
     vec3 reflectDir = reflect(-lightDirN, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
-    specular = specularStrength * specCoeff * lightColor;
+    specular = specularStrength * specCoeff * lightColor.rgb;
+
+#ifdef SHADOWS
+    float shadow = computeShadow(fPosEye, normalEye);
+    diffuse *= shadow;
+    specular *= shadow;
+#endif
+
+#ifdef LIGHTMAP
+    //the shadow map also holds the windmill, which the bake does not - the darker of the two wins
+    vec3 bakedDirect = texture(lightmap, vec3(fLightmapCoords, 0.0f)).rgb;
+#ifdef SHADOWS
+    diffuse = min(diffuse, bakedDirect);
+#else
+    diffuse = bakedDirect;
+#endif
+    ambient = texture(lightmap, vec3(fLightmapCoords, 1.0f)).rgb;
+#endif
+#ifdef PROBES
+    ambient = fProbeAmbient;
+#endif
+#ifdef ENVIRONMENT
+    //the cube is world aligned - back from eye space with the transposed view rotation
+    ambient *= computeIrradiance(normalEye * mat3(view));
+    //the sky reflected, blurred like the highlight (level 2.5 is its Phong exponent of 32), Schlick's Fresnel at 4%
+    float fresnel = 0.04f + 0.96f * pow(1.0f - max(dot(viewDir, normalEye), 0.0f), 5.0f);
+    vec3 reflectView = reflect(-viewDir, normalEye) * mat3(view);
+    specular += specularStrength * fresnel * textureLod(environmentSpecular, reflectView, 2.5f).rgb;
+#endif
 }
 
-//added function to factor in the positional light
-void computePosLight(vec3 lightPosition) {
-    float distance = length(lightPosition - fPosition);
+#ifdef LAMPS_ON
+//faded to zero at the light's range, where its clusters end
+float computeAttenuation(float distance, float range) {
     float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+    float ratio = distance / range;
+    float fade = clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+    return attenuation * fade * fade;
+}
+
+#ifdef SHADOWS
+//fraction of a point light reaching the fragment, from the light's cube in PointShadowAtlas - lit without one
+float computePointShadow(vec3 posEye, vec3 normalEye, vec3 lightPosEye, float range, float shadowSlot)
+{
+    if (shadowSlot < 0.0f) {
+        return 1.0f;
+    }
+    //pushed out along the normal by a texel and a half - the cube's texels grow with the distance to the light
+    float texelSize = 2.0f * length(posEye - lightPosEye) / float(textureSize(pointShadowMap, 0).x);
+    vec3 toFragment = posEye + normalEye * texelSize * 1.5f - lightPosEye;
+    //the cube faces are world aligned - back from eye space with the transposed view rotation
+    return texture(pointShadowMap, vec4(toFragment * mat3(view), shadowSlot), length(toFragment) / range);
+}
+#endif
+
+//added function to factor in the positional lights - only the ones assigned to this fragment's cluster
+void computePosLights() {
+    ivec3 clusterId = ivec3(ivec2(gl_FragCoord.xy * clusterScale.xy), int(log(-fPosEye.z) * clusterScale.z - clusterScale.w));
+    clusterId = clamp(clusterId, ivec3(0), clusterGrid.xyz - 1);
+    int cluster = (clusterId.z * clusterGrid.y + clusterId.y) * clusterGrid.x + clusterId.x;
+    uvec2 lightRange = texelFetch(lightClusters, cluster).xy;
+
+#ifdef SHADOWS
+    vec3 normalEye = normalize(fNormalEye);
+#endif
+
+    vec3 lampLight = vec3(0.0f);
+    for (uint i = 0u; i < lightRange.y; i++) {
+        int light = int(texelFetch(lightIndices, int(lightRange.x + i)).x);
+#ifdef LIGHTMAP
+        if (light < bakedLights) {
+            continue;
+        }
+#endif
+        vec4 positionRange = texelFetch(pointLights, 2 * light);
+        vec4 colorSlot = texelFetch(pointLights, 2 * light + 1);
+        float attenuation = computeAttenuation(length(positionRange.xyz - fPosEye), positionRange.w);
+#ifdef SHADOWS
+        attenuation *= computePointShadow(fPosEye, normalEye, positionRange.xyz, positionRange.w, colorSlot.a);
+#endif
+        lampLight += attenuation * colorSlot.rgb;
+    }
+    lampLight *= lightColor.rgb;
 
-    diffuse += attenuation * diffuse * lightColor;
-    ambient += attenuation * ambient * lightColor;
-    specular += attenuation * specular * lightColor;
+    diffuse += lampLight * diffuse;
+    ambient += lampLight * ambient;
+    specular += lampLight * specular;
 }
+#endif
 
 void main() 
 {	
-    computeDirLight();
-    if(lampOn) {
-	computePosLight(lightPosition);
-	computePosLight(lightPosition2);
-    }
-	
-    // created variables for texture colors
+    // sampled once and reused
     vec4 diffuseTexColor = texture(diffuseTexture, fTexCoords);
-    vec4 specularTexColor = texture(specularTexture, fTexCoords);
 
     // removed black from border texture and leaves
     if (all(lessThan(diffuseTexColor.rgb, vec3(0.001)))) {
         discard;
     }
 
+#ifdef GBUFFER
+    gAlbedo = vec4(diffuseTexColor.rgb, 1.0f);
+#ifdef SHINY
+    gSpecular = vec4(1.0f);
+#else
+    gSpecular = texture(specularTexture, fTexCoords);
+#endif
+    gNormal = vec4(normalize(fNormalEye), 0.0f);
+#else
     //compute final vertex color
     vec3 color;
 
-    //added light on - off 
-    if(sunOn) {
-	    if(isShiny)
-		color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb + specular, 1.0f);	//add white point
-	    else            
-		color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb + specular * texture(specularTexture, fTexCoords).rgb, 1.0f);	//remove white point
+#ifdef SUN_ON
+    computeDirLight();
+#ifdef LAMPS_ON
+#ifdef LIGHTMAP
+    //the baked lamps come from the lightmap, the clusters are only walked for the lights after them
+    if (clusterGrid.w > bakedLights) {
+        computePosLights();
     }
-    else
-	    color = texture(diffuseTexture, fTexCoords).rgb;
+    ambient += texture(lightmap, vec3(fLightmapCoords, 2.0f)).rgb;
+#else
+    computePosLights();
+#endif
+#endif
+
+#ifdef SHINY
+    color = min((ambient + diffuse) * diffuseTexColor.rgb + specular, 1.0f);	//add white point
+#else
+    vec4 specularTexColor = texture(specularTexture, fTexCoords);
+    color = min((ambient + diffuse) * diffuseTexColor.rgb + specular * specularTexColor.rgb, 1.0f);	//remove white point
+#endif
+#else
+    color = diffuseTexColor.rgb;
+#endif
+
     fColor = vec4(color, 1.0f);
+#endif
 }
@@ -3,19 +3,77 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+#ifdef LIGHTMAP
+layout(location=3) in vec2 vLightmapCoords;
 
-out vec3 fPosition;
-out vec3 fNormal;
+out vec2 fLightmapCoords;
+#endif
+
+out vec3 fPosEye;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
 
+// per-frame values, filled once per frame on the CPU
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 clusterScale;
+    ivec4 clusterGrid;
+    mat4 shadowMatrices[4];
+    vec4 cascadeSplits;
+    vec4 shadowTexelSizes;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix;
+
+#ifdef PROBES
+// baked sky and bounce light for moving models, see LightProbeGrid - nine spherical harmonics coefficients per probe,
+// stored as slabs of the 3D texture one after the other along z
+uniform sampler3D lightProbes;
+uniform vec3 lightProbesOrigin;     // world position of the first probe
+uniform vec3 lightProbesExtent;     // from the first probe to the last
+
+out vec3 fProbeAmbient;
+
+//ambient at a world position and normal, blended from the eight probes around it
+vec3 computeProbeAmbient(vec3 posWorld, vec3 n)
+{
+    ivec3 size = textureSize(lightProbes, 0);
+    int slabDepth = size.z / 9;
+    //texel centres of the first and the last probe, so the lookups stay inside each slab
+    vec3 cell = clamp((posWorld - lightProbesOrigin) / lightProbesExtent, 0.0f, 1.0f) * vec3(size.xy - 1, slabDepth - 1) + 0.5f;
+    vec2 coordsXY = cell.xy / vec2(size.xy);
+
+    float basis[9] = float[9](0.282095f, 0.488603f * n.y, 0.488603f * n.z, 0.488603f * n.x,
+        1.092548f * n.x * n.y, 1.092548f * n.y * n.z, 0.315392f * (3.0f * n.z * n.z - 1.0f), 1.092548f * n.x * n.z, 0.546274f * (n.x * n.x - n.y * n.y));
+    vec3 ambient = vec3(0.0f);
+    for (int i = 0; i < 9; i++) {
+        ambient += basis[i] * textureLod(lightProbes, vec3(coordsXY, (cell.z + float(i * slabDepth)) / float(size.z)), 0.0f).rgb;
+    }
+    //L2 rings slightly below zero opposite bright light
+    return max(ambient, 0.0f);
+}
+#endif
+
+// must match depth.vert bit for bit, the depth pre-pass is followed by a GL_EQUAL test
+invariant gl_Position;
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
+	//eye space position and normal, interpolated for the fragment shader
+	vec4 posEye = view * model * vec4(vPosition, 1.0f);
+	gl_Position = projection * posEye;
+	fPosEye = posEye.xyz;
+	fNormalEye = normalMatrix * vNormal;
 	fTexCoords = vTexCoords;
+#ifdef LIGHTMAP
+	fLightmapCoords = vLightmapCoords;
+#endif
+#ifdef PROBES
+	//moving models are only rotated and translated, the model matrix turns their normals as well
+	fProbeAmbient = computeProbeAmbient(vec3(model * vec4(vPosition, 1.0f)), normalize(mat3(model) * vNormal));
+#endif
 }
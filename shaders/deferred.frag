@@ -0,0 +1,175 @@
+#version 410 core
+
+out vec4 fColor;
+
+//per-frame values, shared with basic.vert/frag
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 clusterScale;
+    ivec4 clusterGrid;
+    mat4 shadowMatrices[4];
+    vec4 cascadeSplits;
+    vec4 shadowTexelSizes;
+};
+
+//G-buffer written by basic.frag with GBUFFER
+uniform sampler2D albedoBuffer;
+uniform sampler2D specularBuffer;
+uniform sampler2D normalBuffer;
+uniform sampler2D depthBuffer;
+
+#ifdef SHADOWS
+//sun shadow cascades, see CascadedShadowMap
+uniform sampler2DArrayShadow shadowMap;
+#ifdef POINT_LIGHT
+//point light distance cubes, one per shadow slot, see PointShadowAtlas
+uniform samplerCubeArrayShadow pointShadowMap;
+#endif
+#endif
+
+//variants
+//SUN_ON      - directional light, without it the albedo is shown unlit
+//POINT_LIGHT - one light volume per point light, added on top of the sun pass
+//SHADOWS     - the sun is shadowed through the cascaded shadow map, a point light through its cube if it has one
+
+#ifdef POINT_LIGHT
+flat in vec4 fLightPositionRangeEye;
+flat in vec3 fLightColor;
+flat in float fShadowSlot;
+#endif
+
+//same lighting as basic.frag
+vec3 ambient;
+float ambientStrength = 0.2f;
+vec3 diffuse;
+vec3 specular;
+float specularStrength = 0.5f;
+
+float constant = 1.0f;
+float linear = 0.0045f;
+float quadratic = 0.0075f;
+
+//eye space position from the depth buffer, inverting the perspective projection
+vec3 reconstructPosEye(ivec2 pixel, float depth)
+{
+    vec2 ndc = (vec2(pixel) + 0.5f) / vec2(textureSize(depthBuffer, 0)) * 2.0f - 1.0f;
+    float zEye = -projection[3][2] / ((depth * 2.0f - 1.0f) + projection[2][2]);
+    return vec3(-zEye * ndc.x / projection[0][0], -zEye * ndc.y / projection[1][1], zEye);
+}
+
+#ifdef SHADOWS
+//fraction of the sun reaching the fragment, from the cascade covering its depth - lit past the last cascade
+float computeShadow(vec3 posEye, vec3 normalEye)
+{
+    int cascade = int(dot(step(cascadeSplits, vec4(-posEye.z)), vec4(1.0f)));
+    if (cascade >= 4) {
+        return 1.0f;
+    }
+    //pushed out along the normal by a texel and a half, so a surface does not shadow itself
+    vec3 offsetPosEye = posEye + normalEye * shadowTexelSizes[cascade] * 1.5f;
+    vec4 shadowCoord = shadowMatrices[cascade] * vec4(offsetPosEye, 1.0f);
+    return texture(shadowMap, vec4(shadowCoord.xy, float(cascade), shadowCoord.z));
+}
+#endif
+
+void computeDirLight(vec3 posEye, vec3 normalEye)
+{
+    vec3 lightDirN = lightDirEye.xyz;
+
+    //compute view direction (in eye coordinates, the viewer is situated at the origin
+    vec3 viewDir = normalize(- posEye);
+
+    //compute ambient light
+    ambient = ambientStrength * lightColor.rgb;
+
+    //compute diffuse light
+    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor.rgb;
+
+    //compute specular light
+    vec3 reflectDir = reflect(-lightDirN, normalEye);
+    float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
+    specular = specularStrength * specCoeff * lightColor.rgb;
+
+#ifdef SHADOWS
+    float shadow = computeShadow(posEye, normalEye);
+    diffuse *= shadow;
+    specular *= shadow;
+#endif
+}
+
+#if defined(SHADOWS) && defined(POINT_LIGHT)
+//fraction of a point light reaching the fragment, from the light's cube in PointShadowAtlas - lit without one
+float computePointShadow(vec3 posEye, vec3 normalEye, vec3 lightPosEye, float range, float shadowSlot)
+{
+    if (shadowSlot < 0.0f) {
+        return 1.0f;
+    }
+    //pushed out along the normal by a texel and a half - the cube's texels grow with the distance to the light
+    float texelSize = 2.0f * length(posEye - lightPosEye) / float(textureSize(pointShadowMap, 0).x);
+    vec3 toFragment = posEye + normalEye * texelSize * 1.5f - lightPosEye;
+    //the cube faces are world aligned - back from eye space with the transposed view rotation
+    return texture(pointShadowMap, vec4(toFragment * mat3(view), shadowSlot), length(toFragment) / range);
+}
+#endif
+
+#ifdef POINT_LIGHT
+//faded to zero at the light's range, the edge of its volume
+float computeAttenuation(float distance, float range) {
+    float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+    float ratio = distance / range;
+    float fade = clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+    return attenuation * fade * fade;
+}
+#endif
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(depthBuffer, pixel, 0).r;
+
+    //no mesh here - left to the skybox, drawn after the lighting
+    if (depth == 1.0f) {
+        discard;
+    }
+
+#ifdef POINT_LIGHT
+    //outside the light's range - skip before reading the rest of the G-buffer
+    vec3 posEye = reconstructPosEye(pixel, depth);
+    float distance = length(fLightPositionRangeEye.xyz - posEye);
+    if (distance >= fLightPositionRangeEye.w) {
+        discard;
+    }
+#elif defined(SUN_ON)
+    vec3 posEye = reconstructPosEye(pixel, depth);
+#endif
+
+    vec3 albedo = texelFetch(albedoBuffer, pixel, 0).rgb;
+    vec3 color;
+
+#ifdef SUN_ON
+    vec3 normalEye = normalize(texelFetch(normalBuffer, pixel, 0).xyz);
+    computeDirLight(posEye, normalEye);
+    vec3 specularColor = texelFetch(specularBuffer, pixel, 0).rgb;
+    color = (ambient + diffuse) * albedo + specular * specularColor;
+
+#ifdef POINT_LIGHT
+    //the lamps brighten the lit terms, as in basic.frag - additive blending sums them over the lights
+    color *= computeAttenuation(distance, fLightPositionRangeEye.w) * fLightColor * lightColor.rgb;
+#ifdef SHADOWS
+    color *= computePointShadow(posEye, normalEye, fLightPositionRangeEye.xyz, fLightPositionRangeEye.w, fShadowSlot);
+#endif
+#endif
+#else
+    color = albedo;
+#endif
+
+    //written to an 8 bit target, which clamps the sum to 1 like min() in basic.frag
+    fColor = vec4(color, 1.0f);
+#ifndef POINT_LIGHT
+    //the light volumes are depth tested against it
+    gl_FragDepth = depth;
+#endif
+}
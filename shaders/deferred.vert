@@ -0,0 +1,40 @@
+#version 410 core
+
+// per-frame values, shared with basic.vert/frag
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 clusterScale;
+    ivec4 clusterGrid;
+    mat4 shadowMatrices[4];
+    vec4 cascadeSplits;
+    vec4 shadowTexelSizes;
+};
+
+#ifdef POINT_LIGHT
+// unit sphere, scaled and moved to each light
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec4 lightPositionRange;
+layout(location=2) in vec4 pointLightColor;
+
+flat out vec4 fLightPositionRangeEye;
+flat out vec3 fLightColor;
+flat out float fShadowSlot;
+#endif
+
+void main()
+{
+#ifdef POINT_LIGHT
+    vec4 posEye = view * vec4(lightPositionRange.xyz + vPosition * lightPositionRange.w, 1.0f);
+    gl_Position = projection * posEye;
+    fLightPositionRangeEye = vec4((view * vec4(lightPositionRange.xyz, 1.0f)).xyz, lightPositionRange.w);
+    fLightColor = pointLightColor.rgb;
+    fShadowSlot = pointLightColor.a;
+#else
+    // full screen triangle from the vertex id, no vertex buffer
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+#endif
+}
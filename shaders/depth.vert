@@ -0,0 +1,27 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+// per-frame values, filled once per frame on the CPU
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 clusterScale;
+    ivec4 clusterGrid;
+    mat4 shadowMatrices[4];
+    vec4 cascadeSplits;
+    vec4 shadowTexelSizes;
+};
+
+uniform mat4 model;
+
+// same expression as basic.vert so the color pass can test with GL_EQUAL
+invariant gl_Position;
+
+void main() 
+{
+	vec4 posEye = view * model * vec4(vPosition, 1.0f);
+	gl_Position = projection * posEye;
+}
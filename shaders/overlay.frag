@@ -0,0 +1,13 @@
+#version 410 core
+
+in vec2 textureCoordinates;
+in vec4 overlayColor;
+out vec4 color;
+
+// font glyphs in the red channel, one fully set cell for solid quads
+uniform sampler2D fontAtlas;
+
+void main()
+{
+    color = vec4(overlayColor.rgb, overlayColor.a * texture(fontAtlas, textureCoordinates).r);
+}
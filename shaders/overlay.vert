@@ -0,0 +1,19 @@
+#version 410 core
+
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec2 vertexTexCoords;
+layout (location = 2) in vec4 vertexColor;
+
+out vec2 textureCoordinates;
+out vec4 overlayColor;
+
+// pixels, origin in the top left corner
+uniform vec2 screenSize;
+
+void main()
+{
+    vec2 ndc = vertexPosition / screenSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+    textureCoordinates = vertexTexCoords;
+    overlayColor = vertexColor;
+}
@@ -0,0 +1,25 @@
+#version 410 core
+
+in vec3 fPosWorld;
+#ifdef CUTOUT
+in vec2 fTexCoords;
+
+uniform sampler2D diffuseTexture;
+#endif
+
+// world position + range of the light, the depth is the distance over the range
+uniform vec4 lightPositionRange;
+
+//variants
+//CUTOUT - the texels basic.frag discards cast no shadow either
+
+void main()
+{
+#ifdef CUTOUT
+    vec4 diffuseTexColor = texture(diffuseTexture, fTexCoords);
+    if (all(lessThan(diffuseTexColor.rgb, vec3(0.001)))) {
+        discard;
+    }
+#endif
+    gl_FragDepth = length(fPosWorld - lightPositionRange.xyz) / lightPositionRange.w;
+}
@@ -0,0 +1,31 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+#ifdef CUTOUT
+layout(location=2) in vec2 vTexCoords;
+
+out vec2 fTexCoords;
+#endif
+#ifdef POINT_LIGHT
+out vec3 fPosWorld;
+#endif
+
+// projection * view of the light for the cascade (or cube face) being drawn
+uniform mat4 lightMatrix;
+uniform mat4 model;
+
+//variants
+//CUTOUT      - meshes with cutout texels, drawn from the full vertex stream so the fragment shader can discard them
+//POINT_LIGHT - a point light's cube face, pointShadow.frag writes the distance to the light
+
+void main() 
+{
+	vec4 posWorld = model * vec4(vPosition, 1.0f);
+	gl_Position = lightMatrix * posWorld;
+#ifdef POINT_LIGHT
+	fPosWorld = posWorld.xyz;
+#endif
+#ifdef CUTOUT
+	fTexCoords = vTexCoords;
+#endif
+}
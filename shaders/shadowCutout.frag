@@ -0,0 +1,14 @@
+#version 410 core
+
+in vec2 fTexCoords;
+
+uniform sampler2D diffuseTexture;
+
+// depth only - the texels basic.frag discards cast no shadow either
+void main() 
+{
+    vec4 diffuseTexColor = texture(diffuseTexture, fTexCoords);
+    if (all(lessThan(diffuseTexColor.rgb, vec3(0.001)))) {
+        discard;
+    }
+}
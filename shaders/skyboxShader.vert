@@ -10,6 +10,7 @@ uniform mat4 model;
 void main()
 {
     vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
+    //z = w puts the sky on the far plane, so the meshes drawn before it reject it with the depth test
     gl_Position = tempPos.xyww;
     textureCoordinates = vertexPosition;
 }